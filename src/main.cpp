@@ -7,27 +7,27 @@ void setup() {
   shell::startupScriptInit();
 #endif
 
-  Serial.begin(shell::kBaudRate);
+  shell::Serial.begin(shell::savedBaudRate());
 #if FEATURE_I2C
-  Wire.begin();
-  shell::setI2cClock(shell::gI2cClockHz);
+  shell::twiBegin();
 #endif
   delay(200);
 
-  Serial.println(F("\nArduino command shell"));
-  Serial.println(F("By: Dan Tudose"));
-  Serial.print(F("Version: "));
-  Serial.println(FW_VERSION);
-  Serial.print(F("Build: "));
-  Serial.print(F(__DATE__));
-  Serial.write(' ');
-  Serial.println(F(__TIME__));
-  Serial.println(F("Type 'help' for full command list."));
+  shell::Serial.println(F("\nArduino command shell"));
+  shell::Serial.println(F("By: Dan Tudose"));
+  shell::Serial.print(F("Version: "));
+  shell::Serial.println(FW_VERSION);
+  shell::Serial.print(F("Build: "));
+  shell::Serial.print(F(__DATE__));
+  shell::Serial.write(' ');
+  shell::Serial.println(F(__TIME__));
+  shell::Serial.println(F("Type 'help' for full command list."));
   //shell::printHelp();
   shell::printPrompt();
 }
 
 void loop() {
   shell::updateBackgroundTasks();
+  shell::updateJobs();
   shell::updateSerial();
 }
@@ -1,7 +1,8 @@
 #pragma once
 
 #include <Arduino.h>
-#include <Wire.h>
+
+#include "shell_math.hpp"
 
 namespace shell {
 
@@ -9,16 +10,46 @@ namespace shell {
 #define DEMO_BAUD 57600UL
 #endif
 constexpr uint32_t kBaudRate = DEMO_BAUD;
+#ifndef RX_LINE_QUEUE_SIZE
+#define RX_LINE_QUEUE_SIZE 96
+#endif
+#ifndef TX_RING_SIZE
+#define TX_RING_SIZE 64
+#endif
 constexpr size_t kCmdBufferSize = 64;
+// Complete lines waiting to run, stored as [echo keep][text]['\0'] records.
+constexpr uint8_t kRxLineQueueSize = RX_LINE_QUEUE_SIZE;
+static_assert(RX_LINE_QUEUE_SIZE > kCmdBufferSize && RX_LINE_QUEUE_SIZE <= 255,
+              "RX_LINE_QUEUE_SIZE must hold one full line and fit in 8 bits");
+constexpr uint8_t kTxRingSize = TX_RING_SIZE;
+static_assert(TX_RING_SIZE >= 32 && TX_RING_SIZE <= 255, "TX_RING_SIZE must be 32..255");
+// Output is formatted into this staging line and moved to the TX ring in one step.
+constexpr uint8_t kTxStageSize = 32;
+// Host must answer "ok" at the new rate within this window or `baud` reverts.
+constexpr uint16_t kBaudConfirmMs = 10000;
 constexpr size_t kMaxArgs = 32;
-constexpr size_t kHistorySize = 8;
-constexpr uint16_t kWatchPeriodMs = 200;
+constexpr size_t kHistorySize = 4;
+// Edge events buffered between watch job steps; a power of two.
+constexpr uint8_t kWatchEvents = 8;
 constexpr uint16_t kDefaultFreqWindowMs = 250;
 constexpr uint16_t kMinFreqWindowMs = 10;
 constexpr uint16_t kMaxFreqWindowMs = 10000;
 constexpr uint8_t kI2cMaxTransferLen = 32;
 constexpr uint32_t kI2cSpeed100kHz = 100000UL;
-constexpr uint32_t kI2cSpeed400kHz = 400000UL;
+// `i2cpage` writes at most one page of this size per transaction and then polls the device
+// for its ACK, for up to kI2cAckPollMs, while the page is programmed.
+constexpr uint8_t kI2cMaxPage = 64;
+constexpr uint16_t kI2cAckPollMs = 50;
+// TWI driver queue depth (a power of two) and the longest a transaction may go without a
+// TWI interrupt before the bus is reset, after the SMBus clock-low timeout.
+constexpr uint8_t kTwiQueueSlots = 4;
+constexpr uint16_t kTwiTimeoutMs = 25;
+constexpr uint8_t kTwiLogEntries = 4;
+// `i2cscan fast`: SCL for the scan (the datasheet's limit, unless i2cspeed is faster), the
+// timeout per probe, and how long one job step may keep probing before the loop gets a turn.
+constexpr uint32_t kI2cScanFastHz = 400000UL;
+constexpr uint16_t kI2cProbeTimeoutUs = 500;
+constexpr uint16_t kI2cScanSliceUs = 2000;
 constexpr uint8_t kEepromEraseValue = 0xFF;
 extern const char kEepromEraseToken[];
 constexpr uint8_t kFsMagic0 = 'E';
@@ -27,6 +58,11 @@ constexpr uint8_t kFsMagic2 = 'S';
 constexpr uint8_t kFsMagic3 = '1';
 constexpr uint8_t kFsVersion = 1;
 constexpr uint8_t kFsRootParent = 0xFF;
+// FS header bytes 10..11 hold the saved UART rate; `fs format` leaves them alone.
+constexpr uint8_t kEepromBaudMagicAddr = 10;
+constexpr uint8_t kEepromBaudCodeAddr = 11;
+constexpr uint8_t kEepromBaudMagic = 'U';
+constexpr uint8_t kFsHeaderClearStart = 12;
 constexpr uint8_t kFsMaxEntries = 16;
 constexpr uint8_t kFsNameBytes = 12;
 constexpr uint8_t kFsEntrySize = 20;
@@ -35,6 +71,78 @@ constexpr uint16_t kFsEntryTableOffset = kFsHeaderSize;
 constexpr uint16_t kFsDataStart =
     kFsEntryTableOffset + (static_cast<uint16_t>(kFsMaxEntries) * kFsEntrySize);
 constexpr uint8_t kUserAnalogCount = 6;
+// Fills unused SRAM at boot; `mem` counts how much of it the stack never touched.
+constexpr uint8_t kStackCanary = 0xC5;
+constexpr int8_t kStackNoCommand = -1;
+constexpr uint8_t kProfSlots = 8;
+constexpr uint8_t kTaskSlots = 4;
+constexpr int8_t kNoTask = -1;
+constexpr uint16_t kMaxBlinkPeriodMs = 60000;
+// Longest pin list a command takes ("2,3,4,..."); every pin once, with room for repeats.
+constexpr uint8_t kMaxPinList = 32;
+constexpr uint8_t kJobSlots = 3;
+constexpr int8_t kNoJob = -1;
+constexpr int8_t kJobRefused = -2; // the starter already said why
+constexpr uint32_t kMaxDelayMs = 600000UL;
+// `freq` on pins without Timer1 inputs samples in slices of this length so other jobs and
+// the prompt keep running.
+constexpr uint16_t kFreqSliceUs = 2000;
+// Timer1 inputs: T1 counts edges against a gate, ICP1 timestamps them.
+constexpr uint8_t kFreqCounterPin = 5;
+constexpr uint8_t kFreqCapturePin = 8;
+// `freq auto` counts on T1 this long, then picks the reciprocal engine below the cutoff.
+constexpr uint8_t kFreqProbeMs = 10;
+constexpr uint32_t kFreqReciprocalMaxHz = 20000UL;
+// `pwidth` times levels on ICP1 with the same capture engine. Edges wait in a ring of
+// kWidthEdges stamps for the job; no edge for kWidthTimeoutMs ends the measurement.
+constexpr uint16_t kDefaultWidthLevels = 16;
+constexpr uint16_t kMaxWidthLevels = 1000;
+constexpr uint8_t kWidthEdges = 8;
+constexpr uint16_t kWidthTimeoutMs = 2000;
+// Timer1 compare outputs for hardware-timed `pulse` trains, clocked at 0.5 us per tick.
+constexpr uint8_t kPulseOc1aPin = 9;
+constexpr uint8_t kPulseOc1bPin = 10;
+// Shorter levels leave the compare ISR too little time to set up the next edge.
+constexpr uint32_t kPulseMinUs = 20;
+constexpr uint32_t kPulseMaxUs = 2000000000UL;
+// `pwmcfg` needs a TOP of at least this many counts (2 bits); duty is in 1/1000 percent.
+constexpr uint32_t kPwmCfgMinSteps = 4;
+constexpr uint32_t kPwmCfgDutyFull = 100000UL;
+// `wave`: user waveforms are resampled to kWaveUserPoints entries (the ISR takes the top
+// 6 bits of the phase for them); the status is read kWaveSettleMs after a start.
+constexpr uint8_t kWaveUserPoints = 64;
+constexpr uint32_t kWaveMaxHz = 5000;
+constexpr uint16_t kWaveSettleMs = 20;
+#ifndef CAPTURE_BUFFER_BYTES
+#define CAPTURE_BUFFER_BYTES 256
+#endif
+// `capture` stores [value][count] runs; the first kCapturePreRuns slots double as the
+// pre-trigger ring.
+constexpr uint16_t kCaptureRuns = CAPTURE_BUFFER_BYTES / 2;
+constexpr uint8_t kCapturePreRuns = 32;
+static_assert(CAPTURE_BUFFER_BYTES >= 128 && CAPTURE_BUFFER_BYTES <= 1024,
+              "CAPTURE_BUFFER_BYTES must be 128..1024");
+constexpr uint32_t kCaptureMinHz = F_CPU / 1024UL / 256UL + 1U; // slowest Timer2 CTC rate
+constexpr uint32_t kCaptureMaxHz = 50000UL;
+constexpr uint32_t kCaptureMaxSamples = 1000000UL;
+#ifndef ADC_BUFFER_BYTES
+#define ADC_BUFFER_BYTES 128
+#endif
+// `adc` double buffer: the ISR fills one block of 16-bit results while the job streams
+// the other.
+constexpr uint8_t kAdcBlockSamples = ADC_BUFFER_BYTES / 4;
+static_assert(ADC_BUFFER_BYTES >= 48 && ADC_BUFFER_BYTES <= 512,
+              "ADC_BUFFER_BYTES must be 48..512");
+constexpr uint16_t kAdcSummaryMs = 1000;
+#ifndef I2C_SNAPSHOT_BYTES
+#define I2C_SNAPSHOT_BYTES 128
+#endif
+// With FEATURE_I2C_SNAPSHOT, `i2cdump` keeps the first I2C_SNAPSHOT_BYTES registers of the
+// last dump for `i2cdump diff`.
+constexpr uint16_t kI2cSnapshotBytes = I2C_SNAPSHOT_BYTES;
+static_assert(I2C_SNAPSHOT_BYTES >= 16 && I2C_SNAPSHOT_BYTES <= 512,
+              "I2C_SNAPSHOT_BYTES must be 16..512");
+constexpr uint8_t kAdcMaxOversampleShift = 3; // 64 samples per result, 13 bits
 
 #ifndef FW_VERSION
 #define FW_VERSION "1.1.0"
@@ -60,10 +168,52 @@ constexpr uint8_t kUserAnalogCount = 6;
 #define FEATURE_LOWLEVEL 1
 #endif
 
+#ifndef FEATURE_BINARY
+#define FEATURE_BINARY 1
+#endif
+
+#ifndef FEATURE_PROF
+#define FEATURE_PROF 0
+#endif
+
+#ifndef FEATURE_CAPTURE
+#define FEATURE_CAPTURE 0
+#endif
+
+#ifndef FEATURE_ADC
+#define FEATURE_ADC 0
+#endif
+
+#ifndef FEATURE_WAVE
+#define FEATURE_WAVE 0
+#endif
+
+#ifndef FEATURE_I2C_SNAPSHOT
+#define FEATURE_I2C_SNAPSHOT 0
+#endif
+
 #if FEATURE_FS && !FEATURE_EEPROM
 #error "FEATURE_FS requires FEATURE_EEPROM=1"
 #endif
 
+#if FEATURE_I2C_SNAPSHOT && !FEATURE_I2C
+#error "FEATURE_I2C_SNAPSHOT requires FEATURE_I2C=1"
+#endif
+
+#ifndef STACK_RESERVE_BYTES
+#define STACK_RESERVE_BYTES 512
+#endif
+// SRAM the stack keeps. The AVR link enforces it on all of .data + .bss (see platformio.ini);
+// the sized buffers are checked here too, against what the rest of the static state (about
+// 1056 B in the default build) leaves, so that oversizing one fails with a clear message.
+constexpr uint16_t kStaticRamOtherBytes = 1056;
+constexpr uint16_t kStaticRamBufferBytes =
+    kHistorySize * kCmdBufferSize + kRxLineQueueSize + kTxRingSize + kTxStageSize +
+    (FEATURE_CAPTURE ? CAPTURE_BUFFER_BYTES : 0) + (FEATURE_ADC ? ADC_BUFFER_BYTES : 0) +
+    (FEATURE_I2C_SNAPSHOT ? I2C_SNAPSHOT_BYTES : 0);
+static_assert(kStaticRamBufferBytes + kStaticRamOtherBytes + STACK_RESERVE_BYTES <= 2048,
+              "buffers leave less than STACK_RESERVE_BYTES of SRAM for the stack");
+
 enum class EscState : uint8_t { None, SeenEsc, SeenEscBracket };
 
 struct FsEntry {
@@ -75,17 +225,64 @@ struct FsEntry {
   uint16_t dataLen = 0;
 };
 
-#if FEATURE_LOWLEVEL
+#if FEATURE_LOWLEVEL || FEATURE_CAPTURE
 enum class PortId : uint8_t { B, C, D };
 #endif
 
+// Command registry row (see shell_registry.cpp). argc counts the command name itself.
+using CommandHandler = void (*)(char *argv[], size_t argc);
+enum class CommandGroup : uint8_t { Shell, Timing, Tasks, Gpio, I2c, Eeprom, Fs, LowLevel };
+constexpr size_t kCommandNameSize = 13;
+
+struct CommandSpec {
+  char name[kCommandNameSize];
+  const char *usage; // PROGMEM
+  const char *desc;  // PROGMEM, may be empty
+  CommandHandler handler;
+  uint8_t minArgc;
+  uint8_t maxArgc;
+  CommandGroup group;
+  bool job; // may be started in the background with a trailing '&'
+};
+
+// Interrupt-driven USART0 driver. It lives in namespace shell so unqualified `Serial`
+// in shell code resolves here; the core's HardwareSerial owns the same vectors and is
+// therefore never linked.
+class ShellSerial : public Print {
+public:
+  void begin(uint32_t baud);
+  uint32_t baud() const { return baud_; }
+  size_t write(uint8_t value) override;
+  size_t write(const uint8_t *buffer, size_t size) override;
+  using Print::write;
+  // Hands the staged partial line to the TX ring without waiting for it to drain.
+  void push();
+  void flush() override;
+  // Bytes typed but not yet executed (current edit line plus queued lines).
+  int available();
+  void discardInput();
+
+private:
+  uint32_t baud_ = 0;
+};
+
+extern ShellSerial Serial;
+
 extern uint8_t gResetFlags;
 #if FEATURE_I2C
 extern uint32_t gI2cClockHz;
+// gI2cClockHz as TWBR and prescaler; the driver programs it at every START.
+extern I2cClock gI2cClock;
 #endif
 
 extern char gCmdBuffer[kCmdBufferSize];
 extern size_t gCmdLen;
+extern char gLineBuffer[kCmdBufferSize];
+extern volatile uint16_t gRxDroppedBytes;
+extern volatile uint16_t gRxDroppedLines;
+extern uint32_t gTxBytes;
+extern uint32_t gTxBlockedUs;
+extern uint16_t gTxStalls;
 extern char gHistory[kHistorySize][kCmdBufferSize];
 extern size_t gHistoryCount;
 extern size_t gHistoryHead;
@@ -93,10 +290,14 @@ extern int gHistoryCursor;
 extern char gEditBackup[kCmdBufferSize];
 extern size_t gEditBackupLen;
 extern EscState gEscState;
+extern const char kPrompt[]; // PROGMEM
 
 void printPrompt();
+// Blanks the prompt and the echoed edit line so asynchronous output can take the line.
+void clearPromptLine();
 void print2Digits(uint32_t value);
 void print3Digits(uint32_t value);
+void printHundredths(uint32_t valueX100);
 void printHexByte(uint8_t value);
 void printHexWord(uint16_t value);
 void printUptimeFormatted(uint32_t ms);
@@ -104,12 +305,38 @@ void readDeviceSignature(uint8_t outSig[3]);
 void printResetCause();
 void captureResetFlags();
 int freeRamEstimate();
+uint16_t stackFloor();
+uint16_t stackMargin();
+void paintFreeStack();
+// Records a new stack low-water mark and returns the current margin; command is a registry
+// index or kStackNoCommand.
+uint16_t noteStackLowWater(int8_t command);
+void resetStackLowWater();
+void printMemReport();
+// Timer0 ticks since boot (kCyclesPerTick CPU cycles each).
+uint32_t timerTicks();
+void printTicks(uint32_t ticks);
+#if FEATURE_PROF
+void profRecord(int8_t command, uint32_t ticks, uint16_t stackBytes);
+void resetProfile();
+void printProfile();
+#endif
 
 bool startsWithIgnoreCase(const char *text, const char *prefix);
 bool equalsIgnoreCase(const char *a, const char *b);
+// Keyword literals stay in flash: equalsIgnoreCase(argv[1], F("reset")).
+bool equalsIgnoreCase(const char *a, const __FlashStringHelper *b);
+// Splits in place: each token is terminated where it stands, nothing is copied.
 size_t splitArgs(char *text, char *argv[], size_t maxArgs);
+// Original text from argv[from] to the end of the line; argv[from..argc-2] lose their
+// terminators, earlier tokens are untouched.
+const char *argTail(char *argv[], size_t argc, size_t from);
 bool parseUnsigned(const char *token, unsigned long &value);
 bool parseUnsignedAuto(const char *token, unsigned long &value);
+// "<n>", "<n>ms" or "<n>us"; a bare number is milliseconds.
+bool parseDurationUs(const char *token, uint32_t &us);
+// "<n>[.ddd]" as thousandths (n up to 4000000), optionally followed by `suffix`.
+bool parseThousandths(const char *token, uint32_t &value, char suffix = '\0');
 bool parseByteValue(const char *token, uint8_t &value);
 
 #if FEATURE_LOWLEVEL
@@ -119,7 +346,11 @@ bool parseAddressValue(const char *token, uint16_t &value);
 #if FEATURE_I2C
 bool parseI2cAddress(const char *token, uint8_t &address);
 bool parseI2cSpeedToken(const char *token, uint32_t &hz);
-bool parseI2cLen(const char *token, uint8_t &length);
+bool parseI2cLen(const char *token, uint16_t &length);
+// Appends a data token to out[count..max): a byte (0..255, decimal or 0x..) or "0x" and an
+// even number of hex digits, more than two, as a byte string in the order written
+// ("0x0102" is 0x01 then 0x02).
+bool parseDataToken(const char *token, uint8_t *out, size_t max, size_t &count);
 #endif
 
 size_t eepromSize();
@@ -132,7 +363,7 @@ bool parseEepromLen(const char *token, size_t &length);
 uint16_t eepromReadU16(size_t addr);
 void eepromWriteU16(size_t addr, uint16_t value);
 size_t fsEntryAddress(uint8_t index);
-bool fsIsValidNameToken(const char *name);
+bool fsIsValidNameToken(const char *name, size_t len);
 void fsSetRootEntry(FsEntry &entry);
 void fsLoadEntry(uint8_t index, FsEntry &entry);
 void fsStoreEntry(uint8_t index, const FsEntry &entry);
@@ -146,21 +377,102 @@ void fsFormat();
 void fsEnsureInitialized();
 #endif
 
-bool fsFindChild(uint8_t parent, const char *name, uint8_t &indexOut, FsEntry &entryOut);
+bool fsFindChild(uint8_t parent, const char *name, size_t nameLen, uint8_t &indexOut,
+                 FsEntry &entryOut);
 bool fsFindFreeEntry(uint8_t &indexOut);
 bool fsHasChildren(uint8_t parentIndex);
+// Paths are resolved as spans of the caller's text; the NUL-terminated forms use strlen.
+bool fsResolvePath(const char *path, size_t len, uint8_t &indexOut, FsEntry &entryOut);
 bool fsResolvePath(const char *path, uint8_t &indexOut, FsEntry &entryOut);
+bool fsResolveDirectory(const char *path, size_t len, uint8_t &indexOut, FsEntry &entryOut);
 bool fsResolveDirectory(const char *path, uint8_t &indexOut, FsEntry &entryOut);
-bool fsSplitParentLeaf(const char *path, char *parentOut, size_t parentOutSize, char *leafOut,
-                       size_t leafOutSize);
+// Parent is path[0..parentLen) (empty means root); the leaf points into path.
+bool fsSplitParentLeaf(const char *path, size_t &parentLen, const char *&leaf, size_t &leafLen);
+
+#if FEATURE_FS
+enum class FsWriteStatus : uint8_t { Ok, InvalidPath, NoParent, IsDirectory, TableFull, NoSpace };
+// Creates or replaces a file; shared by `fs write` and the binary protocol.
+FsWriteStatus fsWriteFile(const char *path, const uint8_t *data, size_t len);
+#endif
 
 #if FEATURE_I2C
-void setI2cClock(uint32_t hz);
+// Interrupt-driven TWI master (shell_twi.cpp). Wire is not linked: it owns the same vector.
+// A transaction is a write, a read, or a write and then a read after a repeated START. The
+// caller owns the descriptor and its buffers from twiSubmit() until they are handed back:
+// the ISR runs queued descriptors back to back and updateTwi() returns finished ones, in
+// order, through their callback. Status values are Wire's endTransmission() codes.
+enum class TwiStatus : uint8_t {
+  Ok = 0,
+  AddrNack = 2,
+  DataNack = 3,
+  BusError = 4,
+  Timeout = 5,
+  ArbLost = 6,
+  Queued,
+  Busy,
+  Paused, // rx is full and more follows; SCL is held low until twiResume()
+};
+struct TwiTxn;
+using TwiCallback = void (*)(TwiTxn &txn);
+struct TwiTxn {
+  uint8_t address = 0;
+  const uint8_t *tx = nullptr;
+  uint8_t txLen = 0; // with rxLen 0 as well: an address-only probe
+  uint8_t *rx = nullptr;
+  uint8_t rxLen = 0;
+  uint16_t rxMore = 0; // read on past rxLen bytes in the same transaction, rx refilled
+  TwiCallback done = nullptr;
+  uint16_t arg = 0;
+  uint16_t timeoutTicks = 0; // without a TWI interrupt; 0 is kTwiTimeoutMs
+  bool ownClock = false;     // run at `clock` instead of the i2cspeed rate
+  I2cClock clock = {0, 0};
+  // Written by the driver.
+  bool queued = false; // from twiSubmit() until handed back
+  TwiStatus status = TwiStatus::Ok;
+  uint8_t txCount = 0; // bytes sent; after DataNack the last of them was refused
+  uint8_t rxCount = 0;
+  uint32_t queuedTicks = 0; // timerTicks() at submit, at the START and at the end
+  uint32_t startTicks = 0;
+  uint32_t endTicks = 0;
+};
+void twiBegin();
+// False while all kTwiQueueSlots are taken.
+bool twiSubmit(TwiTxn &txn);
+// Submits and waits, running background tasks meanwhile. Not for use inside a callback.
+TwiStatus twiRun(TwiTxn &txn);
+// Continues a Paused read into the same rx buffer, rxCount back at 0: the next chunk of up
+// to rxLen bytes (which the caller may change first), until rxMore runs out. Only the very
+// last byte is NACKed.
+void twiResume(TwiTxn &txn);
+// Hands back finished transactions and resets a bus that made no progress for
+// kTwiTimeoutMs. Runs from updateBackgroundTasks(), so callbacks must not print either.
+void updateTwi();
+void printTwiStats();
+void resetTwiStats();
+// Waits for the queue to drain, then clocks SCL by hand (at most 9 pulses) until a slave
+// stuck in a read lets go of SDA, and sends a STOP. Returns whether both lines are high;
+// `pulses` is how many clocks it took.
+bool twiRecoverBus(uint8_t &pulses);
+// Takes effect at the next transaction's START.
+bool setI2cClock(uint32_t hz);
+// "SCL 100000.00 Hz (TWBR 72, prescaler 1), error +0.00%"
+void printI2cClock(uint32_t hz);
+// Blocking helpers over twiRun(). They return the status code (0 = ok, 2 = NACK on
+// address, 3 = NACK on data, ...); reads also report how many bytes arrived.
+uint8_t i2cWriteBytes(uint8_t address, const uint8_t *data, size_t len);
+uint8_t i2cReadBytes(uint8_t address, uint8_t *out, uint8_t len, uint8_t &received);
+// Write, repeated START, read: one transaction, so no other traffic can come between.
+uint8_t i2cWriteRead(uint8_t address, const uint8_t *data, uint8_t len, uint8_t *out,
+                     uint8_t outLen, uint8_t &received);
 void printI2cAddress(uint8_t address);
 void printI2cTxStatus(uint8_t status);
+// `i2cscan id`: the id register of the known devices that sit at `address` (false when
+// none do), and the name of the one whose id that register holds, or nullptr.
+bool i2cIdRegister(uint8_t address, uint8_t &reg);
+const __FlashStringHelper *i2cIdName(uint8_t address, uint8_t value);
 #endif
 
-#if FEATURE_LOWLEVEL
+#if FEATURE_LOWLEVEL || FEATURE_CAPTURE
 bool parsePortId(const char *token, PortId &port);
 char portLetter(PortId port);
 volatile uint8_t &ddrForPort(PortId port);
@@ -169,12 +481,57 @@ volatile uint8_t &pinForPort(PortId port);
 #endif
 
 bool parsePinToken(const char *token, int &pin);
+// Comma-separated pins ("13" or "12,13,A0") in the order given; 0 for a bad list or one
+// longer than maxPins.
+uint8_t parsePinSequence(const char *token, uint8_t pins[], uint8_t maxPins);
+// The same list as a bit per Arduino pin number.
+bool parsePinList(const char *token, uint32_t &mask);
 bool parseAnalogPinToken(const char *token, uint8_t &analogIndex, int &pin);
 void printPinLabel(int pin);
-bool isPwmCapablePin(int pin);
+void printPinList(uint32_t mask);
+// Timer and compare channel behind a PWM pin. analogWrite() gives 8 bits on all of them;
+// the Timer1 pins also take `pwmcfg` and hardware `pulse` trains.
+struct PwmPinInfo {
+  uint8_t timer;
+  char channel; // 'A' or 'B'
+};
+bool isPwmCapablePin(int pin, PwmPinInfo &info);
+void printPwmPinInfo(int pin, const PwmPinInfo &info);
+// Hands a PWM pin back to its PORT bit, as digitalWrite() does, without touching the level.
+void detachPwm(uint8_t pin);
+
+// Direct port access. Pins are looked up in the core's variant tables, so every pin it
+// numbers lands on its real port bit, D20-D22 included. A FastPin is resolved once and then
+// costs a load or store per access, where digitalWrite() looks the pin up in flash and checks
+// its timer every time. `in` points at PINx; the AVR I/O map puts DDRx and PORTx right after
+// it.
+struct FastPin {
+  volatile uint8_t *in;
+  uint8_t mask;
+};
+// 0 = port B, 1 = port C, 2 = port D (the PCINT group order).
+inline uint8_t pinPortIndex(uint8_t pin) {
+  return static_cast<uint8_t>(digitalPinToPort(pin) - PB);
+}
+inline uint8_t pinBitMask(uint8_t pin) { return digitalPinToBitMask(pin); }
+inline volatile uint8_t *portInput(uint8_t index) { return &PINB + 3U * index; }
+inline FastPin fastPin(uint8_t pin) {
+  return {portInputRegister(digitalPinToPort(pin)), pinBitMask(pin)};
+}
+inline bool fastRead(const FastPin &io) { return (*io.in & io.mask) != 0; }
+// Writing a 1 to PINx flips the PORTx bit in one store, leaving the other bits alone, so
+// neither call needs interrupts off even though tone() toggles its pin from an ISR.
+inline void fastToggle(const FastPin &io) { *io.in = io.mask; }
+inline void fastWrite(const FastPin &io, bool high) {
+  if (((io.in[2] & io.mask) != 0) != high) {
+    *io.in = io.mask;
+  }
+}
+void fastPinMode(const FastPin &io, uint8_t mode);
+// Drives the pin as an output at `high`, first detaching any PWM the core left on it.
+FastPin fastOutput(uint8_t pin, bool high);
 
 void setCmdBuffer(const char *text);
-void redrawInputLine(size_t previousLen);
 const char *historyEntryFromNewest(size_t newestOffset);
 void pushHistory(const char *line);
 void resetHistoryBrowse();
@@ -183,16 +540,270 @@ void historyDown();
 
 void printHelp();
 void printStatus();
+void handleCommand(char *line);
+// Looks up argv[0] and runs it; shared by the line handler and `time`. `background` is
+// set for a line that ended in '&' and is only accepted by job commands.
+void dispatchCommand(char *argv[], size_t argc, bool background);
+size_t commandCount();
+void readCommand(size_t index, CommandSpec &out);
+int findCommand(const char *name);
+
+void cmdHelp(char *argv[], size_t argc);
+void cmdStatus(char *argv[], size_t argc);
+void cmdVer(char *argv[], size_t argc);
+void cmdId(char *argv[], size_t argc);
+void cmdEcho(char *argv[], size_t argc);
+void cmdReset(char *argv[], size_t argc);
+void cmdFree(char *argv[], size_t argc);
+void cmdMem(char *argv[], size_t argc);
+void cmdUptime(char *argv[], size_t argc);
+void cmdMicros(char *argv[], size_t argc);
+#if FEATURE_PROF
+void cmdProf(char *argv[], size_t argc);
+#endif
+void cmdTime(char *argv[], size_t argc);
+void cmdTasks(char *argv[], size_t argc);
+void cmdTask(char *argv[], size_t argc);
+void cmdBlink(char *argv[], size_t argc);
+void cmdJobs(char *argv[], size_t argc);
+void cmdFg(char *argv[], size_t argc);
+void cmdKill(char *argv[], size_t argc);
+void cmdUart(char *argv[], size_t argc);
+void cmdBaud(char *argv[], size_t argc);
+void cmdPinmode(char *argv[], size_t argc);
+void cmdPins(char *argv[], size_t argc);
+void cmdPinset(char *argv[], size_t argc);
+void cmdDelay(char *argv[], size_t argc);
+void cmdFreq(char *argv[], size_t argc);
+void cmdPwidth(char *argv[], size_t argc);
+void cmdDigitalread(char *argv[], size_t argc);
+void cmdDigitalwrite(char *argv[], size_t argc);
+void cmdAnalogread(char *argv[], size_t argc);
+void cmdPwm(char *argv[], size_t argc);
+void cmdPwmcfg(char *argv[], size_t argc);
+void cmdBench(char *argv[], size_t argc);
+#if FEATURE_TONE
+void cmdTone(char *argv[], size_t argc);
+void cmdNotone(char *argv[], size_t argc);
+#endif
+void cmdPulse(char *argv[], size_t argc);
+void cmdWatch(char *argv[], size_t argc);
+#if FEATURE_CAPTURE
+void cmdCapture(char *argv[], size_t argc);
+#endif
+#if FEATURE_ADC
+void cmdAdc(char *argv[], size_t argc);
+#endif
+#if FEATURE_WAVE
+void cmdWave(char *argv[], size_t argc);
+#endif
+#if FEATURE_I2C
+void cmdI2cspeed(char *argv[], size_t argc);
+void cmdI2cstat(char *argv[], size_t argc);
+void cmdI2cscan(char *argv[], size_t argc);
+void cmdI2cdump(char *argv[], size_t argc);
+void cmdI2cpage(char *argv[], size_t argc);
+void cmdI2cread(char *argv[], size_t argc);
+void cmdI2cwrite(char *argv[], size_t argc);
+void cmdI2cwr(char *argv[], size_t argc);
+void cmdI2crr(char *argv[], size_t argc);
+#endif
+#if FEATURE_EEPROM
+void cmdEepread(char *argv[], size_t argc);
+void cmdEepwrite(char *argv[], size_t argc);
+void cmdEeperase(char *argv[], size_t argc);
+#endif
 #if FEATURE_FS
-void handleFsCommand(const char *rawLine);
+void cmdFs(char *argv[], size_t argc);
 #endif
-bool handleI2cCommand(char *argv[], size_t argc);
-bool handleEepromCommand(char *argv[], size_t argc);
-bool handleGpioCommand(char *argv[], size_t argc);
-bool handleLowLevelCommand(char *argv[], size_t argc);
-void handleCommand(char *line);
+#if FEATURE_LOWLEVEL
+void cmdDdr(char *argv[], size_t argc);
+void cmdPort(char *argv[], size_t argc);
+void cmdPin(char *argv[], size_t argc);
+void cmdPeek(char *argv[], size_t argc);
+void cmdPoke(char *argv[], size_t argc);
+void cmdReg(char *argv[], size_t argc);
+#endif
+void assembleInputByte(char c);
+bool popInputLine(char *out, uint8_t &echoKeep);
+uint8_t inputQueueUsed();
+uint8_t inputQueueHighWater();
+void discardInput();
+void printUartStats();
+bool isSupportedBaud(uint32_t baud);
+uint16_t ubrrForBaud(uint32_t baud);
+uint32_t actualBaud(uint32_t baud);
+void printSupportedBauds();
+uint32_t savedBaudRate();
+#if FEATURE_EEPROM
+void saveBaudRate(uint32_t baud);
+#endif
+#if FEATURE_BINARY
+extern volatile bool gBinaryMode;
+bool binaryMagicByte(char c);
+void binaryRxByte(uint8_t c);
+void updateBinaryProtocol();
+#endif
+void resetUartStats();
 void updateSerial();
 void startupScriptInit();
+// Runs at most one due task per call; tasks may be run from inside Serial writes while the
+// TX ring is full, so task callbacks must not print.
 void updateBackgroundTasks();
+using TaskCallback = void (*)(uint16_t arg);
+int8_t taskStartPeriodic(TaskCallback fn, uint16_t arg, uint32_t periodMs,
+                         const __FlashStringHelper *label);
+int8_t taskStartOnce(TaskCallback fn, uint16_t arg, uint32_t delayMs,
+                     const __FlashStringHelper *label);
+int8_t taskStartBlink(uint32_t pinMask, uint16_t periodMs);
+bool taskStop(uint8_t id);
+void printTasks();
+
+// Timer1 is shared by the freq engines and the pulse generator. The claim fails while
+// analogWrite() drives D9/D10 or another user holds it; release restores the core's setup.
+bool timer1Claim();
+bool timer1InUse();
+void timer1Release();
+// Timer2 likewise, for capture and wave (shell_shared.cpp). The claim fails while tone()
+// or analogWrite() on D3/D11 uses the timer.
+bool timer2Claim();
+bool timer2InUse();
+void timer2Release();
+
+// Timer1 frequency engines (shell_freq.cpp). freqStart() fails while Timer1 is in use,
+// including by analogWrite() on D9/D10.
+bool freqStart(FreqMode mode);
+void freqStop(FreqMode mode, FreqReading &out);
+void printFreqReading(int pin, const FreqReading &reading);
+// High/low level timing on ICP1 (D8) for `pwidth`: Timer1 at F_CPU timestamps both edges
+// of every level, extended past 16 bits by the overflow count.
+bool widthStart(uint16_t levels);
+bool widthStep();
+void widthStop();
+void printWidthReport();
+
+// Hardware pulse trains on OC1A (channel 0, D9) and OC1B (channel 1, D10), shell_pulse.cpp.
+// The compare unit makes every edge; its ISR only programs the next one. Both channels
+// can run at once on the same Timer1 claim.
+int8_t pulseChannelForPin(uint8_t pin); // -1 for pins without a compare output
+bool pulseGenStart(uint8_t channel, uint32_t count, uint32_t highUs, uint32_t lowUs);
+bool pulseGenRunning(uint8_t channel);
+uint32_t pulseGenLeft(uint8_t channel);
+// Leaves the pin LOW and returns how many edges were made late by other interrupts.
+uint16_t pulseGenStop(uint8_t channel);
+
+// Timer1 PWM with ICR1 as TOP on the same OC1A/OC1B channels (shell_pwm.cpp). The channels
+// share frequency and mode; each has its own duty. pwmCfgStart() fails for a frequency the
+// timer cannot make or while someone else holds Timer1.
+uint32_t pwmCfgMaxHz(bool phaseCorrect);
+bool pwmCfgStart(uint8_t channel, uint32_t hz, uint32_t dutyMilli, bool phaseCorrect);
+bool pwmCfgActive(uint8_t channel);
+// Leaves the pin LOW; the last channel hands Timer1 back to the core.
+void pwmCfgStop(uint8_t channel);
+void printPwmCfg(uint8_t channel);
+
+#if FEATURE_CAPTURE
+// Timer2-paced port sampler (shell_capture.cpp). captureArm() claims Timer2 and starts
+// sampling; the ISR stops by itself once the capture is complete or the buffer is full.
+struct CaptureTrigger {
+  uint8_t mask = 0; // 0: start at once
+  uint8_t value = 0;
+  bool edge = false; // fire only when the masked bits change to `value`
+};
+bool parseCaptureTrigger(const char *token, CaptureTrigger &trigger);
+bool captureArm(PortId port, uint32_t rateHz, uint32_t samples, const CaptureTrigger &trigger);
+bool captureRunning();
+void captureAbort();
+void printCaptureSummary();
+void printCaptureDump();
+#endif
+
+#if FEATURE_WAVE
+// DDS generator (shell_wave.cpp): a 32-bit phase accumulator in the Timer2 overflow ISR
+// indexes a wavetable into the PWM duty of D3/D11 (Timer2) or D9/D10 (Timer1).
+enum class WaveShape : uint8_t { Sine, Triangle, User };
+bool waveLoadUser(const uint8_t *points, uint8_t count);
+#if FEATURE_FS
+bool waveLoadFile(const char *path);
+#endif
+// The user table must be loaded before starting WaveShape::User.
+bool waveStart(uint8_t pin, WaveShape shape, uint32_t milliHz);
+bool waveRunning();
+void waveStop();
+void printWaveStatus();
+#endif
+
+#if FEATURE_ADC
+// Interrupt-driven ADC scanner (shell_adc.cpp). Conversions are started by the ADC itself
+// (free-running) or by Timer1 compare B; the ISR scans the channels round-robin, sums
+// 4^osShift rounds per result and fills the double buffer the job drains.
+struct AdcConfig {
+  uint8_t channels[kUserAnalogCount] = {0}; // scan order, 0..5 for A0..A5
+  uint8_t channelCount = 0;
+  uint32_t rateHz = 0; // conversions per second on the Timer1 trigger; 0 = free-running
+  uint8_t clockDiv = 128;
+  uint8_t osShift = 0;
+  uint32_t samples = 0; // results per channel; 0 = until stopped
+  bool binary = false;
+};
+// Highest conversion rate the ADC keeps up with at this clock divider.
+uint32_t adcMaxRate(uint8_t clockDiv);
+bool adcStart(const AdcConfig &config);
+bool adcRunning();
+bool adcBusy(); // started and not yet stopped; analogRead() would disturb it
+void adcStop();
+bool adcBlockReady();
+void adcWriteBlock();
+void adcFoldBlock();
+void printAdcHeader();
+bool adcSummaryReady();
+void printAdcSummary();
+void printAdcEnd();
+#endif
+
+// Pin-change edge log behind `watch` (shell_watch.cpp). One watch at a time; the PCINT
+// handlers stamp each edge with timerTicks() and queue it for the job to print.
+struct WatchEvent {
+  uint32_t ticks;
+  uint8_t group;   // PCINT group: 0 = port B, 1 = port C, 2 = port D
+  uint8_t state;   // port levels just after the edge
+  uint8_t changed; // watched bits that changed
+};
+bool watchStart(uint32_t pinMask);
+void watchStop();
+bool watchPop(WatchEvent &event);
+uint16_t watchTakeDropped();
+void printWatchLevels();
+// Advances prevTicks so the next event prints its delta from this one.
+void printWatchEvent(const WatchEvent &event, uint32_t &prevTicks);
+
+// Jobs are the resumable commands (delay, freq, pulse, watch, i2cscan, ...). They print, so
+// unlike tasks they are stepped only from loop() and from a foreground wait, never from the
+// TX idle hook. Slots are numbered from 1 on the console.
+extern bool gJobDetach; // set by dispatchCommand while a '&' command starts its job
+int8_t jobStartDelay(uint32_t ms);
+// `probe` starts with a short gate count on T1 and then picks the engine (`freq auto`).
+int8_t jobStartFreq(uint8_t pin, FreqMode mode, bool probe, uint32_t windowMs);
+int8_t jobStartWidth(uint16_t levels);
+// Pins with a Timer1 compare output get a hardware train; others are timed in whole ms.
+int8_t jobStartPulse(uint8_t pin, uint32_t count, uint32_t highUs, uint32_t lowUs);
+int8_t jobStartWatch(uint32_t pinMask);
+#if FEATURE_CAPTURE
+int8_t jobStartCapture(PortId port, uint32_t rateHz, uint32_t samples,
+                       const CaptureTrigger &trigger);
+#endif
+#if FEATURE_ADC
+int8_t jobStartAdc(const AdcConfig &config);
+#endif
+#if FEATURE_I2C
+int8_t jobStartScan(bool fast, bool identify);
+#endif
+// Leaves a fresh job running in the background, or waits for it when started without '&'.
+void runJob(int8_t slot);
+// Waits for a background job; kNoJob picks the newest one. False when there is none.
+bool jobForeground(int8_t slot);
+bool jobKill(uint8_t slot);
+void updateJobs();
+void printJobs();
 
 } // namespace shell
@@ -0,0 +1,359 @@
+#include "shell.hpp"
+
+#include <util/atomic.h>
+#include <util/crc16.h>
+
+namespace shell {
+
+#if FEATURE_ADC
+namespace {
+
+constexpr uint8_t kAdmuxBase = _BV(REFS0); // AVcc reference, as analogRead() uses
+constexpr uint8_t kAdcSync0 = 0xA5;
+constexpr uint8_t kAdcSync1 = 0x5A;
+constexpr uint16_t kTimer1Prescalers[] = {1, 8, 64, 256, 1024};
+
+AdcConfig gConfig;
+
+// Double buffer: the ISR fills gBlocks[gFill] while the job drains the other one.
+uint16_t gBlocks[2][kAdcBlockSamples];
+volatile uint8_t gBlockLen[2] = {0, 0}; // nonzero: ready for the job
+uint8_t gFill = 0;
+uint8_t gFillPos = 0;
+uint8_t gDrain = 0;
+uint8_t gBlockCapacity = 0; // whole scans only, so every block starts at the first channel
+
+// Written by the ADC ISR.
+volatile bool gRunning = false;
+uint8_t gQueue[2] = {0, 0}; // channel of the finished conversion, then of the running one
+uint8_t gNextIndex = 0;     // scan position of the next conversion to set up
+uint8_t gExpectIndex = 0;   // scan position the next accepted result belongs to
+uint8_t gRounds = 0;
+uint16_t gAccum[kUserAnalogCount];
+volatile uint32_t gResults = 0; // decimated results per channel
+volatile uint16_t gLostBlocks = 0;
+
+bool gTimer1Held = false;
+bool gOwned = false;
+uint8_t gSavedAdcsra = 0;
+uint8_t gSavedAdcsrb = 0;
+uint8_t gSavedAdmux = 0;
+uint8_t gSavedDidr0 = 0;
+
+// Summary statistics since the last printed line.
+uint16_t gMin[kUserAnalogCount];
+uint16_t gMax[kUserAnalogCount];
+uint32_t gSum[kUserAnalogCount];
+uint16_t gSumCount = 0;
+uint8_t gBlockSeq = 0;
+uint32_t gActualHz = 0;
+
+uint8_t adpsForDiv(uint8_t div) {
+  uint8_t adps = 1;
+  while ((1U << adps) < div) {
+    ++adps;
+  }
+  return adps;
+}
+
+void resetSummary() {
+  for (uint8_t i = 0; i < kUserAnalogCount; ++i) {
+    gMin[i] = 0xFFFF;
+    gMax[i] = 0;
+    gSum[i] = 0;
+  }
+  gSumCount = 0;
+}
+
+// The block the job reads next and how many samples it holds.
+uint8_t takeBlock(const uint16_t *&data) {
+  const uint8_t len = gBlockLen[gDrain];
+  data = gBlocks[gDrain];
+  return len;
+}
+
+void releaseBlock() {
+  gBlockLen[gDrain] = 0;
+  gDrain ^= 1U;
+}
+
+void stopFromIsr() {
+  ADCSRA = static_cast<uint8_t>(ADCSRA & ~(_BV(ADIE) | _BV(ADATE)));
+  if (gFillPos != 0 && gBlockLen[gFill] == 0) {
+    gBlockLen[gFill] = gFillPos;
+  }
+  gRunning = false;
+}
+
+void printChannelList() {
+  for (uint8_t i = 0; i < gConfig.channelCount; ++i) {
+    if (i != 0) {
+      Serial.write(',');
+    }
+    Serial.write('A');
+    Serial.print(gConfig.channels[i]);
+  }
+}
+
+// Runs in the ADC ISR. In free-running mode the next conversion has already started on
+// the old ADMUX when this runs, so the channel written here is two conversions ahead and
+// the queue keeps track of which channel each result came from. Results that do not fit
+// the scan order (the pipeline filling up) are dropped.
+void adcConversionDone() {
+  const uint16_t value = ADC;
+  if (gConfig.rateHz != 0) {
+    TIFR1 = _BV(OCF1B); // the auto trigger fires on the flag's rising edge
+  }
+  const uint8_t done = gQueue[0];
+  const uint8_t next = gConfig.channels[gNextIndex];
+  if (++gNextIndex == gConfig.channelCount) {
+    gNextIndex = 0;
+  }
+  if (gConfig.rateHz == 0) {
+    gQueue[0] = gQueue[1];
+    gQueue[1] = next;
+  } else {
+    gQueue[0] = next;
+  }
+  ADMUX = static_cast<uint8_t>(kAdmuxBase | next);
+
+  if (done != gConfig.channels[gExpectIndex]) {
+    return;
+  }
+  gAccum[gExpectIndex] = static_cast<uint16_t>(gAccum[gExpectIndex] + value);
+  if (++gExpectIndex != gConfig.channelCount) {
+    return;
+  }
+  gExpectIndex = 0;
+  if (++gRounds != (1U << (2U * gConfig.osShift))) {
+    return;
+  }
+  gRounds = 0;
+
+  uint16_t *block = gBlocks[gFill];
+  for (uint8_t i = 0; i < gConfig.channelCount; ++i) {
+    block[gFillPos++] = static_cast<uint16_t>(gAccum[i] >> gConfig.osShift);
+    gAccum[i] = 0;
+  }
+  ++gResults;
+  if (gFillPos >= gBlockCapacity) {
+    if (gBlockLen[gFill ^ 1U] != 0) {
+      // The job has not drained the other block yet; this one is overwritten.
+      if (gLostBlocks != 0xFFFF) {
+        ++gLostBlocks;
+      }
+    } else {
+      gBlockLen[gFill] = gFillPos;
+      gFill ^= 1U;
+    }
+    gFillPos = 0;
+  }
+  if (gConfig.samples != 0 && gResults >= gConfig.samples) {
+    stopFromIsr();
+  }
+}
+
+} // namespace
+
+uint32_t adcMaxRate(uint8_t clockDiv) { return F_CPU / clockDiv / 14UL; }
+
+bool adcStart(const AdcConfig &config) {
+  if (gOwned || config.channelCount == 0) {
+    return false;
+  }
+  if (config.rateHz != 0 && !timer1Claim()) {
+    return false;
+  }
+  gTimer1Held = config.rateHz != 0;
+  gOwned = true;
+  gConfig = config;
+  gBlockCapacity = static_cast<uint8_t>((kAdcBlockSamples / config.channelCount) *
+                                        config.channelCount);
+  gFill = 0;
+  gFillPos = 0;
+  gDrain = 0;
+  gBlockLen[0] = 0;
+  gBlockLen[1] = 0;
+  gNextIndex = config.channelCount > 1 ? 1 : 0;
+  gExpectIndex = 0;
+  gRounds = 0;
+  gResults = 0;
+  gLostBlocks = 0;
+  gBlockSeq = 0;
+  for (uint8_t i = 0; i < kUserAnalogCount; ++i) {
+    gAccum[i] = 0;
+  }
+  resetSummary();
+
+  uint8_t didr = 0;
+  for (uint8_t i = 0; i < config.channelCount; ++i) {
+    didr = static_cast<uint8_t>(didr | _BV(config.channels[i]));
+  }
+  const uint8_t adps = adpsForDiv(config.clockDiv);
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    gSavedAdcsra = ADCSRA;
+    gSavedAdcsrb = ADCSRB;
+    gSavedAdmux = ADMUX;
+    gSavedDidr0 = DIDR0;
+    DIDR0 = static_cast<uint8_t>(DIDR0 | didr); // digital input buffers add noise
+    ADCSRA = static_cast<uint8_t>(_BV(ADEN) | _BV(ADIF) | adps);
+    ADMUX = static_cast<uint8_t>(kAdmuxBase | config.channels[0]);
+    gQueue[0] = config.channels[0];
+    gQueue[1] = config.channels[0];
+    if (config.rateHz == 0) {
+      ADCSRB = 0; // free running
+      ADCSRA = static_cast<uint8_t>(_BV(ADEN) | _BV(ADSC) | _BV(ADATE) | _BV(ADIE) | adps);
+      gActualHz = F_CPU / config.clockDiv / 13UL;
+    } else {
+      // Timer1 CTC: compare B at TOP raises OCF1B once per period, which starts a conversion.
+      uint8_t cs = 0;
+      uint32_t top = 0;
+      for (; cs < sizeof(kTimer1Prescalers) / sizeof(kTimer1Prescalers[0]); ++cs) {
+        top = (F_CPU / kTimer1Prescalers[cs] + config.rateHz / 2U) / config.rateHz;
+        if (top <= 65536UL) {
+          break;
+        }
+      }
+      if (top == 0) {
+        top = 1;
+      }
+      TCCR1B = 0;
+      TCCR1A = 0;
+      TIMSK1 = 0;
+      TCNT1 = 0;
+      OCR1A = static_cast<uint16_t>(top - 1U);
+      OCR1B = static_cast<uint16_t>(top - 1U);
+      TIFR1 = static_cast<uint8_t>(_BV(OCF1A) | _BV(OCF1B) | _BV(TOV1));
+      ADCSRB = static_cast<uint8_t>(_BV(ADTS2) | _BV(ADTS0)); // Timer1 compare match B
+      ADCSRA = static_cast<uint8_t>(_BV(ADEN) | _BV(ADATE) | _BV(ADIE) | adps);
+      TCCR1B = static_cast<uint8_t>(_BV(WGM12) | (cs + 1U));
+      gActualHz = F_CPU / kTimer1Prescalers[cs] / top;
+    }
+    gRunning = true;
+  }
+  return true;
+}
+
+bool adcRunning() { return gRunning; }
+
+bool adcBusy() { return gOwned; }
+
+void adcStop() {
+  if (!gOwned) {
+    return;
+  }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (gRunning) {
+      stopFromIsr();
+    }
+    ADCSRA = static_cast<uint8_t>(gSavedAdcsra & ~(_BV(ADSC) | _BV(ADIF)));
+    ADCSRB = gSavedAdcsrb;
+    ADMUX = gSavedAdmux;
+    DIDR0 = gSavedDidr0;
+  }
+  if (gTimer1Held) {
+    timer1Release();
+    gTimer1Held = false;
+  }
+  gOwned = false;
+}
+
+bool adcBlockReady() { return gBlockLen[gDrain] != 0; }
+
+// Binary block: A5 5A, sequence, sample count, samples (little-endian), CRC-16/CCITT-FALSE
+// over the sequence, count and samples.
+void adcWriteBlock() {
+  const uint16_t *data = nullptr;
+  const uint8_t len = takeBlock(data);
+  uint16_t crc = 0xFFFF;
+  Serial.write(kAdcSync0);
+  Serial.write(kAdcSync1);
+  Serial.write(gBlockSeq);
+  Serial.write(len);
+  crc = _crc_xmodem_update(crc, gBlockSeq++);
+  crc = _crc_xmodem_update(crc, len);
+  for (uint8_t i = 0; i < len; ++i) {
+    const uint8_t lo = static_cast<uint8_t>(data[i]);
+    const uint8_t hi = static_cast<uint8_t>(data[i] >> 8);
+    Serial.write(lo);
+    Serial.write(hi);
+    crc = _crc_xmodem_update(crc, lo);
+    crc = _crc_xmodem_update(crc, hi);
+  }
+  Serial.write(static_cast<uint8_t>(crc));
+  Serial.write(static_cast<uint8_t>(crc >> 8));
+  releaseBlock();
+}
+
+void adcFoldBlock() {
+  const uint16_t *data = nullptr;
+  const uint8_t len = takeBlock(data);
+  uint8_t channel = 0;
+  for (uint8_t i = 0; i < len; ++i) {
+    const uint16_t value = data[i];
+    gMin[channel] = value < gMin[channel] ? value : gMin[channel];
+    gMax[channel] = value > gMax[channel] ? value : gMax[channel];
+    gSum[channel] += value;
+    if (++channel == gConfig.channelCount) {
+      channel = 0;
+      ++gSumCount;
+    }
+  }
+  releaseBlock();
+}
+
+void printAdcHeader() {
+  Serial.print(F("#ADC ch="));
+  printChannelList();
+  Serial.print(F(" hz="));
+  Serial.print(gActualHz);
+  Serial.print(F(" os="));
+  Serial.print(1U << (2U * gConfig.osShift));
+  Serial.print(F(" bits="));
+  Serial.print(10U + gConfig.osShift);
+  Serial.print(F(" block="));
+  Serial.println(gBlockCapacity);
+}
+
+bool adcSummaryReady() { return gSumCount != 0; }
+
+// "A0 min/avg/max ..." over the results folded in since the last line.
+void printAdcSummary() {
+  if (gSumCount == 0) {
+    return;
+  }
+  for (uint8_t i = 0; i < gConfig.channelCount; ++i) {
+    if (i != 0) {
+      Serial.print(F("  "));
+    }
+    Serial.write('A');
+    Serial.print(gConfig.channels[i]);
+    Serial.write(' ');
+    Serial.print(gMin[i]);
+    Serial.write('/');
+    Serial.print(gSum[i] / gSumCount);
+    Serial.write('/');
+    Serial.print(gMax[i]);
+  }
+  Serial.print(F("  ("));
+  Serial.print(gSumCount);
+  Serial.println(F(" per channel)"));
+  resetSummary();
+}
+
+void printAdcEnd() {
+  Serial.print(gConfig.binary ? F("#END adc: ") : F("adc: "));
+  Serial.print(gResults);
+  Serial.print(F(" results per channel at "));
+  Serial.print(gActualHz);
+  Serial.print(F(" Hz conversion rate, "));
+  Serial.print(gLostBlocks);
+  Serial.println(F(" blocks lost."));
+}
+#endif
+
+} // namespace shell
+
+#if FEATURE_ADC
+ISR(ADC_vect) { shell::adcConversionDone(); }
+#endif
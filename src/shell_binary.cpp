@@ -0,0 +1,325 @@
+#include "shell.hpp"
+
+#if FEATURE_BINARY
+
+#include <EEPROM.h>
+#include <string.h>
+#include <util/atomic.h>
+
+namespace shell {
+
+volatile bool gBinaryMode = false;
+
+namespace {
+
+// Entered from text mode with SYN SYN 'B'; left with the Exit op.
+const uint8_t kBinaryMagic[3] = {0x16, 0x16, 'B'};
+constexpr uint8_t kBinaryVersion = 1;
+constexpr uint8_t kBinFrameSize = 48;
+static_assert(kBinFrameSize - 2 <= kFrameMaxData, "frames must fit encodeFrame()");
+// Largest data block carried by a single request or response.
+constexpr uint8_t kBinMaxData = 32;
+
+enum BinaryOp : uint8_t {
+  kOpPing = 0x01,
+  kOpExit = 0x02,
+  kOpPinMode = 0x10,
+  kOpDigitalRead = 0x11,
+  kOpDigitalWrite = 0x12,
+  kOpAnalogRead = 0x18,
+  kOpI2cWrite = 0x20,
+  kOpI2cRead = 0x21,
+  kOpI2cWriteRead = 0x22,
+  kOpEepromRead = 0x30,
+  kOpEepromWrite = 0x31,
+  kOpFsRead = 0x40,
+  kOpFsWrite = 0x41,
+};
+
+enum BinaryStatus : uint8_t {
+  kStatusOk = 0x00,
+  kStatusBadFrame = 0x01,
+  kStatusBadCrc = 0x02,
+  kStatusBadOp = 0x03,
+  kStatusBadArg = 0x04,
+  kStatusI2cError = 0x05,
+  kStatusFsError = 0x06,
+  kStatusBusy = 0x07,
+};
+
+uint8_t gMagicMatched = 0;
+uint8_t gBinFrame[kBinFrameSize];
+volatile uint8_t gBinFrameLen = 0;
+volatile bool gBinFrameReady = false;
+bool gBinFrameOverflow = false;
+volatile bool gBinHelloPending = false;
+
+void writeSerial(const uint8_t *bytes, uint8_t count) { Serial.write(bytes, count); }
+
+// Appends the CRC and streams the COBS-encoded frame plus its 0x00 delimiter.
+void sendFrame(uint8_t *data, uint8_t len) { encodeFrame(data, len, writeSerial); }
+
+bool validPin(uint8_t pin) { return pin < NUM_DIGITAL_PINS; }
+
+// Executes one request. The payload lives in gBinFrame; response data is written to
+// gBinFrame + 2 and its length returned through respLen.
+uint8_t executeOp(uint8_t op, uint8_t *payload, uint8_t payloadLen, uint8_t &respLen) {
+  uint8_t *const resp = gBinFrame + 2;
+  respLen = 0;
+
+  switch (op) {
+    case kOpPing:
+      resp[0] = kBinaryVersion;
+      resp[1] = kBinMaxData;
+      respLen = 2;
+      return kStatusOk;
+
+    case kOpExit:
+      return kStatusOk;
+
+    case kOpPinMode: {
+      if (payloadLen != 2 || !validPin(payload[0]) || payload[1] > 2) {
+        return kStatusBadArg;
+      }
+      static const uint8_t kModes[3] = {INPUT, OUTPUT, INPUT_PULLUP};
+      fastPinMode(fastPin(payload[0]), kModes[payload[1]]);
+      return kStatusOk;
+    }
+
+    case kOpDigitalRead:
+      if (payloadLen != 1 || !validPin(payload[0])) {
+        return kStatusBadArg;
+      }
+      resp[0] = digitalRead(payload[0]) ? 1 : 0;
+      respLen = 1;
+      return kStatusOk;
+
+    case kOpDigitalWrite:
+      if (payloadLen != 2 || !validPin(payload[0]) || payload[1] > 1) {
+        return kStatusBadArg;
+      }
+      fastOutput(payload[0], payload[1] != 0);
+      return kStatusOk;
+
+    case kOpAnalogRead: {
+      if (payloadLen != 1 || payload[0] >= kUserAnalogCount) {
+        return kStatusBadArg;
+      }
+#if FEATURE_ADC
+      if (adcBusy()) {
+        return kStatusBusy;
+      }
+#endif
+      const uint16_t value = static_cast<uint16_t>(analogRead(A0 + payload[0]));
+      resp[0] = static_cast<uint8_t>(value & 0xFFU);
+      resp[1] = static_cast<uint8_t>(value >> 8);
+      respLen = 2;
+      return kStatusOk;
+    }
+
+#if FEATURE_I2C
+    case kOpI2cWrite: {
+      if (payloadLen < 1 || payload[0] > 0x7F) {
+        return kStatusBadArg;
+      }
+      const uint8_t status = i2cWriteBytes(payload[0], payload + 1, payloadLen - 1U);
+      resp[0] = status;
+      respLen = 1;
+      return status == 0 ? kStatusOk : kStatusI2cError;
+    }
+
+    case kOpI2cRead:
+    case kOpI2cWriteRead: {
+      if (payloadLen < 2 || payload[0] > 0x7F || payload[1] == 0 || payload[1] > kBinMaxData ||
+          (op == kOpI2cRead && payloadLen != 2)) {
+        return kStatusBadArg;
+      }
+      // The reply overwrites the request, but the read only starts once all of it is sent.
+      uint8_t received = 0;
+      const uint8_t status = i2cWriteRead(payload[0], payload + 2, payloadLen - 2U, resp,
+                                          payload[1], received);
+      if (status != 0 && received == 0) {
+        resp[0] = status;
+        respLen = 1;
+        return kStatusI2cError;
+      }
+      respLen = received;
+      return kStatusOk;
+    }
+#endif
+
+#if FEATURE_EEPROM
+    case kOpEepromRead:
+    case kOpEepromWrite: {
+      if (payloadLen < 3) {
+        return kStatusBadArg;
+      }
+      const size_t address = static_cast<size_t>(payload[0] | (payload[1] << 8));
+      const size_t length = (op == kOpEepromRead) ? payload[2] : (payloadLen - 2U);
+      if (length == 0 || length > kBinMaxData || address >= eepromSize() ||
+          length > (eepromSize() - address) || (op == kOpEepromRead && payloadLen != 3)) {
+        return kStatusBadArg;
+      }
+      if (op == kOpEepromWrite) {
+        for (size_t i = 0; i < length; ++i) {
+          EEPROM.update(static_cast<int>(address + i), payload[2 + i]);
+        }
+        return kStatusOk;
+      }
+      for (size_t i = 0; i < length; ++i) {
+        resp[i] = EEPROM.read(static_cast<int>(address + i));
+      }
+      respLen = static_cast<uint8_t>(length);
+      return kStatusOk;
+    }
+#endif
+
+#if FEATURE_FS
+    case kOpFsRead: {
+      // [offset lo][offset hi][n][path...]; the caller NUL-terminated the path.
+      if (payloadLen < 4 || payload[2] == 0 || payload[2] > kBinMaxData) {
+        return kStatusBadArg;
+      }
+      if (!fsIsFormatted()) {
+        return kStatusFsError;
+      }
+      uint8_t nodeIndex = kFsRootParent;
+      FsEntry entry;
+      if (!fsResolvePath(reinterpret_cast<const char *>(payload + 3), nodeIndex, entry) ||
+          entry.isDir) {
+        return kStatusFsError;
+      }
+      const uint16_t offset = static_cast<uint16_t>(payload[0] | (payload[1] << 8));
+      uint8_t length = payload[2];
+      if (offset >= entry.dataLen) {
+        return kStatusOk; // End of file: empty data.
+      }
+      if (length > entry.dataLen - offset) {
+        length = static_cast<uint8_t>(entry.dataLen - offset);
+      }
+      for (uint8_t i = 0; i < length; ++i) {
+        resp[i] = EEPROM.read(static_cast<int>(entry.dataStart + offset + i));
+      }
+      respLen = length;
+      return kStatusOk;
+    }
+
+    case kOpFsWrite: {
+      // [path...][0x00][data...]
+      const uint8_t *nul = static_cast<const uint8_t *>(memchr(payload, 0, payloadLen));
+      if (nul == nullptr || nul == payload) {
+        return kStatusBadArg;
+      }
+      if (!fsIsFormatted()) {
+        return kStatusFsError;
+      }
+      const uint8_t pathLen = static_cast<uint8_t>(nul - payload);
+      const FsWriteStatus status = fsWriteFile(reinterpret_cast<const char *>(payload), nul + 1,
+                                               payloadLen - pathLen - 1U);
+      resp[0] = static_cast<uint8_t>(status);
+      respLen = 1;
+      return status == FsWriteStatus::Ok ? kStatusOk : kStatusFsError;
+    }
+#endif
+
+    default:
+      return kStatusBadOp;
+  }
+}
+
+void handleFrame(uint8_t encodedLen) {
+  const uint8_t len = cobsDecode(gBinFrame, encodedLen);
+  if (len < 4) {
+    gBinFrame[0] = 0;
+    gBinFrame[1] = kStatusBadFrame;
+    sendFrame(gBinFrame, 2);
+    return;
+  }
+
+  const uint8_t seq = gBinFrame[0];
+  if (!frameCrcOk(gBinFrame, len)) {
+    gBinFrame[1] = kStatusBadCrc;
+    sendFrame(gBinFrame, 2);
+    return;
+  }
+
+  const uint8_t op = gBinFrame[1];
+  const uint8_t payloadLen = static_cast<uint8_t>(len - 4U);
+  gBinFrame[len - 2] = 0; // Terminates a trailing path argument.
+
+  uint8_t respLen = 0;
+  const uint8_t status = executeOp(op, gBinFrame + 2, payloadLen, respLen);
+  gBinFrame[0] = seq;
+  gBinFrame[1] = status;
+  sendFrame(gBinFrame, static_cast<uint8_t>(2U + respLen));
+
+  if (op == kOpExit && status == kStatusOk) {
+    gBinaryMode = false;
+    Serial.println();
+    printPrompt();
+  }
+}
+
+} // namespace
+
+bool binaryMagicByte(char c) {
+  if (static_cast<uint8_t>(c) != kBinaryMagic[gMagicMatched]) {
+    gMagicMatched = (static_cast<uint8_t>(c) == kBinaryMagic[0]) ? 1 : 0;
+    return false;
+  }
+  if (++gMagicMatched < sizeof(kBinaryMagic)) {
+    return false;
+  }
+
+  gMagicMatched = 0;
+  gBinFrameLen = 0;
+  gBinFrameReady = false;
+  gBinFrameOverflow = false;
+  gBinaryMode = true;
+  gBinHelloPending = true;
+  return true;
+}
+
+void binaryRxByte(uint8_t c) {
+  if (gBinFrameReady) {
+    ++gRxDroppedBytes; // Host sent before reading the previous response.
+    return;
+  }
+  if (c == 0) {
+    if (gBinFrameOverflow) {
+      gBinFrameOverflow = false;
+      gBinFrameLen = 0;
+      ++gRxDroppedLines;
+    } else if (gBinFrameLen > 0) {
+      gBinFrameReady = true;
+    }
+    return;
+  }
+  if (gBinFrameLen < kBinFrameSize) {
+    gBinFrame[gBinFrameLen++] = c;
+  } else {
+    gBinFrameOverflow = true;
+  }
+}
+
+void updateBinaryProtocol() {
+  if (gBinHelloPending) {
+    gBinHelloPending = false;
+    uint8_t hello[5] = {0, kStatusOk, kBinaryVersion};
+    Serial.write(static_cast<uint8_t>(0)); // Resynchronise the host's frame decoder.
+    sendFrame(hello, 3);
+  }
+
+  if (!gBinFrameReady) {
+    return;
+  }
+  handleFrame(gBinFrameLen);
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    gBinFrameLen = 0;
+    gBinFrameReady = false;
+  }
+}
+
+} // namespace shell
+
+#endif
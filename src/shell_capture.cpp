@@ -0,0 +1,311 @@
+#include "shell.hpp"
+
+#include <ctype.h>
+#include <string.h>
+#include <util/atomic.h>
+
+namespace shell {
+
+#if FEATURE_CAPTURE
+namespace {
+
+enum class CaptureState : uint8_t { Idle, Armed, Running, Done };
+
+struct CaptureRun {
+  uint8_t value;
+  uint8_t count;
+};
+
+static_assert((kCapturePreRuns & (kCapturePreRuns - 1)) == 0 &&
+                  kCapturePreRuns <= kCaptureRuns / 2,
+              "kCapturePreRuns must be a power of two no larger than half the buffer");
+
+CaptureRun gRuns[kCaptureRuns];
+
+// Written by the Timer2 ISR while a capture is armed or running.
+volatile CaptureState gState = CaptureState::Idle;
+volatile uint8_t *gSamplePort = &PIND;
+CaptureTrigger gTrigger;
+uint8_t gPrevSample = 0;
+uint8_t gPreHead = 0; // oldest run of the pre-trigger ring
+uint8_t gPreCount = 0;
+uint32_t gPreSamples = 0;
+uint32_t gPreLimit = 0;
+uint16_t gPostStart = 0;
+uint16_t gPostEnd = 0;
+uint32_t gPostSamples = 0;
+uint32_t gPostTarget = 0;
+bool gTruncated = false;
+
+// Described by the dump header.
+PortId gPort = PortId::D;
+uint32_t gRateHz = 0;
+uint32_t gTotalSamples = 0;
+bool gTriggered = false;
+
+bool gTimer2Held = false; // this capture holds the shared Timer2 claim
+
+constexpr uint16_t kTimer2Prescalers[] = {1, 8, 32, 64, 128, 256, 1024};
+
+// CTC mode: one COMPB interrupt every (OCR2A + 1) prescaled clocks. Picks the finest
+// prescaler whose period fits in 8 bits and returns the rate actually achieved.
+uint32_t startSampleClock(uint32_t rateHz) {
+  uint8_t cs = 0;
+  uint32_t top = 0;
+  for (; cs < sizeof(kTimer2Prescalers) / sizeof(kTimer2Prescalers[0]); ++cs) {
+    const uint32_t clock = F_CPU / kTimer2Prescalers[cs];
+    top = (clock + rateHz / 2U) / rateHz;
+    if (top <= 256U) {
+      break;
+    }
+  }
+  if (top == 0) {
+    top = 1;
+  }
+  TCCR2B = 0;
+  TCCR2A = _BV(WGM21);
+  TCNT2 = 0;
+  OCR2A = static_cast<uint8_t>(top - 1U);
+  OCR2B = 0;
+  TIFR2 = static_cast<uint8_t>(_BV(OCF2A) | _BV(OCF2B) | _BV(TOV2));
+  TIMSK2 = _BV(OCIE2B);
+  TCCR2B = static_cast<uint8_t>(cs + 1U);
+  return F_CPU / kTimer2Prescalers[cs] / top;
+}
+
+void finishFromIsr() {
+  TIMSK2 = static_cast<uint8_t>(TIMSK2 & ~_BV(OCIE2B));
+  gState = CaptureState::Done;
+}
+
+void printRun(uint8_t value, uint32_t count, uint8_t &onLine) {
+  if (onLine == 8) {
+    Serial.println();
+    onLine = 0;
+  }
+  if (onLine != 0) {
+    Serial.write(' ');
+  }
+  printHexByte(value);
+  if (count > 1) {
+    Serial.write('*');
+    Serial.print(count);
+  }
+  ++onLine;
+}
+
+} // namespace
+
+// r<bit> / f<bit>: rising or falling edge on one port bit. Eight characters of 0/1/x,
+// most significant bit first: the masked bits match the pattern.
+bool parseCaptureTrigger(const char *token, CaptureTrigger &trigger) {
+  trigger = CaptureTrigger();
+  const char kind = static_cast<char>(tolower(static_cast<unsigned char>(token[0])));
+  if ((kind == 'r' || kind == 'f') && token[1] >= '0' && token[1] <= '7' && token[2] == '\0') {
+    trigger.mask = static_cast<uint8_t>(1U << (token[1] - '0'));
+    trigger.value = (kind == 'r') ? trigger.mask : 0;
+    trigger.edge = true;
+    return true;
+  }
+  if (strlen(token) != 8) {
+    return false;
+  }
+  for (uint8_t i = 0; i < 8; ++i) {
+    const uint8_t bit = static_cast<uint8_t>(0x80U >> i);
+    switch (token[i]) {
+      case '1':
+        trigger.value |= bit;
+        // fall through
+      case '0':
+        trigger.mask |= bit;
+        break;
+      case 'x':
+      case 'X':
+        break;
+      default:
+        return false;
+    }
+  }
+  return trigger.mask != 0;
+}
+
+bool captureArm(PortId port, uint32_t rateHz, uint32_t samples, const CaptureTrigger &trigger) {
+  if (gState == CaptureState::Armed || gState == CaptureState::Running || !timer2Claim()) {
+    return false;
+  }
+  gTimer2Held = true;
+  gSamplePort = &pinForPort(port);
+  gTrigger = trigger;
+  gPrevSample = *gSamplePort;
+  gPreHead = 0;
+  gPreCount = 0;
+  gPreSamples = 0;
+  gPreLimit = samples / 4U;
+  gPostSamples = 0;
+  gTruncated = false;
+  gTriggered = false;
+  gPort = port;
+  gTotalSamples = samples;
+  if (trigger.mask == 0) {
+    gPostStart = 0;
+    gPostTarget = samples;
+    gState = CaptureState::Running;
+  } else {
+    gPostStart = kCapturePreRuns;
+    gState = CaptureState::Armed;
+  }
+  gPostEnd = gPostStart;
+  gRateHz = startSampleClock(rateHz);
+  return true;
+}
+
+bool captureRunning() {
+  if (gState == CaptureState::Done && gTimer2Held) {
+    timer2Release();
+    gTimer2Held = false;
+  }
+  return gState == CaptureState::Armed || gState == CaptureState::Running;
+}
+
+void captureAbort() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (gState == CaptureState::Armed || gState == CaptureState::Running) {
+      TIMSK2 = static_cast<uint8_t>(TIMSK2 & ~_BV(OCIE2B));
+      // Keep what was recorded; a capture that never triggered has nothing to show.
+      gState = gTriggered || gTrigger.mask == 0 ? CaptureState::Done : CaptureState::Idle;
+      gTruncated = true;
+    }
+  }
+  if (gTimer2Held) {
+    timer2Release();
+    gTimer2Held = false;
+  }
+}
+
+void printCaptureSummary() {
+  Serial.print(F("capture "));
+  Serial.write(portLetter(gPort));
+  Serial.print(F(": "));
+  Serial.print(gPreSamples + gPostSamples);
+  Serial.print(F(" samples at "));
+  Serial.print(gRateHz);
+  Serial.print(F(" Hz in "));
+  Serial.print(gPreCount + (gPostEnd - gPostStart));
+  Serial.print(F(" runs"));
+  if (gTruncated) {
+    Serial.print(F(" (stopped early)"));
+  }
+  Serial.println(F(". 'capture dump' prints it."));
+}
+
+// One header line, then runs as <hex value>[*<count>], eight to a line, then #END. The
+// trigger field is the index of the first post-trigger sample, or -1.
+void printCaptureDump() {
+  if (gState != CaptureState::Done) {
+    Serial.println(F("No capture recorded."));
+    return;
+  }
+  Serial.print(F("#CAP port="));
+  Serial.write(portLetter(gPort));
+  Serial.print(F(" hz="));
+  Serial.print(gRateHz);
+  Serial.print(F(" samples="));
+  Serial.print(gPreSamples + gPostSamples);
+  Serial.print(F(" trigger="));
+  if (gTriggered) {
+    Serial.print(gPreSamples);
+  } else {
+    Serial.print(F("-1"));
+  }
+  if (gTruncated) {
+    Serial.print(F(" truncated=1"));
+  }
+  Serial.println();
+
+  // Adjacent runs with the same value (count overflow, ring/post seam) print as one.
+  uint8_t onLine = 0;
+  bool pending = false;
+  uint8_t value = 0;
+  uint32_t count = 0;
+  const uint16_t total = static_cast<uint16_t>(gPreCount + (gPostEnd - gPostStart));
+  for (uint16_t i = 0; i < total; ++i) {
+    const CaptureRun &run =
+        (i < gPreCount) ? gRuns[(gPreHead + i) & (kCapturePreRuns - 1U)]
+                        : gRuns[gPostStart + (i - gPreCount)];
+    if (pending && run.value == value) {
+      count += run.count;
+      continue;
+    }
+    if (pending) {
+      printRun(value, count, onLine);
+    }
+    pending = true;
+    value = run.value;
+    count = run.count;
+  }
+  if (pending) {
+    printRun(value, count, onLine);
+  }
+  if (onLine != 0) {
+    Serial.println();
+  }
+  Serial.println(F("#END"));
+}
+
+#endif
+
+} // namespace shell
+
+#if FEATURE_CAPTURE
+ISR(TIMER2_COMPB_vect) {
+  using namespace shell;
+  const uint8_t sample = *gSamplePort;
+
+  if (gState == CaptureState::Armed) {
+    const bool hit = (sample & gTrigger.mask) == gTrigger.value &&
+                     (!gTrigger.edge || (gPrevSample & gTrigger.mask) != gTrigger.value);
+    gPrevSample = sample;
+    if (!hit) {
+      const uint8_t last =
+          static_cast<uint8_t>((gPreHead + gPreCount - 1U) & (kCapturePreRuns - 1U));
+      if (gPreCount != 0 && gRuns[last].value == sample && gRuns[last].count != 0xFF) {
+        ++gRuns[last].count;
+      } else {
+        if (gPreCount == kCapturePreRuns) {
+          gPreSamples -= gRuns[gPreHead].count;
+          gPreHead = static_cast<uint8_t>((gPreHead + 1U) & (kCapturePreRuns - 1U));
+          --gPreCount;
+        }
+        gRuns[(gPreHead + gPreCount) & (kCapturePreRuns - 1U)] = {sample, 1};
+        ++gPreCount;
+      }
+      // Keep at most gPreLimit samples by trimming the oldest run one sample at a time.
+      if (++gPreSamples > gPreLimit) {
+        --gPreSamples;
+        if (--gRuns[gPreHead].count == 0) {
+          gPreHead = static_cast<uint8_t>((gPreHead + 1U) & (kCapturePreRuns - 1U));
+          --gPreCount;
+        }
+      }
+      return;
+    }
+    gTriggered = true;
+    gPostTarget = gTotalSamples - gPreSamples;
+    gState = CaptureState::Running;
+  }
+
+  if (gPostEnd != gPostStart && gRuns[gPostEnd - 1U].value == sample &&
+      gRuns[gPostEnd - 1U].count != 0xFF) {
+    ++gRuns[gPostEnd - 1U].count;
+  } else if (gPostEnd < kCaptureRuns) {
+    gRuns[gPostEnd++] = {sample, 1};
+  } else {
+    gTruncated = true;
+    finishFromIsr();
+    return;
+  }
+  if (++gPostSamples >= gPostTarget) {
+    finishFromIsr();
+  }
+}
+#endif
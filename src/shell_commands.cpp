@@ -18,178 +18,361 @@ const __FlashStringHelper *selectedBoardName() {
 #endif
 }
 
-void normalize(char *s) {
-  size_t w = 0;
-  bool prevSpace = true;
-
-  for (size_t r = 0; s[r] != '\0'; ++r) {
-    char c = static_cast<char>(tolower(static_cast<unsigned char>(s[r])));
-    if (c == '\t') {
-      c = ' ';
-    }
-    if (c == ' ') {
-      if (prevSpace) {
-        continue;
-      }
-      prevSpace = true;
-      s[w++] = c;
-    } else {
-      prevSpace = false;
-      s[w++] = c;
+void printBaudLine(uint32_t baud) {
+  Serial.print(baud);
+  Serial.print(F(" baud (UBRR "));
+  Serial.print(ubrrForBaud(baud));
+  Serial.print(F(" U2X, actual "));
+  Serial.print(actualBaud(baud));
+  Serial.println(F(")"));
+}
+
+// Waits for the host to type "ok" at the current rate; other lines are line noise.
+bool waitForBaudConfirm() {
+  discardInput();
+  const uint32_t startMs = millis();
+  uint8_t keep = 0;
+  while ((millis() - startMs) < kBaudConfirmMs) {
+    updateBackgroundTasks();
+    if (popInputLine(gLineBuffer, keep) && equalsIgnoreCase(gLineBuffer, F("ok"))) {
+      return true;
     }
   }
+  return false;
+}
 
-  if (w > 0 && s[w - 1] == ' ') {
-    --w;
+// Folds the name to lower case in place, as dispatchCommand() would.
+bool isJobCommand(char *name) {
+  for (char *p = name; *p != '\0'; ++p) {
+    *p = static_cast<char>(tolower(static_cast<unsigned char>(*p)));
+  }
+  const int index = (strlen(name) < kCommandNameSize) ? findCommand(name) : -1;
+  if (index < 0) {
+    return false;
   }
-  s[w] = '\0';
+  CommandSpec spec;
+  readCommand(static_cast<size_t>(index), spec);
+  return spec.job;
 }
 
 } // namespace
 
+// Tokenizes the queued line in place; handlers get slices of it and never copy it again.
 void handleCommand(char *line) {
-  char raw[kCmdBufferSize];
-  strncpy(raw, line, kCmdBufferSize - 1);
-  raw[kCmdBufferSize - 1] = '\0';
-
-  char *trimmed = raw;
-  while (*trimmed != '\0' && isspace(static_cast<unsigned char>(*trimmed))) {
-    ++trimmed;
+  char *argv[kMaxArgs] = {};
+  size_t argc = splitArgs(line, argv, kMaxArgs);
+  if (argc == 0) {
+    return;
+  }
+  // A trailing '&' on its own asks for a background job. Stuck to the last word it only
+  // does for job commands, so "echo a&" or "fs write /f AT&" keep their '&'.
+  char *last = argv[argc - 1];
+  const size_t lastLen = strlen(last);
+  bool background = false;
+  if (lastLen == 1 && last[0] == '&') {
+    background = true;
+    --argc;
+  } else if (last[lastLen - 1] == '&') {
+    last[lastLen - 1] = '\0';
+    background = isJobCommand(argv[0]);
+    if (!background) {
+      last[lastLen - 1] = '&';
+    }
+  }
+  if (argc > 0) {
+    dispatchCommand(argv, argc, background);
   }
+}
 
-  size_t end = strlen(trimmed);
-  while (end > 0 && isspace(static_cast<unsigned char>(trimmed[end - 1]))) {
-    trimmed[end - 1] = '\0';
-    --end;
+void dispatchCommand(char *argv[], size_t argc, bool background) {
+  // Only the command name is case-folded; arguments keep their case for paths and text.
+  for (char *p = argv[0]; *p != '\0'; ++p) {
+    *p = static_cast<char>(tolower(static_cast<unsigned char>(*p)));
+  }
+  const int index = (strlen(argv[0]) < kCommandNameSize) ? findCommand(argv[0]) : -1;
+  if (index < 0) {
+    Serial.print(F("Unknown command: "));
+    Serial.println(argTail(argv, argc, 0));
+    Serial.println(F("Type 'help'"));
+    return;
   }
 
-  if (trimmed[0] == '\0') {
+  CommandSpec spec;
+  readCommand(static_cast<size_t>(index), spec);
+  if (argc < spec.minArgc || argc > spec.maxArgc) {
+    Serial.print(F("Usage: "));
+    Serial.println(reinterpret_cast<const __FlashStringHelper *>(spec.usage));
+    return;
+  }
+  if (background && !spec.job) {
+    Serial.print(spec.name);
+    Serial.println(F(" cannot run in the background."));
     return;
   }
 
-#if FEATURE_FS
-  if (startsWithIgnoreCase(trimmed, "fs")) {
-    const char next = trimmed[2];
-    if (next == '\0' || isspace(static_cast<unsigned char>(next))) {
-      handleFsCommand(trimmed);
+  noteStackLowWater(kStackNoCommand);
+#if FEATURE_PROF
+  // Repaint so this command's own depth can be read back from the canary afterwards.
+  const uint16_t spAtDispatch = SP;
+  paintFreeStack();
+  const uint32_t startTicks = timerTicks();
+#endif
+  gJobDetach = background;
+  spec.handler(argv, argc);
+  gJobDetach = false;
+#if FEATURE_PROF
+  const uint32_t elapsedTicks = timerTicks() - startTicks;
+#endif
+  const uint16_t margin = noteStackLowWater(static_cast<int8_t>(index));
+#if FEATURE_PROF
+  profRecord(static_cast<int8_t>(index), elapsedTicks,
+             static_cast<uint16_t>(spAtDispatch - stackFloor() - margin));
+#else
+  (void)margin;
+#endif
+}
+
+void cmdHelp(char *argv[], size_t argc) { printHelp(); }
+
+void cmdStatus(char *argv[], size_t argc) { printStatus(); }
+
+void cmdVer(char *argv[], size_t argc) {
+  Serial.println(F("\n=== Firmware Info ==="));
+  Serial.print(F("Version: "));
+  Serial.println(FW_VERSION);
+  Serial.print(F("Build: "));
+  Serial.print(F(__DATE__));
+  Serial.write(' ');
+  Serial.println(F(__TIME__));
+  Serial.print(F("Board: "));
+  Serial.println(selectedBoardName());
+  Serial.print(F("MCU: "));
+  Serial.println(F("ATmega328P"));
+  Serial.print(F("F_CPU: "));
+  Serial.print(F_CPU);
+  Serial.println(F(" Hz"));
+  Serial.print(F("UART baud: "));
+  Serial.println(Serial.baud());
+  Serial.print(F("Compiler: "));
+  Serial.println(__VERSION__);
+  Serial.print(F("Reset cause: "));
+  printResetCause();
+  Serial.println();
+  Serial.println(F("=====================\n"));
+}
+
+void cmdId(char *argv[], size_t argc) {
+  uint8_t sig[3] = {0, 0, 0};
+  readDeviceSignature(sig);
+  Serial.print(F("Board: "));
+  Serial.println(selectedBoardName());
+  Serial.print(F("Device ID: 0x"));
+  printHexByte(sig[0]);
+  printHexByte(sig[1]);
+  printHexByte(sig[2]);
+  Serial.println();
+}
+
+void cmdEcho(char *argv[], size_t argc) { Serial.println(argTail(argv, argc, 1)); }
+
+void cmdUptime(char *argv[], size_t argc) {
+  const uint32_t upMs = millis();
+  Serial.print(F("Uptime: "));
+  printUptimeFormatted(upMs);
+  Serial.print(F(" ("));
+  Serial.print(upMs);
+  Serial.println(F(" ms)"));
+}
+
+void cmdFree(char *argv[], size_t argc) {
+  Serial.print(F("Free RAM (estimate): "));
+  Serial.print(freeRamEstimate());
+  Serial.println(F(" bytes"));
+}
+
+void cmdMem(char *argv[], size_t argc) {
+  if (argc == 2) {
+    if (!equalsIgnoreCase(argv[1], F("reset"))) {
+      Serial.println(F("Usage: mem [reset]"));
       return;
     }
+    resetStackLowWater();
+    Serial.println(F("Stack low-water mark cleared."));
+    return;
   }
-#endif
+  printMemReport();
+}
 
-  if (startsWithIgnoreCase(trimmed, "echo")) {
-    const char *text = trimmed + 4;
-    if (*text != '\0' && !isspace(static_cast<unsigned char>(*text))) {
-      Serial.print(F("Unknown command: "));
-      Serial.println(trimmed);
-      Serial.println(F("Type 'help'"));
+#if FEATURE_PROF
+void cmdProf(char *argv[], size_t argc) {
+  if (argc == 2) {
+    if (!equalsIgnoreCase(argv[1], F("reset"))) {
+      Serial.println(F("Usage: prof [reset]"));
       return;
     }
-    while (*text != '\0' && isspace(static_cast<unsigned char>(*text))) {
-      ++text;
-    }
-    Serial.println(text);
+    resetProfile();
+    Serial.println(F("Profile cleared."));
     return;
   }
+  printProfile();
+}
+#endif
 
-  normalize(trimmed);
+void cmdTime(char *argv[], size_t argc) {
+  const uint32_t startTicks = timerTicks();
+  dispatchCommand(argv + 1, argc - 1, false);
+  const uint32_t elapsedTicks = timerTicks() - startTicks;
+  Serial.print(F("time: "));
+  printTicks(elapsedTicks);
+  Serial.println();
+}
 
-  char *argv[kMaxArgs] = {};
-  const size_t argc = splitArgs(trimmed, argv, kMaxArgs);
-  if (argc == 0) {
+void cmdTasks(char *argv[], size_t argc) { printTasks(); }
+
+void cmdTask(char *argv[], size_t argc) {
+  unsigned long id = 0;
+  if (!equalsIgnoreCase(argv[1], F("stop")) || !parseUnsigned(argv[2], id)) {
+    Serial.println(F("Usage: task stop <id>"));
     return;
   }
+  if (id >= kTaskSlots || !taskStop(static_cast<uint8_t>(id))) {
+    Serial.println(F("No such task."));
+    return;
+  }
+  Serial.print(F("Task "));
+  Serial.print(id);
+  Serial.println(F(" stopped."));
+}
 
-  if (strcmp(argv[0], "help") == 0 && argc == 1) {
-    printHelp();
-    return;
-  }
-  if (strcmp(argv[0], "status") == 0 && argc == 1) {
-    printStatus();
-    return;
-  }
-  if (strcmp(argv[0], "ver") == 0 && argc == 1) {
-    Serial.println(F("\n=== Firmware Info ==="));
-    Serial.print(F("Version: "));
-    Serial.println(FW_VERSION);
-    Serial.print(F("Build: "));
-    Serial.print(F(__DATE__));
-    Serial.write(' ');
-    Serial.println(F(__TIME__));
-    Serial.print(F("Board: "));
-    Serial.println(selectedBoardName());
-    Serial.print(F("MCU: "));
-    Serial.println(F("ATmega328P"));
-    Serial.print(F("F_CPU: "));
-    Serial.print(F_CPU);
-    Serial.println(F(" Hz"));
-    Serial.print(F("UART baud: "));
-    Serial.println(kBaudRate);
-    Serial.print(F("Compiler: "));
-    Serial.println(__VERSION__);
-    Serial.print(F("Reset cause: "));
-    printResetCause();
-    Serial.println();
-    Serial.println(F("=====================\n"));
-    return;
-  }
-  if (strcmp(argv[0], "id") == 0 && argc == 1) {
-    uint8_t sig[3] = {0, 0, 0};
-    readDeviceSignature(sig);
-    Serial.print(F("Board: "));
-    Serial.println(selectedBoardName());
-    Serial.print(F("Device ID: 0x"));
-    printHexByte(sig[0]);
-    printHexByte(sig[1]);
-    printHexByte(sig[2]);
-    Serial.println();
+void cmdBlink(char *argv[], size_t argc) {
+  uint32_t pinMask = 0;
+  if (!parsePinList(argv[1], pinMask)) {
+    Serial.println(F("Invalid pin list. Use e.g. 13 or 12,13."));
     return;
   }
-  if (strcmp(argv[0], "uptime") == 0 && argc == 1) {
-    const uint32_t upMs = millis();
-    Serial.print(F("Uptime: "));
-    printUptimeFormatted(upMs);
-    Serial.print(F(" ("));
-    Serial.print(upMs);
-    Serial.println(F(" ms)"));
+  unsigned long periodMs = 0;
+  if (!parseUnsignedAuto(argv[2], periodMs) || periodMs < 2 || periodMs > kMaxBlinkPeriodMs) {
+    Serial.print(F("Invalid period. Use 2.."));
+    Serial.print(kMaxBlinkPeriodMs);
+    Serial.println(F(" ms."));
     return;
   }
-  if (strcmp(argv[0], "free") == 0 && argc == 1) {
-    Serial.print(F("Free RAM (estimate): "));
-    Serial.print(freeRamEstimate());
-    Serial.println(F(" bytes"));
+  const int8_t id = taskStartBlink(pinMask, static_cast<uint16_t>(periodMs));
+  if (id == kNoTask) {
+    Serial.println(F("No free task slot."));
     return;
   }
-  if (strcmp(argv[0], "micros") == 0 && argc == 1) {
-    Serial.print(F("micros(): "));
-    Serial.println(micros());
+  Serial.print(F("Blink task "));
+  Serial.print(id);
+  Serial.println(F(" started."));
+}
+
+void cmdJobs(char *argv[], size_t argc) { printJobs(); }
+
+void cmdFg(char *argv[], size_t argc) {
+  unsigned long id = 0;
+  if (argc == 2 && (!parseUnsigned(argv[1], id) || id == 0 || id > kJobSlots)) {
+    Serial.println(F("No such job."));
     return;
   }
-  if (strcmp(argv[0], "reset") == 0 && argc == 1) {
-    Serial.println(F("Resetting via watchdog..."));
-    Serial.flush();
-    delay(20);
-    wdt_enable(WDTO_15MS);
-    while (true) {
-    }
+  const int8_t slot = (argc == 2) ? static_cast<int8_t>(id - 1) : kNoJob;
+  if (!jobForeground(slot)) {
+    Serial.println(argc == 2 ? F("No such job.") : F("No jobs."));
   }
+}
+
+void cmdKill(char *argv[], size_t argc) {
+  unsigned long id = 0;
+  if (!parseUnsigned(argv[1], id) || id == 0 || id > kJobSlots ||
+      !jobKill(static_cast<uint8_t>(id - 1))) {
+    Serial.println(F("No such job."));
+    return;
+  }
+  Serial.print(F("Job "));
+  Serial.print(id);
+  Serial.println(F(" killed."));
+}
 
-  if (handleI2cCommand(argv, argc)) {
+void cmdMicros(char *argv[], size_t argc) {
+  Serial.print(F("micros(): "));
+  Serial.println(micros());
+}
+
+void cmdUart(char *argv[], size_t argc) {
+  if (argc == 2) {
+    if (!equalsIgnoreCase(argv[1], F("reset"))) {
+      Serial.println(F("Usage: uart [reset]"));
+      return;
+    }
+    resetUartStats();
+    Serial.println(F("UART counters cleared."));
     return;
   }
-  if (handleEepromCommand(argv, argc)) {
+  printUartStats();
+}
+
+void cmdBaud(char *argv[], size_t argc) {
+  if (argc == 1) {
+    Serial.print(F("UART: "));
+    printBaudLine(Serial.baud());
+    Serial.print(F("Boot rate: "));
+    Serial.println(savedBaudRate());
     return;
   }
-  if (handleGpioCommand(argv, argc)) {
+
+  unsigned long baud = 0;
+  bool save = false;
+  if (argc == 3) {
+#if FEATURE_EEPROM
+    save = equalsIgnoreCase(argv[2], F("save"));
+#endif
+    if (!save) {
+      Serial.println(F("Usage: baud [rate] [save]"));
+      return;
+    }
+  }
+  if (!parseUnsigned(argv[1], baud) || !isSupportedBaud(baud)) {
+    Serial.print(F("Invalid rate. Use "));
+    printSupportedBauds();
+    Serial.println();
     return;
   }
-  if (handleLowLevelCommand(argv, argc)) {
+
+  const uint32_t previous = Serial.baud();
+  Serial.print(F("Switching to "));
+  printBaudLine(baud);
+  Serial.print(F("Reconnect and send 'ok' within "));
+  Serial.print(kBaudConfirmMs / 1000U);
+  Serial.println(F(" s or the rate reverts."));
+  Serial.flush();
+
+  Serial.begin(baud);
+  if (!waitForBaudConfirm()) {
+    Serial.begin(previous);
+    Serial.print(F("\nNo confirmation; back at "));
+    Serial.print(previous);
+    Serial.println(F(" baud."));
     return;
   }
 
-  Serial.print(F("Unknown command: "));
-  Serial.println(trimmed);
-  Serial.println(F("Type 'help'"));
+  Serial.print(F("Baud "));
+  Serial.print(baud);
+  Serial.println(F(" confirmed."));
+#if FEATURE_EEPROM
+  if (save) {
+    saveBaudRate(baud);
+    Serial.println(F("Saved as boot rate."));
+  }
+#endif
+}
+
+void cmdReset(char *argv[], size_t argc) {
+  Serial.println(F("Resetting via watchdog..."));
+  Serial.flush();
+  delay(20);
+  wdt_enable(WDTO_15MS);
+  while (true) {
+  }
 }
 
 } // namespace shell
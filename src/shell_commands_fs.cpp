@@ -21,28 +21,13 @@ void printFsHelp() {
   Serial.println();
 }
 
-void handleFsCommand(const char *rawLine) {
-  if (rawLine == nullptr) {
-    return;
-  }
-
-  char argsLine[kCmdBufferSize];
-  strncpy(argsLine, rawLine, kCmdBufferSize - 1);
-  argsLine[kCmdBufferSize - 1] = '\0';
-
-  // FS subcommands are short; keep this argv small to reduce stack pressure.
-  char *argv[8] = {};
-  const size_t argc = splitArgs(argsLine, argv, 8);
-  if (argc == 0 || !equalsIgnoreCase(argv[0], "fs")) {
-    return;
-  }
-
-  if (argc == 1 || equalsIgnoreCase(argv[1], "help")) {
+void cmdFs(char *argv[], size_t argc) {
+  if (argc == 1 || equalsIgnoreCase(argv[1], F("help"))) {
     printFsHelp();
     return;
   }
 
-  if (equalsIgnoreCase(argv[1], "format")) {
+  if (equalsIgnoreCase(argv[1], F("format"))) {
     if (argc != 3 || !equalsIgnoreCase(argv[2], kEepromEraseToken)) {
       Serial.print(F("Usage: fs format "));
       Serial.println(kEepromEraseToken);
@@ -61,7 +46,7 @@ void handleFsCommand(const char *rawLine) {
     return;
   }
 
-  if (equalsIgnoreCase(argv[1], "ls")) {
+  if (equalsIgnoreCase(argv[1], F("ls"))) {
     if (argc != 2 && argc != 3) {
       Serial.println(F("Usage: fs ls [path]"));
       return;
@@ -100,7 +85,7 @@ void handleFsCommand(const char *rawLine) {
     return;
   }
 
-  if (equalsIgnoreCase(argv[1], "cat")) {
+  if (equalsIgnoreCase(argv[1], F("cat"))) {
     if (argc != 3) {
       Serial.println(F("Usage: fs cat <path>"));
       return;
@@ -130,29 +115,30 @@ void handleFsCommand(const char *rawLine) {
     return;
   }
 
-  if (equalsIgnoreCase(argv[1], "mkdir")) {
+  if (equalsIgnoreCase(argv[1], F("mkdir"))) {
     if (argc != 3) {
       Serial.println(F("Usage: fs mkdir <path>"));
       return;
     }
 
-    char parentPath[kCmdBufferSize];
-    char leaf[kFsNameBytes];
-    if (!fsSplitParentLeaf(argv[2], parentPath, sizeof(parentPath), leaf, sizeof(leaf))) {
+    size_t parentLen = 0;
+    const char *leaf = nullptr;
+    size_t leafLen = 0;
+    if (!fsSplitParentLeaf(argv[2], parentLen, leaf, leafLen)) {
       Serial.println(F("Invalid path."));
       return;
     }
 
     uint8_t parentIndex = kFsRootParent;
     FsEntry parentEntry;
-    if (!fsResolveDirectory(parentPath, parentIndex, parentEntry)) {
+    if (!fsResolveDirectory(argv[2], parentLen, parentIndex, parentEntry)) {
       Serial.println(F("Parent directory does not exist."));
       return;
     }
 
     uint8_t existingIndex = 0;
     FsEntry existingEntry;
-    if (fsFindChild(parentIndex, leaf, existingIndex, existingEntry)) {
+    if (fsFindChild(parentIndex, leaf, leafLen, existingIndex, existingEntry)) {
       Serial.println(F("Path already exists."));
       return;
     }
@@ -167,8 +153,7 @@ void handleFsCommand(const char *rawLine) {
     newEntry.used = true;
     newEntry.isDir = true;
     newEntry.parent = parentIndex;
-    strncpy(newEntry.name, leaf, kFsNameBytes - 1);
-    newEntry.name[kFsNameBytes - 1] = '\0';
+    memcpy(newEntry.name, leaf, leafLen);
     fsStoreEntry(newIndex, newEntry);
 
     Serial.print(F("Directory created: "));
@@ -176,29 +161,30 @@ void handleFsCommand(const char *rawLine) {
     return;
   }
 
-  if (equalsIgnoreCase(argv[1], "touch")) {
+  if (equalsIgnoreCase(argv[1], F("touch"))) {
     if (argc != 3) {
       Serial.println(F("Usage: fs touch <path>"));
       return;
     }
 
-    char parentPath[kCmdBufferSize];
-    char leaf[kFsNameBytes];
-    if (!fsSplitParentLeaf(argv[2], parentPath, sizeof(parentPath), leaf, sizeof(leaf))) {
+    size_t parentLen = 0;
+    const char *leaf = nullptr;
+    size_t leafLen = 0;
+    if (!fsSplitParentLeaf(argv[2], parentLen, leaf, leafLen)) {
       Serial.println(F("Invalid path."));
       return;
     }
 
     uint8_t parentIndex = kFsRootParent;
     FsEntry parentEntry;
-    if (!fsResolveDirectory(parentPath, parentIndex, parentEntry)) {
+    if (!fsResolveDirectory(argv[2], parentLen, parentIndex, parentEntry)) {
       Serial.println(F("Parent directory does not exist."));
       return;
     }
 
     uint8_t nodeIndex = 0;
     FsEntry nodeEntry;
-    if (fsFindChild(parentIndex, leaf, nodeIndex, nodeEntry)) {
+    if (fsFindChild(parentIndex, leaf, leafLen, nodeIndex, nodeEntry)) {
       if (nodeEntry.isDir) {
         Serial.println(F("Path exists as directory."));
         return;
@@ -216,115 +202,43 @@ void handleFsCommand(const char *rawLine) {
     newEntry.used = true;
     newEntry.isDir = false;
     newEntry.parent = parentIndex;
-    strncpy(newEntry.name, leaf, kFsNameBytes - 1);
-    newEntry.name[kFsNameBytes - 1] = '\0';
+    memcpy(newEntry.name, leaf, leafLen);
     fsStoreEntry(nodeIndex, newEntry);
     Serial.print(F("File created: "));
     Serial.println(argv[2]);
     return;
   }
 
-  if (equalsIgnoreCase(argv[1], "write")) {
-    // Parse path + raw text from the original command to preserve text case and spacing.
-    const char *p = rawLine;
-    while (*p != '\0' && isspace(static_cast<unsigned char>(*p))) {
-      ++p;
-    }
-    while (*p != '\0' && !isspace(static_cast<unsigned char>(*p))) {
-      ++p; // fs
-    }
-    while (*p != '\0' && isspace(static_cast<unsigned char>(*p))) {
-      ++p;
-    }
-    while (*p != '\0' && !isspace(static_cast<unsigned char>(*p))) {
-      ++p; // write
-    }
-    while (*p != '\0' && isspace(static_cast<unsigned char>(*p))) {
-      ++p;
-    }
-    if (*p == '\0') {
+  if (equalsIgnoreCase(argv[1], F("write"))) {
+    if (argc < 3) {
       Serial.println(F("Usage: fs write <path> <text>"));
       return;
     }
-
-    const char *pathStart = p;
-    while (*p != '\0' && !isspace(static_cast<unsigned char>(*p))) {
-      ++p;
-    }
-    const size_t pathLen = static_cast<size_t>(p - pathStart);
-    if (pathLen == 0 || pathLen >= kCmdBufferSize) {
-      Serial.println(F("Invalid path."));
-      return;
-    }
-
-    char path[kCmdBufferSize];
-    memcpy(path, pathStart, pathLen);
-    path[pathLen] = '\0';
-
-    while (*p != '\0' && isspace(static_cast<unsigned char>(*p))) {
-      ++p;
-    }
-    const char *text = p; // May be empty.
+    const char *path = argv[2];
+    // Everything after the path, with its original case and spacing. May be empty.
+    const char *text = argTail(argv, argc, 3);
     const size_t textLen = strlen(text);
 
-    char parentPath[kCmdBufferSize];
-    char leaf[kFsNameBytes];
-    if (!fsSplitParentLeaf(path, parentPath, sizeof(parentPath), leaf, sizeof(leaf))) {
-      Serial.println(F("Invalid path."));
-      return;
-    }
-
-    uint8_t parentIndex = kFsRootParent;
-    FsEntry parentEntry;
-    if (!fsResolveDirectory(parentPath, parentIndex, parentEntry)) {
-      Serial.println(F("Parent directory does not exist."));
-      return;
-    }
-
-    uint8_t nodeIndex = 0;
-    FsEntry nodeEntry;
-    bool exists = fsFindChild(parentIndex, leaf, nodeIndex, nodeEntry);
-    if (exists && nodeEntry.isDir) {
-      Serial.println(F("Path exists as directory."));
-      return;
-    }
-    if (!exists) {
-      if (!fsFindFreeEntry(nodeIndex)) {
+    switch (fsWriteFile(path, reinterpret_cast<const uint8_t *>(text), textLen)) {
+      case FsWriteStatus::Ok:
+        break;
+      case FsWriteStatus::InvalidPath:
+        Serial.println(F("Invalid path."));
+        return;
+      case FsWriteStatus::NoParent:
+        Serial.println(F("Parent directory does not exist."));
+        return;
+      case FsWriteStatus::IsDirectory:
+        Serial.println(F("Path exists as directory."));
+        return;
+      case FsWriteStatus::TableFull:
         Serial.println(F("FS entry table full."));
         return;
-      }
-      nodeEntry.used = true;
-      nodeEntry.isDir = false;
-      nodeEntry.parent = parentIndex;
-      strncpy(nodeEntry.name, leaf, kFsNameBytes - 1);
-      nodeEntry.name[kFsNameBytes - 1] = '\0';
-    }
-
-    if (textLen == 0) {
-      nodeEntry.dataLen = 0;
-      nodeEntry.dataStart = 0;
-      fsStoreEntry(nodeIndex, nodeEntry);
-      Serial.print(F("Wrote 0 bytes to "));
-      Serial.println(path);
-      return;
-    }
-
-    const size_t size = eepromSize();
-    const uint16_t nextFree = fsNextFree();
-    if (nextFree > size || textLen > (size - nextFree)) {
-      Serial.println(F("Not enough EEPROM data space. Run 'fs format confirm'."));
-      return;
-    }
-
-    for (size_t i = 0; i < textLen; ++i) {
-      EEPROM.update(static_cast<int>(nextFree + i), static_cast<uint8_t>(text[i]));
+      case FsWriteStatus::NoSpace:
+        Serial.println(F("Not enough EEPROM data space. Run 'fs format confirm'."));
+        return;
     }
 
-    nodeEntry.dataStart = nextFree;
-    nodeEntry.dataLen = static_cast<uint16_t>(textLen);
-    fsStoreEntry(nodeIndex, nodeEntry);
-    fsSetNextFree(static_cast<uint16_t>(nextFree + textLen));
-
     Serial.print(F("Wrote "));
     Serial.print(textLen);
     Serial.print(F(" byte(s) to "));
@@ -332,7 +246,7 @@ void handleFsCommand(const char *rawLine) {
     return;
   }
 
-  if (equalsIgnoreCase(argv[1], "rm")) {
+  if (equalsIgnoreCase(argv[1], F("rm"))) {
     if (argc != 3) {
       Serial.println(F("Usage: fs rm <path>"));
       return;
@@ -355,7 +269,7 @@ void handleFsCommand(const char *rawLine) {
     return;
   }
 
-  if (equalsIgnoreCase(argv[1], "stat")) {
+  if (equalsIgnoreCase(argv[1], F("stat"))) {
     if (argc != 2) {
       Serial.println(F("Usage: fs stat"));
       return;
@@ -1,363 +1,748 @@
 #include "shell.hpp"
 
 #include <string.h>
+#include <util/atomic.h>
 
 namespace shell {
 
-bool handleGpioCommand(char *argv[], size_t argc) {
-  if (argc > 0 && strcmp(argv[0], "pinmode") == 0) {
-    if (argc != 3) {
-      Serial.println(F("Usage: pinmode <pin> <in|out|pullup>"));
-      return true;
-    }
-    int pin = -1;
-    if (!parsePinToken(argv[1], pin)) {
-      Serial.println(F("Invalid pin. Use D0-D22 or A0-A5."));
-      return true;
+void cmdPinmode(char *argv[], size_t argc) {
+  int pin = -1;
+  if (!parsePinToken(argv[1], pin)) {
+    Serial.println(F("Invalid pin. Use D0-D22 or A0-A5."));
+    return;
+  }
+  if (equalsIgnoreCase(argv[2], F("in")) || equalsIgnoreCase(argv[2], F("input"))) {
+    fastPinMode(fastPin(static_cast<uint8_t>(pin)), INPUT);
+    Serial.print(F("pinMode "));
+    printPinLabel(pin);
+    Serial.println(F(" -> INPUT"));
+    return;
+  }
+  if (equalsIgnoreCase(argv[2], F("out")) || equalsIgnoreCase(argv[2], F("output"))) {
+    fastPinMode(fastPin(static_cast<uint8_t>(pin)), OUTPUT);
+    Serial.print(F("pinMode "));
+    printPinLabel(pin);
+    Serial.println(F(" -> OUTPUT"));
+    return;
+  }
+  if (equalsIgnoreCase(argv[2], F("pullup")) || equalsIgnoreCase(argv[2], F("input_pullup"))) {
+    fastPinMode(fastPin(static_cast<uint8_t>(pin)), INPUT_PULLUP);
+    Serial.print(F("pinMode "));
+    printPinLabel(pin);
+    Serial.println(F(" -> INPUT_PULLUP"));
+    return;
+  }
+  Serial.println(F("Invalid mode. Use in|out|pullup."));
+}
+
+namespace {
+
+char pinModeLetter(bool output, bool latch) {
+  if (output) {
+    return 'o';
+  }
+  return latch ? 'u' : 'i';
+}
+
+} // namespace
+
+// All nine port registers are read back to back with interrupts off, so the table is one
+// instant (within a few cycles) rather than one digitalread per pin.
+void cmdPins(char *argv[], size_t argc) {
+  uint8_t ddr[3];
+  uint8_t latch[3];
+  uint8_t level[3];
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    for (uint8_t i = 0; i < 3; ++i) {
+      const volatile uint8_t *regs = portInput(i);
+      level[i] = regs[0];
+      ddr[i] = regs[1];
+      latch[i] = regs[2];
     }
-    if (strcmp(argv[2], "in") == 0 || strcmp(argv[2], "input") == 0) {
-      pinMode(pin, INPUT);
-      Serial.print(F("pinMode "));
-      printPinLabel(pin);
-      Serial.println(F(" -> INPUT"));
-      return true;
+  }
+  for (uint8_t i = 0; i < 3; ++i) {
+    Serial.write(static_cast<char>("BCD"[i]));
+    Serial.print(F(": DDR="));
+    printHexByte(ddr[i]);
+    Serial.print(F(" PORT="));
+    printHexByte(latch[i]);
+    Serial.print(F(" PIN="));
+    printHexByte(level[i]);
+    Serial.println();
+  }
+  Serial.println(F("pin  mode port pin  (o=out, i=in, u=pullup)"));
+  for (uint8_t pin = 0; pin < NUM_DIGITAL_PINS; ++pin) {
+    const uint8_t index = pinPortIndex(pin);
+    const uint8_t mask = pinBitMask(pin);
+    const bool output = (ddr[index] & mask) != 0;
+    const bool high = (latch[index] & mask) != 0;
+    const bool in = (level[index] & mask) != 0;
+    printPinLabel(pin);
+    Serial.print(pin < 10 || pin >= A0 ? F("   ") : F("  "));
+    Serial.write(pinModeLetter(output, high));
+    Serial.print(F("    "));
+    Serial.write(high ? '1' : '0');
+    Serial.print(F("    "));
+    Serial.write(in ? '1' : '0');
+    // An output that reads back the other level is shorted or overloaded.
+    Serial.println(output && high != in ? F("  !") : F(""));
+  }
+}
+
+// pinset <pins> <values>: one 0/1 for all pins, or one per pin in list order ("1,0,1" or
+// "101"). The pins become outputs; each port then takes its new levels in one PORTx write.
+void cmdPinset(char *argv[], size_t argc) {
+  uint8_t pins[kMaxPinList];
+  const uint8_t count = parsePinSequence(argv[1], pins, kMaxPinList);
+  if (count == 0) {
+    Serial.println(F("Invalid pin list. Use e.g. 2,3,4 or D8,A0."));
+    return;
+  }
+  uint8_t values = 0;
+  uint8_t touched[3] = {0, 0, 0};
+  uint8_t high[3] = {0, 0, 0};
+  for (const char *v = argv[2]; *v != '\0'; ++v) {
+    if (*v == ',') {
+      continue;
+    }
+    if ((*v != '0' && *v != '1') || values == count) {
+      values = 0xFF;
+      break;
+    }
+    ++values;
+  }
+  if (values != 1 && values != count) {
+    Serial.println(F("Invalid values. Give one 0/1 for all pins or one per pin."));
+    return;
+  }
+  const char *v = argv[2];
+  for (uint8_t i = 0; i < count; ++i) {
+    while (*v == ',') {
+      ++v;
+    }
+    const uint8_t index = pinPortIndex(pins[i]);
+    const uint8_t mask = pinBitMask(pins[i]);
+    touched[index] |= mask;
+    high[index] = static_cast<uint8_t>(*v == '1' ? (high[index] | mask) : (high[index] & ~mask));
+    if (values != 1) {
+      ++v;
+    }
+    detachPwm(pins[i]);
+  }
+  for (uint8_t i = 0; i < 3; ++i) {
+    if (touched[i] == 0) {
+      continue;
     }
-    if (strcmp(argv[2], "out") == 0 || strcmp(argv[2], "output") == 0) {
-      pinMode(pin, OUTPUT);
-      Serial.print(F("pinMode "));
-      printPinLabel(pin);
-      Serial.println(F(" -> OUTPUT"));
-      return true;
+    volatile uint8_t *regs = portInput(i);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      regs[2] = static_cast<uint8_t>((regs[2] & ~touched[i]) | high[i]);
+      regs[1] = static_cast<uint8_t>(regs[1] | touched[i]);
     }
-    if (strcmp(argv[2], "pullup") == 0 || strcmp(argv[2], "input_pullup") == 0) {
-      pinMode(pin, INPUT_PULLUP);
-      Serial.print(F("pinMode "));
-      printPinLabel(pin);
-      Serial.println(F(" -> INPUT_PULLUP"));
-      return true;
+  }
+  for (uint8_t i = 0; i < 3; ++i) {
+    if (touched[i] != 0) {
+      Serial.write(static_cast<char>("BCD"[i]));
+      Serial.print(F(": mask="));
+      printHexByte(touched[i]);
+      Serial.print(F(" value="));
+      printHexByte(high[i]);
+      Serial.println();
     }
-    Serial.println(F("Invalid mode. Use in|out|pullup."));
-    return true;
   }
+}
 
-  if (argc > 0 && strcmp(argv[0], "delay") == 0) {
-    if (argc != 2) {
-      Serial.println(F("Usage: delay <ms>"));
-      return true;
-    }
-    unsigned long delayMs = 0;
-    if (!parseUnsignedAuto(argv[1], delayMs) || delayMs > 600000UL) {
-      Serial.println(F("Invalid delay. Use 0..600000 ms."));
-      return true;
-    }
+void cmdDelay(char *argv[], size_t argc) {
+  unsigned long delayMs = 0;
+  if (!parseUnsignedAuto(argv[1], delayMs) || delayMs > kMaxDelayMs) {
+    Serial.print(F("Invalid delay. Use 0.."));
+    Serial.print(kMaxDelayMs);
+    Serial.println(F(" ms."));
+    return;
+  }
+  if (!gJobDetach) {
     Serial.print(F("Delaying "));
     Serial.print(delayMs);
     Serial.println(F(" ms..."));
-    delay(delayMs);
-    Serial.println(F("Done."));
-    return true;
+  }
+  runJob(jobStartDelay(delayMs));
+}
+
+void cmdFreq(char *argv[], size_t argc) {
+  const bool autoMode = equalsIgnoreCase(argv[1], F("auto"));
+  int pin = kFreqCounterPin;
+  if (!autoMode && !parsePinToken(argv[1], pin)) {
+    Serial.println(F("Invalid pin. Use D0-D22, A0-A5 or auto."));
+    return;
   }
 
-  if (argc > 0 && strcmp(argv[0], "freq") == 0) {
-    if (argc != 2 && argc != 3) {
-      Serial.println(F("Usage: freq <pin> [ms]"));
-      Serial.print(F("Window: "));
+  unsigned long windowMs = kDefaultFreqWindowMs;
+  if (argc == 3) {
+    if (!parseUnsignedAuto(argv[2], windowMs) || windowMs < kMinFreqWindowMs ||
+        windowMs > kMaxFreqWindowMs) {
+      Serial.print(F("Invalid window. Use "));
       Serial.print(kMinFreqWindowMs);
       Serial.print(F(".."));
       Serial.print(kMaxFreqWindowMs);
-      Serial.println(F(" ms"));
-      return true;
+      Serial.println(F(" ms."));
+      return;
     }
+  }
+  // T1 (D5) and ICP1 (D8) are measured by Timer1; any other pin is polled.
+  FreqMode mode = FreqMode::Polled;
+  if (autoMode || pin == kFreqCounterPin) {
+    mode = FreqMode::Gate;
+  } else if (pin == kFreqCapturePin) {
+    mode = FreqMode::Reciprocal;
+  }
+  runJob(jobStartFreq(static_cast<uint8_t>(pin), mode, autoMode, windowMs));
+}
 
-    int pin = -1;
-    if (!parsePinToken(argv[1], pin)) {
-      Serial.println(F("Invalid pin. Use D0-D22 or A0-A5."));
-      return true;
-    }
+void cmdPwidth(char *argv[], size_t argc) {
+  int pin = -1;
+  if (!parsePinToken(argv[1], pin)) {
+    Serial.println(F("Invalid pin. Use D0-D22 or A0-A5."));
+    return;
+  }
+  if (pin != kFreqCapturePin) {
+    Serial.println(F("pwidth needs the input-capture pin D8 (ICP1)."));
+    return;
+  }
+  unsigned long levels = kDefaultWidthLevels;
+  if (argc == 3 &&
+      (!parseUnsignedAuto(argv[2], levels) || levels == 0 || levels > kMaxWidthLevels)) {
+    Serial.print(F("Invalid count. Use 1.."));
+    Serial.print(kMaxWidthLevels);
+    Serial.println(F(" levels."));
+    return;
+  }
+  runJob(jobStartWidth(static_cast<uint16_t>(levels)));
+}
 
-    unsigned long windowMs = kDefaultFreqWindowMs;
-    if (argc == 3) {
-      if (!parseUnsignedAuto(argv[2], windowMs) || windowMs < kMinFreqWindowMs ||
-          windowMs > kMaxFreqWindowMs) {
-        Serial.print(F("Invalid window. Use "));
-        Serial.print(kMinFreqWindowMs);
-        Serial.print(F(".."));
-        Serial.print(kMaxFreqWindowMs);
-        Serial.println(F(" ms."));
-        return true;
-      }
-    }
+void cmdDigitalread(char *argv[], size_t argc) {
+  int pin = -1;
+  if (!parsePinToken(argv[1], pin)) {
+    Serial.println(F("Invalid pin. Use D0-D22 or A0-A5."));
+    return;
+  }
+  const int value = digitalRead(pin);
+  printPinLabel(pin);
+  Serial.print(F(" = "));
+  Serial.print(value ? F("HIGH") : F("LOW"));
+  Serial.print(F(" ("));
+  Serial.print(value ? 1 : 0);
+  Serial.println(F(")"));
+}
+
+void cmdDigitalwrite(char *argv[], size_t argc) {
+  int pin = -1;
+  if (!parsePinToken(argv[1], pin)) {
+    Serial.println(F("Invalid pin. Use D0-D22 or A0-A5."));
+    return;
+  }
+  unsigned long bit = 0;
+  if (!parseUnsigned(argv[2], bit) || bit > 1) {
+    Serial.println(F("Invalid value. Use 0 or 1."));
+    return;
+  }
+  fastOutput(static_cast<uint8_t>(pin), bit != 0);
+  printPinLabel(pin);
+  Serial.print(F(" <= "));
+  Serial.println(bit ? F("HIGH") : F("LOW"));
+}
 
-    const uint32_t startUs = micros();
-    const uint32_t windowUs = static_cast<uint32_t>(windowMs) * 1000UL;
-    uint32_t risingEdges = 0;
-    int prev = digitalRead(pin);
+void cmdAnalogread(char *argv[], size_t argc) {
+  uint8_t analogIndex = 0;
+  int pin = -1;
+  if (!parseAnalogPinToken(argv[1], analogIndex, pin)) {
+    Serial.println(F("Invalid analog pin. Use A0-A5."));
+    return;
+  }
+#if FEATURE_ADC
+  if (adcBusy()) {
+    Serial.println(F("The ADC is busy with an adc job."));
+    return;
+  }
+#endif
+  const int value = analogRead(pin);
+  Serial.print(F("A"));
+  Serial.print(analogIndex);
+  Serial.print(F(" = "));
+  Serial.println(value);
+}
+
+void cmdPwm(char *argv[], size_t argc) {
+  int pin = -1;
+  if (!parsePinToken(argv[1], pin)) {
+    Serial.println(F("Invalid pin. Use D0-D22 or A0-A5."));
+    return;
+  }
+  PwmPinInfo info;
+  if (!isPwmCapablePin(pin, info)) {
+    Serial.println(F("Pin is not PWM-capable. Use D3,D5,D6,D9,D10,D11."));
+    return;
+  }
+  unsigned long level = 0;
+  if (!parseUnsigned(argv[2], level) || level > 255UL) {
+    Serial.println(F("Invalid value. Use 0..255."));
+    return;
+  }
+  // analogWrite() would reprogram a timer that pwmcfg, pulse, freq, adc, wave or capture
+  // has set up differently.
+  if ((info.timer == 1 && timer1InUse()) || (info.timer == 2 && timer2InUse())) {
+    Serial.print(F("Timer"));
+    Serial.print(info.timer);
+    Serial.println(F(" is busy (pwmcfg, pulse, freq, adc, wave or capture)."));
+    return;
+  }
+  pinMode(pin, OUTPUT);
+  analogWrite(pin, static_cast<uint8_t>(level));
+  printPinLabel(pin);
+  Serial.print(F(" PWM <= "));
+  Serial.println(level);
+}
 
-    while ((uint32_t)(micros() - startUs) < windowUs) {
-      const int curr = digitalRead(pin);
-      if (prev == LOW && curr == HIGH) {
-        ++risingEdges;
+void cmdPwmcfg(char *argv[], size_t argc) {
+  if (argc == 1) {
+    for (int pin = 0; pin < NUM_DIGITAL_PINS; ++pin) {
+      PwmPinInfo info;
+      if (isPwmCapablePin(pin, info)) {
+        printPwmPinInfo(pin, info);
       }
-      prev = curr;
     }
-
-    const uint32_t elapsedUs = micros() - startUs;
-    uint32_t hzWhole = 0;
-    uint8_t hzFrac2 = 0;
-    if (elapsedUs > 0) {
-      const uint64_t hzX100 =
-          (static_cast<uint64_t>(risingEdges) * 100000000ULL) / elapsedUs;
-      hzWhole = static_cast<uint32_t>(hzX100 / 100ULL);
-      hzFrac2 = static_cast<uint8_t>(hzX100 % 100ULL);
+    printPwmCfg(0);
+    printPwmCfg(1);
+    return;
+  }
+  int pin = -1;
+  const int8_t channel =
+      parsePinToken(argv[1], pin) ? pulseChannelForPin(static_cast<uint8_t>(pin)) : -1;
+  if (channel < 0) {
+    Serial.println(F("Invalid pin. pwmcfg drives D9 (OC1A) or D10 (OC1B)."));
+    return;
+  }
+  if (argc == 3 && equalsIgnoreCase(argv[2], F("off"))) {
+    pwmCfgStop(static_cast<uint8_t>(channel));
+    printPwmCfg(static_cast<uint8_t>(channel));
+    return;
+  }
+  if (argc < 4) {
+    Serial.println(F("Usage: pwmcfg <D9|D10> <hz> <duty%> [fast|phase] | <D9|D10> off"));
+    return;
+  }
+  bool phaseCorrect = false;
+  if (argc == 5) {
+    if (equalsIgnoreCase(argv[4], F("phase"))) {
+      phaseCorrect = true;
+    } else if (!equalsIgnoreCase(argv[4], F("fast"))) {
+      Serial.println(F("Invalid mode. Use fast or phase."));
+      return;
     }
+  }
+  unsigned long hz = 0;
+  if (!parseUnsigned(argv[2], hz) || hz == 0 || hz > pwmCfgMaxHz(phaseCorrect)) {
+    Serial.print(F("Invalid frequency. Use 1.."));
+    Serial.print(pwmCfgMaxHz(phaseCorrect));
+    Serial.println(F(" Hz."));
+    return;
+  }
+  uint32_t dutyMilli = 0;
+  if (!parseThousandths(argv[3], dutyMilli, '%') || dutyMilli > kPwmCfgDutyFull) {
+    Serial.println(F("Invalid duty. Use 0..100 percent, up to 3 decimals."));
+    return;
+  }
+  const uint8_t other = static_cast<uint8_t>(channel ^ 1);
+  if (!pwmCfgStart(static_cast<uint8_t>(channel), hz, dutyMilli, phaseCorrect)) {
+    Serial.println(F("Timer1 is busy (pulse, freq, adc, or pwm on D9/D10)."));
+    return;
+  }
+  printPwmCfg(static_cast<uint8_t>(channel));
+  if (pwmCfgActive(other)) {
+    printPwmCfg(other); // shares the frequency and mode
+  }
+}
 
-    Serial.print(F("freq "));
-    printPinLabel(pin);
-    Serial.print(F(" ~= "));
-    Serial.print(hzWhole);
-    Serial.write('.');
-    if (hzFrac2 < 10) {
-      Serial.write('0');
-    }
-    Serial.print(hzFrac2);
-    Serial.print(F(" Hz (edges="));
-    Serial.print(risingEdges);
-    Serial.print(F(", window="));
-    Serial.print(elapsedUs);
-    Serial.println(F(" us)"));
-    return true;
+#if FEATURE_TONE
+void cmdTone(char *argv[], size_t argc) {
+  int pin = -1;
+  if (!parsePinToken(argv[1], pin)) {
+    Serial.println(F("Invalid pin. Use D0-D22 or A0-A5."));
+    return;
+  }
+  unsigned long freq = 0;
+  if (!parseUnsigned(argv[2], freq) || freq == 0 || freq > 65535UL) {
+    Serial.println(F("Invalid freq. Use 1..65535 Hz."));
+    return;
+  }
+  if (timer2InUse()) {
+    Serial.println(F("Timer2 is busy (wave or capture)."));
+    return;
   }
 
-  if (argc > 0 && strcmp(argv[0], "digitalread") == 0) {
-    if (argc != 2) {
-      Serial.println(F("Usage: digitalread <pin>"));
-      return true;
+  if (argc == 4) {
+    unsigned long durMs = 0;
+    if (!parseUnsigned(argv[3], durMs)) {
+      Serial.println(F("Invalid duration ms."));
+      return;
     }
-    int pin = -1;
-    if (!parsePinToken(argv[1], pin)) {
-      Serial.println(F("Invalid pin. Use D0-D22 or A0-A5."));
-      return true;
-    }
-    const int value = digitalRead(pin);
+    tone(pin, static_cast<unsigned int>(freq), static_cast<unsigned long>(durMs));
     printPinLabel(pin);
-    Serial.print(F(" = "));
-    Serial.print(value ? F("HIGH") : F("LOW"));
-    Serial.print(F(" ("));
-    Serial.print(value ? 1 : 0);
-    Serial.println(F(")"));
-    return true;
+    Serial.print(F(" tone "));
+    Serial.print(freq);
+    Serial.print(F(" Hz for "));
+    Serial.print(durMs);
+    Serial.println(F(" ms"));
+    return;
   }
 
-  if (argc > 0 && strcmp(argv[0], "digitalwrite") == 0) {
-    if (argc != 3) {
-      Serial.println(F("Usage: digitalwrite <pin> <0|1>"));
-      return true;
-    }
-    int pin = -1;
-    if (!parsePinToken(argv[1], pin)) {
-      Serial.println(F("Invalid pin. Use D0-D22 or A0-A5."));
-      return true;
-    }
-    unsigned long bit = 0;
-    if (!parseUnsigned(argv[2], bit) || bit > 1) {
-      Serial.println(F("Invalid value. Use 0 or 1."));
-      return true;
-    }
-    pinMode(pin, OUTPUT);
-    digitalWrite(pin, bit ? HIGH : LOW);
-    printPinLabel(pin);
-    Serial.print(F(" <= "));
-    Serial.println(bit ? F("HIGH") : F("LOW"));
-    return true;
+  tone(pin, static_cast<unsigned int>(freq));
+  printPinLabel(pin);
+  Serial.print(F(" tone "));
+  Serial.print(freq);
+  Serial.println(F(" Hz"));
+}
+
+void cmdNotone(char *argv[], size_t argc) {
+  int pin = -1;
+  if (!parsePinToken(argv[1], pin)) {
+    Serial.println(F("Invalid pin. Use D0-D22 or A0-A5."));
+    return;
   }
+  noTone(pin);
+  printPinLabel(pin);
+  Serial.println(F(" tone OFF"));
+}
+#endif
 
-  if (argc > 0 && strcmp(argv[0], "analogread") == 0) {
-    if (argc != 2) {
-      Serial.println(F("Usage: analogread <A0-A5>"));
-      return true;
-    }
-    uint8_t analogIndex = 0;
-    int pin = -1;
-    if (!parseAnalogPinToken(argv[1], analogIndex, pin)) {
-      Serial.println(F("Invalid analog pin. Use A0-A5."));
-      return true;
-    }
-    const int value = analogRead(pin);
-    Serial.print(F("A"));
-    Serial.print(analogIndex);
-    Serial.print(F(" = "));
-    Serial.println(value);
-    return true;
+void cmdPulse(char *argv[], size_t argc) {
+  int pin = -1;
+  if (!parsePinToken(argv[1], pin)) {
+    Serial.println(F("Invalid pin. Use D0-D22 or A0-A5."));
+    return;
+  }
+  unsigned long count = 0;
+  uint32_t highUs = 0;
+  uint32_t lowUs = 0;
+  if (!parseUnsigned(argv[2], count) || count == 0) {
+    Serial.println(F("Invalid count. Use >= 1."));
+    return;
+  }
+  if (!parseDurationUs(argv[3], highUs) || !parseDurationUs(argv[4], lowUs)) {
+    Serial.println(F("Invalid timing values. Use <n>, <n>ms or <n>us."));
+    return;
   }
+  if (pulseChannelForPin(static_cast<uint8_t>(pin)) >= 0) {
+    if (highUs < kPulseMinUs || lowUs < kPulseMinUs || highUs > kPulseMaxUs ||
+        lowUs > kPulseMaxUs) {
+      Serial.print(F("Invalid timing values. D9/D10 take "));
+      Serial.print(kPulseMinUs);
+      Serial.println(F("us or more."));
+      return;
+    }
+  } else if (highUs % 1000UL != 0 || lowUs % 1000UL != 0) {
+    Serial.println(F("Sub-millisecond times need D9 or D10 (Timer1)."));
+    return;
+  }
+  runJob(jobStartPulse(static_cast<uint8_t>(pin), count, highUs, lowUs));
+}
 
-  if (argc > 0 && strcmp(argv[0], "pwm") == 0) {
-    if (argc != 3) {
-      Serial.println(F("Usage: pwm <pin> <0-255>"));
-      return true;
-    }
-    int pin = -1;
-    if (!parsePinToken(argv[1], pin)) {
-      Serial.println(F("Invalid pin. Use D0-D22 or A0-A5."));
-      return true;
-    }
-    if (!isPwmCapablePin(pin)) {
-      Serial.println(F("Pin is not PWM-capable. Use D3,D5,D6,D9,D10,D11."));
-      return true;
-    }
-    unsigned long level = 0;
-    if (!parseUnsigned(argv[2], level) || level > 255UL) {
-      Serial.println(F("Invalid value. Use 0..255."));
-      return true;
-    }
-    pinMode(pin, OUTPUT);
-    analogWrite(pin, static_cast<uint8_t>(level));
-    printPinLabel(pin);
-    Serial.print(F(" PWM <= "));
-    Serial.println(level);
-    return true;
+void cmdWatch(char *argv[], size_t argc) {
+  uint32_t pinMask = 0;
+  if (!parsePinList(argv[1], pinMask)) {
+    Serial.println(F("Invalid pin list. Use e.g. 2 or D2,D3,A0."));
+    return;
   }
+  runJob(jobStartWatch(pinMask));
+}
 
-#if FEATURE_TONE
-  if (argc > 0 && strcmp(argv[0], "tone") == 0) {
-    if (argc != 3 && argc != 4) {
-      Serial.println(F("Usage: tone <pin> <freq> [ms]"));
-      return true;
+#if FEATURE_WAVE
+void cmdWave(char *argv[], size_t argc) {
+  if (argc == 1 || (argc == 2 && equalsIgnoreCase(argv[1], F("off")))) {
+    if (argc == 2) {
+      waveStop();
+    }
+    printWaveStatus();
+    return;
+  }
+  if (argc != 4) {
+    Serial.println(F("Usage: wave <pin> <sine|tri|/file> <hz> | wave off"));
+    return;
+  }
+  int pin = -1;
+  PwmPinInfo output;
+  if (!parsePinToken(argv[1], pin) || !isPwmCapablePin(pin, output) || output.timer == 0) {
+    Serial.println(F("Invalid pin. Use D3, D11 (Timer2) or D9, D10 (Timer1)."));
+    return;
+  }
+  uint32_t milliHz = 0;
+  if (!parseThousandths(argv[3], milliHz) || milliHz == 0 || milliHz > kWaveMaxHz * 1000UL) {
+    Serial.print(F("Invalid frequency. Use 0.001.."));
+    Serial.print(kWaveMaxHz);
+    Serial.println(F(" Hz."));
+    return;
+  }
+  WaveShape shape = WaveShape::Sine;
+  if (equalsIgnoreCase(argv[2], F("tri"))) {
+    shape = WaveShape::Triangle;
+  } else if (argv[2][0] == '/') {
+#if FEATURE_FS
+    if (!waveLoadFile(argv[2])) {
+      Serial.print(F("Cannot load "));
+      Serial.print(argv[2]);
+      Serial.print(F(": need 2.."));
+      Serial.print(kWaveUserPoints);
+      Serial.println(F(" values of 0..255."));
+      return;
+    }
+    shape = WaveShape::User;
+#else
+    Serial.println(F("Wave files need feature_fs=1."));
+    return;
+#endif
+  } else if (!equalsIgnoreCase(argv[2], F("sine"))) {
+    Serial.println(F("Invalid shape. Use sine, tri or a /file."));
+    return;
+  }
+  if (!waveStart(static_cast<uint8_t>(pin), shape, milliHz)) {
+    Serial.println(F("Timer2 (and Timer1 for D9/D10) is busy: capture, tone, pwm, pwmcfg, "
+                     "pulse, freq or adc."));
+    return;
+  }
+  delay(kWaveSettleMs); // let the ISR cost settle before it is reported
+  printWaveStatus();
+}
+#endif
+
+#if FEATURE_CAPTURE
+void cmdCapture(char *argv[], size_t argc) {
+  if (argc == 2 && equalsIgnoreCase(argv[1], F("dump"))) {
+    printCaptureDump();
+    return;
+  }
+  if (argc < 4) {
+    Serial.println(F("Usage: capture <B|C|D> <hz> <samples> [trigger] | capture dump"));
+    return;
+  }
+  PortId port = PortId::B;
+  if (!parsePortId(argv[1], port)) {
+    Serial.println(F("Invalid port. Use B, C or D."));
+    return;
+  }
+  unsigned long rateHz = 0;
+  if (!parseUnsignedAuto(argv[2], rateHz) || rateHz < kCaptureMinHz || rateHz > kCaptureMaxHz) {
+    Serial.print(F("Invalid rate. Use "));
+    Serial.print(kCaptureMinHz);
+    Serial.print(F(".."));
+    Serial.print(kCaptureMaxHz);
+    Serial.println(F(" Hz."));
+    return;
+  }
+  unsigned long samples = 0;
+  if (!parseUnsignedAuto(argv[3], samples) || samples == 0 || samples > kCaptureMaxSamples) {
+    Serial.print(F("Invalid sample count. Use 1.."));
+    Serial.println(kCaptureMaxSamples);
+    return;
+  }
+  CaptureTrigger trigger;
+  if (argc == 5 && !parseCaptureTrigger(argv[4], trigger)) {
+    Serial.println(F("Invalid trigger. Use r<bit>, f<bit> or a pattern like xxxx01xx."));
+    return;
+  }
+  if (!gJobDetach) {
+    Serial.print(F("Capturing port "));
+    Serial.write(portLetter(port));
+    Serial.println(trigger.mask != 0 ? F(" after the trigger. Press any key to stop.")
+                                     : F(". Press any key to stop."));
+  }
+  runJob(jobStartCapture(port, rateHz, samples, trigger));
+}
+#endif
+
+#if FEATURE_ADC
+namespace {
+
+bool parseAdcChannels(const char *token, AdcConfig &config) {
+  config.channelCount = 0;
+  uint8_t seen = 0;
+  while (true) {
+    char piece[4];
+    size_t len = 0;
+    while (token[len] != '\0' && token[len] != ',') {
+      if (len >= sizeof(piece) - 1) {
+        return false;
+      }
+      piece[len] = token[len];
+      ++len;
     }
+    piece[len] = '\0';
+    uint8_t index = 0;
     int pin = -1;
-    if (!parsePinToken(argv[1], pin)) {
-      Serial.println(F("Invalid pin. Use D0-D22 or A0-A5."));
-      return true;
+    if (!parseAnalogPinToken(piece, index, pin) || (seen & _BV(index)) != 0) {
+      return false;
     }
-    unsigned long freq = 0;
-    if (!parseUnsigned(argv[2], freq) || freq == 0 || freq > 65535UL) {
-      Serial.println(F("Invalid freq. Use 1..65535 Hz."));
+    seen = static_cast<uint8_t>(seen | _BV(index));
+    config.channels[config.channelCount++] = index;
+    if (token[len] == '\0') {
       return true;
     }
+    token += len + 1;
+  }
+}
 
-    if (argc == 4) {
-      unsigned long durMs = 0;
-      if (!parseUnsigned(argv[3], durMs)) {
-        Serial.println(F("Invalid duration ms."));
+// key=value options after the rate; false for anything unknown or out of range.
+bool parseAdcOption(const char *token, AdcConfig &config) {
+  if (equalsIgnoreCase(token, F("bin"))) {
+    config.binary = true;
+    return true;
+  }
+  const char *eq = strchr(token, '=');
+  if (eq == nullptr) {
+    return false;
+  }
+  unsigned long value = 0;
+  if (!parseUnsigned(eq + 1, value)) {
+    return false;
+  }
+  const size_t keyLen = static_cast<size_t>(eq - token);
+  if (keyLen == 1 && (token[0] == 'n' || token[0] == 'N')) {
+    config.samples = value;
+    return true;
+  }
+  if (keyLen == 2 && strncasecmp(token, "os", 2) == 0) {
+    for (uint8_t shift = 0; shift <= kAdcMaxOversampleShift; ++shift) {
+      if (value == (1UL << (2U * shift))) {
+        config.osShift = shift;
         return true;
       }
-      tone(pin, static_cast<unsigned int>(freq), static_cast<unsigned long>(durMs));
-      printPinLabel(pin);
-      Serial.print(F(" tone "));
-      Serial.print(freq);
-      Serial.print(F(" Hz for "));
-      Serial.print(durMs);
-      Serial.println(F(" ms"));
-      return true;
     }
-
-    tone(pin, static_cast<unsigned int>(freq));
-    printPinLabel(pin);
-    Serial.print(F(" tone "));
-    Serial.print(freq);
-    Serial.println(F(" Hz"));
+    return false;
+  }
+  if (keyLen == 3 && strncasecmp(token, "clk", 3) == 0 &&
+      (value == 16 || value == 32 || value == 64 || value == 128)) {
+    config.clockDiv = static_cast<uint8_t>(value);
     return true;
   }
+  return false;
+}
 
-  if (argc > 0 && strcmp(argv[0], "notone") == 0) {
-    if (argc != 2) {
-      Serial.println(F("Usage: notone <pin>"));
-      return true;
-    }
-    int pin = -1;
-    if (!parsePinToken(argv[1], pin)) {
-      Serial.println(F("Invalid pin. Use D0-D22 or A0-A5."));
-      return true;
+} // namespace
+
+void cmdAdc(char *argv[], size_t argc) {
+  AdcConfig config;
+  if (!parseAdcChannels(argv[1], config)) {
+    Serial.println(F("Invalid channel list. Use e.g. A0 or A0,A1,A3."));
+    return;
+  }
+  unsigned long rateHz = 0;
+  if (!equalsIgnoreCase(argv[2], F("max")) &&
+      (!parseUnsignedAuto(argv[2], rateHz) || rateHz == 0)) {
+    Serial.println(F("Invalid rate. Use conversions per second, or max."));
+    return;
+  }
+  for (size_t i = 3; i < argc; ++i) {
+    if (!parseAdcOption(argv[i], config)) {
+      Serial.print(F("Invalid option: "));
+      Serial.println(argv[i]);
+      return;
     }
-    noTone(pin);
-    printPinLabel(pin);
-    Serial.println(F(" tone OFF"));
-    return true;
   }
+  config.rateHz = rateHz;
+  if (rateHz > adcMaxRate(config.clockDiv)) {
+    Serial.print(F("Rate too high for clk="));
+    Serial.print(config.clockDiv);
+    Serial.print(F(". Use up to "));
+    Serial.print(adcMaxRate(config.clockDiv));
+    Serial.println(F(" Hz, or max."));
+    return;
+  }
+  if (config.binary && gJobDetach) {
+    Serial.println(F("Binary output needs the foreground."));
+    return;
+  }
+  runJob(jobStartAdc(config));
+}
 #endif
 
-  if (argc > 0 && strcmp(argv[0], "pulse") == 0) {
-    if (argc != 5) {
-      Serial.println(F("Usage: pulse <pin> <count> <high_ms> <low_ms>"));
-      return true;
-    }
-    int pin = -1;
-    if (!parsePinToken(argv[1], pin)) {
-      Serial.println(F("Invalid pin. Use D0-D22 or A0-A5."));
-      return true;
-    }
-    unsigned long count = 0;
-    unsigned long highMs = 0;
-    unsigned long lowMs = 0;
-    if (!parseUnsigned(argv[2], count) || count == 0) {
-      Serial.println(F("Invalid count. Use >= 1."));
-      return true;
-    }
-    if (!parseUnsigned(argv[3], highMs) || !parseUnsigned(argv[4], lowMs)) {
-      Serial.println(F("Invalid timing values."));
-      return true;
-    }
+namespace {
 
-    pinMode(pin, OUTPUT);
-    for (unsigned long i = 0; i < count; ++i) {
-      digitalWrite(pin, HIGH);
-      delay(highMs);
-      digitalWrite(pin, LOW);
-      if (i + 1 < count) {
-        delay(lowMs);
-      }
-      if (Serial.available() > 0) {
-        while (Serial.available() > 0) {
-          Serial.read();
-        }
-        Serial.println(F("Pulse aborted by keypress."));
-        return true;
-      }
-    }
-    Serial.println(F("Pulse completed."));
-    return true;
+constexpr uint16_t kBenchWrites = 1000; // even, so the toggle run ends where it started
+
+uint32_t benchCycles(uint32_t startTicks) { return (timerTicks() - startTicks) * kCyclesPerTick; }
+
+void printBenchRow(const __FlashStringHelper *label, uint32_t cycles) {
+  Serial.print(label);
+  const uint32_t perWriteX10 = cycles * 10UL / kBenchWrites;
+  Serial.print(perWriteX10 / 10UL);
+  Serial.write('.');
+  Serial.print(perWriteX10 % 10UL);
+  Serial.print(F(" cycles/write, "));
+  Serial.print(cycles == 0 ? 0UL : F_CPU / 1000UL * kBenchWrites / cycles);
+  Serial.println(F(" kHz"));
+}
+
+void printSpeedup(const __FlashStringHelper *label, uint32_t baseCycles, uint32_t cycles) {
+  const uint32_t ratioX10 = cycles == 0 ? 0 : baseCycles * 10UL / cycles;
+  Serial.print(label);
+  Serial.print(ratioX10 / 10UL);
+  Serial.write('.');
+  Serial.print(ratioX10 % 10UL);
+  Serial.write('x');
+}
+
+} // namespace
+
+// Times kBenchWrites alternating writes through each path, loop overhead included and
+// interrupts left on, so the figures are what a command or job actually gets.
+void cmdBench(char *argv[], size_t argc) {
+  if (!equalsIgnoreCase(argv[1], F("gpio"))) {
+    Serial.println(F("Usage: bench gpio [pin]"));
+    return;
   }
+  int pin = LED_BUILTIN;
+  if (argc == 3 && !parsePinToken(argv[2], pin)) {
+    Serial.println(F("Invalid pin. Use D0-D22 or A0-A5."));
+    return;
+  }
+  const uint8_t pinId = static_cast<uint8_t>(pin);
+  const FastPin io = fastPin(pinId);
+  const bool wasOutput = (io.in[1] & io.mask) != 0;
+  const bool wasHigh = (io.in[2] & io.mask) != 0;
+  fastOutput(pinId, wasHigh);
 
-  if (argc > 0 && strcmp(argv[0], "watch") == 0) {
-    if (argc != 2) {
-      Serial.println(F("Usage: watch <pin>"));
-      return true;
-    }
-    int pin = -1;
-    if (!parsePinToken(argv[1], pin)) {
-      Serial.println(F("Invalid pin. Use D0-D22 or A0-A5."));
-      return true;
-    }
-    while (Serial.available() > 0) {
-      Serial.read();
-    }
+  uint32_t start = timerTicks();
+  for (uint16_t i = 0; i < kBenchWrites; ++i) {
+    digitalWrite(pinId, (i & 1U) ? HIGH : LOW);
+  }
+  const uint32_t coreCycles = benchCycles(start);
+  fastWrite(io, wasHigh);
 
-    Serial.print(F("Watching "));
-    printPinLabel(pin);
-    Serial.println(F(" every 200 ms. Press any key to stop."));
-    while (true) {
-      const int value = digitalRead(pin);
-      printPinLabel(pin);
-      Serial.print(F(" = "));
-      Serial.print(value ? F("HIGH") : F("LOW"));
-      Serial.print(F(" @ "));
-      Serial.print(millis());
-      Serial.println(F(" ms"));
-
-      const uint32_t start = millis();
-      while ((millis() - start) < kWatchPeriodMs) {
-        if (Serial.available() > 0) {
-          while (Serial.available() > 0) {
-            Serial.read();
-          }
-          Serial.println(F("Watch stopped."));
-          return true;
-        }
-        delay(5);
-      }
-    }
+  start = timerTicks();
+  for (uint16_t i = 0; i < kBenchWrites; ++i) {
+    fastWrite(io, (i & 1U) != 0);
   }
+  const uint32_t writeCycles = benchCycles(start);
+  fastWrite(io, wasHigh);
 
-  return false;
+  start = timerTicks();
+  for (uint16_t i = 0; i < kBenchWrites; ++i) {
+    fastToggle(io);
+  }
+  const uint32_t toggleCycles = benchCycles(start);
+
+  if (!wasOutput) {
+    fastPinMode(io, wasHigh ? INPUT_PULLUP : INPUT);
+  }
+
+  Serial.print(F("bench gpio "));
+  printPinLabel(pin);
+  Serial.print(F(", "));
+  Serial.print(kBenchWrites);
+  Serial.println(F(" writes each:"));
+  printBenchRow(F("  digitalWrite "), coreCycles);
+  printBenchRow(F("  fastWrite    "), writeCycles);
+  printBenchRow(F("  fastToggle   "), toggleCycles);
+  printSpeedup(F("  speedup: fastWrite "), coreCycles, writeCycles);
+  printSpeedup(F(", fastToggle "), coreCycles, toggleCycles);
+  Serial.println();
 }
 
 } // namespace shell
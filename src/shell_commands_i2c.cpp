@@ -2,270 +2,658 @@
 
 #include <string.h>
 
+#if FEATURE_I2C && FEATURE_FS
+#include <EEPROM.h>
+#endif
+
 namespace shell {
 
-bool handleI2cCommand(char *argv[], size_t argc) {
 #if FEATURE_I2C
-  if (argc > 0 && strcmp(argv[0], "i2cspeed") == 0) {
-    if (argc != 2) {
-      Serial.println(F("Usage: i2cspeed <100k|400k>"));
-      return true;
+void cmdI2cspeed(char *argv[], size_t argc) {
+  if (argc == 1) {
+    Serial.print(F("I2C speed "));
+    Serial.print(gI2cClockHz);
+    Serial.print(F(" Hz: "));
+    printI2cClock(gI2cClockHz);
+    return;
+  }
+
+  uint32_t hz = 0;
+  if (!parseI2cSpeedToken(argv[1], hz)) {
+    Serial.println(F("Invalid speed. Use <hz> or <khz>k, e.g. 50000, 12.5k or 400k."));
+    return;
+  }
+  if (!setI2cClock(hz)) {
+    Serial.print(F("Out of range. The TWI reaches "));
+    Serial.print(kI2cMinHz);
+    Serial.print(F(".."));
+    Serial.print(kI2cMaxHz);
+    Serial.println(F(" Hz."));
+    return;
+  }
+
+  Serial.print(F("I2C speed set to "));
+  Serial.print(hz);
+  Serial.print(F(" Hz: "));
+  printI2cClock(hz);
+}
+
+void cmdI2cscan(char *argv[], size_t argc) {
+  bool fast = false;
+  bool identify = false;
+  for (size_t i = 1; i < argc; ++i) {
+    if (equalsIgnoreCase(argv[i], F("fast"))) {
+      fast = true;
+    } else if (equalsIgnoreCase(argv[i], F("id"))) {
+      identify = true;
+    } else {
+      Serial.println(F("Usage: i2cscan [fast] [id] [&]"));
+      return;
     }
+  }
+  runJob(jobStartScan(fast, identify));
+}
 
-    uint32_t hz = 0;
-    if (!parseI2cSpeedToken(argv[1], hz)) {
-      Serial.println(F("Invalid speed. Use 100k or 400k."));
-      return true;
+void cmdI2cstat(char *argv[], size_t argc) {
+  if (argc == 2) {
+    if (!equalsIgnoreCase(argv[1], F("reset"))) {
+      Serial.println(F("Usage: i2cstat [reset]"));
+      return;
     }
+    resetTwiStats();
+    Serial.println(F("I2C statistics cleared."));
+    return;
+  }
+  printTwiStats();
+}
 
-    setI2cClock(hz);
-    Serial.print(F("I2C speed set to "));
-    Serial.print(gI2cClockHz / 1000UL);
-    Serial.println(F(" kHz"));
-    return true;
+namespace {
+
+// Register and memory addresses are one or two bytes, sent high byte first.
+bool parseRegToken(const char *token, uint8_t *out, size_t &len) {
+  len = 0;
+  if (!parseDataToken(token, out, 2, len)) {
+    Serial.println(F("Invalid register. Use 0..255, 0x00..0xFF or 0x0000..0xFFFF."));
+    return false;
   }
+  return true;
+}
 
-  if (argc > 0 && strcmp(argv[0], "i2cscan") == 0) {
-    if (argc != 1) {
-      Serial.println(F("Usage: i2cscan"));
-      return true;
-    }
+uint16_t regValue(const uint8_t *reg, size_t len) {
+  return len == 2 ? static_cast<uint16_t>((reg[0] << 8) | reg[1]) : reg[0];
+}
 
-    uint8_t found = 0;
-    Serial.println(F("Scanning I2C addresses 0x01..0x7F..."));
-    for (uint8_t address = 1; address <= 0x7F; ++address) {
-      Wire.beginTransmission(address);
-      const uint8_t status = Wire.endTransmission();
-      if (status == 0) {
-        Serial.print(F("  found @ "));
-        printI2cAddress(address);
-        Serial.println();
-        ++found;
-      } else if (status == 4) {
-        Serial.print(F("  bus error @ "));
-        printI2cAddress(address);
-        Serial.println();
+void printReg(const uint8_t *reg, size_t len) {
+  Serial.print(F("0x"));
+  if (len == 2) {
+    printHexWord(regValue(reg, len));
+  } else {
+    printHexByte(reg[0]);
+  }
+}
+
+void printByteList(const uint8_t *data, uint8_t len) {
+  for (uint8_t i = 0; i < len; ++i) {
+    Serial.print(F(" 0x"));
+    printHexByte(data[i]);
+  }
+  Serial.println();
+}
+
+void printThroughput(uint32_t bytes, uint32_t us) {
+  Serial.print(bytes);
+  Serial.print(F(" bytes in "));
+  Serial.print(us / 1000UL);
+  Serial.print(F(" ms = "));
+  Serial.print(us == 0 ? 0UL : static_cast<uint32_t>(bytes * 1000000ULL / us));
+  Serial.println(F(" B/s"));
+}
+
+using ChunkHandler = void (*)(const uint8_t *data, uint8_t len, uint16_t reg);
+
+// Reads `length` bytes in one transaction and hands them over in pieces that end on
+// 16-register boundaries, with `reg` the register of the first byte. The driver pauses with
+// SCL held low while a piece is handled, and reads on afterwards. Returns how many bytes
+// arrived; `status` is the transaction's.
+uint16_t readChunks(uint8_t address, const uint8_t *reg, size_t regLen, uint16_t length,
+                    ChunkHandler handler, TwiStatus &status) {
+  constexpr uint8_t kChunk = 16;
+  uint8_t chunk[kChunk];
+  uint16_t at = regLen == 0 ? 0 : regValue(reg, regLen);
+  TwiTxn txn;
+  txn.address = address;
+  txn.tx = reg;
+  txn.txLen = static_cast<uint8_t>(regLen);
+  txn.rx = chunk;
+  txn.rxLen = static_cast<uint8_t>(kChunk - at % kChunk);
+  if (txn.rxLen > length) {
+    txn.rxLen = static_cast<uint8_t>(length);
+  }
+  txn.rxMore = static_cast<uint16_t>(length - txn.rxLen);
+  uint16_t received = 0;
+
+  while (!twiSubmit(txn)) {
+    updateBackgroundTasks();
+  }
+  while (true) {
+    updateBackgroundTasks();
+    const bool more = txn.status == TwiStatus::Paused;
+    if ((more || !txn.queued) && txn.rxCount != 0) {
+      handler(chunk, txn.rxCount, at);
+      at = static_cast<uint16_t>(at + txn.rxCount);
+      received = static_cast<uint16_t>(received + txn.rxCount);
+    }
+    if (!more) {
+      if (!txn.queued) {
+        break;
       }
+      continue;
     }
+    txn.rxLen = kChunk;
+    twiResume(txn);
+  }
+  status = txn.status;
+  return received;
+}
 
-    if (found == 0) {
-      Serial.println(F("No I2C devices found."));
-    } else {
-      Serial.print(F("I2C devices found: "));
-      Serial.println(found);
-    }
-    return true;
+void printReadLine(const uint8_t *data, uint8_t len, uint16_t reg) {
+  Serial.print(F("0x"));
+  printHexWord(reg);
+  Serial.write(':');
+  for (uint8_t i = 0; i < len; ++i) {
+    Serial.write(' ');
+    printHexByte(data[i]);
   }
+  Serial.println();
+}
 
-  if (argc > 0 && strcmp(argv[0], "i2cread") == 0) {
-    if (argc != 3) {
-      Serial.println(F("Usage: i2cread <addr> <n>"));
-      Serial.print(F("n range: 1.."));
-      Serial.println(kI2cMaxTransferLen);
-      return true;
-    }
+void printShortRead(uint16_t received, uint16_t length, TwiStatus status) {
+  if (status != TwiStatus::Ok) {
+    printI2cTxStatus(static_cast<uint8_t>(status));
+  }
+  if (received != 0 && received != length) {
+    Serial.print(F("Short read (requested "));
+    Serial.print(length);
+    Serial.println(F(")."));
+  }
+}
 
-    uint8_t address = 0;
-    uint8_t length = 0;
-    if (!parseI2cAddress(argv[1], address)) {
-      Serial.println(F("Invalid address. Use 0x00..0x7F."));
-      return true;
-    }
-    if (!parseI2cLen(argv[2], length)) {
-      Serial.print(F("Invalid length. Use 1.."));
-      Serial.println(kI2cMaxTransferLen);
-      return true;
+// Reads past kI2cMaxTransferLen are printed 16 bytes to a line as they arrive.
+void streamRead(uint8_t address, const uint8_t *reg, size_t regLen, uint16_t length) {
+  TwiStatus status = TwiStatus::Ok;
+  const uint32_t startUs = micros();
+  const uint16_t received = readChunks(address, reg, regLen, length, printReadLine, status);
+  const uint32_t us = micros() - startUs;
+  if (received != 0) {
+    printThroughput(received, us);
+  }
+  printShortRead(received, length, status);
+}
+
+void readAndPrint(uint8_t address, const uint8_t *reg, size_t regLen, uint16_t length) {
+  if (length > kI2cMaxTransferLen) {
+    streamRead(address, reg, regLen, length);
+    return;
+  }
+  uint8_t data[kI2cMaxTransferLen];
+  uint8_t received = 0;
+  const uint8_t status = i2cWriteRead(address, reg, static_cast<uint8_t>(regLen), data,
+                                      static_cast<uint8_t>(length), received);
+  if (status != 0 && received == 0) {
+    printI2cTxStatus(status);
+    return;
+  }
+  Serial.print(regLen == 0 ? F("i2cread ") : F("i2crr "));
+  printI2cAddress(address);
+  if (regLen != 0) {
+    Serial.print(F(" reg "));
+    printReg(reg, regLen);
+  }
+  Serial.print(F(" -> "));
+  Serial.print(received);
+  Serial.print(F(" byte(s):"));
+  printByteList(data, received);
+
+  if (received != length) {
+    Serial.print(F("Short read (requested "));
+    Serial.print(length);
+    Serial.println(F(")."));
+  }
+}
+
+bool parseDataTokens(char *argv[], size_t argc, uint8_t *out, size_t max, size_t &count) {
+  for (size_t i = 0; i < argc; ++i) {
+    if (!parseDataToken(argv[i], out, max, count)) {
+      Serial.print(F("Invalid data (or more than "));
+      Serial.print(max);
+      Serial.print(F(" bytes): "));
+      Serial.println(argv[i]);
+      return false;
     }
+  }
+  return true;
+}
 
-    const uint8_t received =
-        Wire.requestFrom(static_cast<int>(address), static_cast<int>(length));
-    Serial.print(F("i2cread "));
-    printI2cAddress(address);
-    Serial.print(F(" -> "));
-    Serial.print(received);
-    Serial.print(F(" byte(s):"));
+// The bytes i2cpage writes: a pattern from the command line or a file, repeated.
+struct PageSource {
+  const uint8_t *bytes;
+  uint16_t fileStart;
+  uint16_t len;
+  bool file;
+};
+
+uint8_t sourceByte(const PageSource &source, uint32_t index) {
+  const uint16_t at = static_cast<uint16_t>(index % source.len);
+#if FEATURE_FS
+  if (source.file) {
+    return EEPROM.read(static_cast<int>(source.fileStart + at));
+  }
+#endif
+  return source.bytes[at];
+}
+
+// An EEPROM ignores its address while it programs a page; it answers again when done.
+TwiStatus pollAck(uint8_t address, uint32_t &polls) {
+  const uint32_t startMs = millis();
+  TwiTxn probe;
+  probe.address = address;
+  do {
+    ++polls;
+  } while (twiRun(probe) == TwiStatus::AddrNack && millis() - startMs < kI2cAckPollMs);
+  return probe.status;
+}
+
+// The last dump's range. Its registers are only kept, for `i2cdump diff`, with
+// FEATURE_I2C_SNAPSHOT.
+struct I2cSnapshot {
+  uint8_t address;
+  uint8_t regLen; // 0 until a dump has been taken
+  uint16_t start;
+  uint16_t len;
+#if FEATURE_I2C_SNAPSHOT
+  uint8_t data[kI2cSnapshotBytes];
+#endif
+};
+
+I2cSnapshot gSnapshot;
+#if FEATURE_I2C_SNAPSHOT
+uint16_t gDiffChanged = 0;
+#endif
 
-    for (uint8_t i = 0; i < received && Wire.available() > 0; ++i) {
-      const uint8_t value = static_cast<uint8_t>(Wire.read());
+void printRegLabel(uint16_t reg) {
+  if (gSnapshot.regLen == 2) {
+    printHexWord(reg);
+  } else {
+    printHexByte(static_cast<uint8_t>(reg));
+  }
+}
+
+// One row of the table per 16 registers, the columns before the start left blank. The
+// snapshot keeps what fits.
+void printDumpRow(const uint8_t *data, uint8_t len, uint16_t reg) {
+  if (reg == gSnapshot.start) {
+    for (uint8_t i = 0; i <= gSnapshot.regLen * 2U; ++i) {
       Serial.write(' ');
-      Serial.print(F("0x"));
-      printHexByte(value);
+    }
+    for (uint8_t col = 0; col < 16; ++col) {
+      Serial.print(F("  "));
+      Serial.write(static_cast<char>(col < 10 ? '0' + col : 'A' + col - 10));
     }
     Serial.println();
-
-    if (received != length) {
-      Serial.print(F("Short read (requested "));
-      Serial.print(length);
-      Serial.println(F(")."));
+  }
+  printRegLabel(static_cast<uint16_t>(reg & ~0x0FU));
+  Serial.write(':');
+  for (uint8_t col = 0; col < (reg & 0x0FU); ++col) {
+    Serial.print(F("   "));
+  }
+  for (uint8_t i = 0; i < len; ++i) {
+    Serial.write(' ');
+    printHexByte(data[i]);
+#if FEATURE_I2C_SNAPSHOT
+    const uint16_t index = static_cast<uint16_t>(reg - gSnapshot.start + i);
+    if (index < kI2cSnapshotBytes) {
+      gSnapshot.data[index] = data[i];
     }
-    return true;
+#endif
   }
+  Serial.println();
+}
 
-  if (argc > 0 && strcmp(argv[0], "i2cwrite") == 0) {
-    if (argc < 3) {
-      Serial.println(F("Usage: i2cwrite <addr> <bytes...>"));
-      return true;
+#if FEATURE_I2C_SNAPSHOT
+void printDiffRow(const uint8_t *data, uint8_t len, uint16_t reg) {
+  for (uint8_t i = 0; i < len; ++i) {
+    uint8_t &saved = gSnapshot.data[reg - gSnapshot.start + i];
+    if (saved == data[i]) {
+      continue;
     }
+    Serial.print(F("  "));
+    printRegLabel(static_cast<uint16_t>(reg + i));
+    Serial.print(F(": "));
+    printHexByte(saved);
+    Serial.print(F(" -> "));
+    printHexByte(data[i]);
+    Serial.println();
+    saved = data[i];
+    ++gDiffChanged;
+  }
+}
+#endif
 
-    uint8_t address = 0;
-    if (!parseI2cAddress(argv[1], address)) {
-      Serial.println(F("Invalid address. Use 0x00..0x7F."));
-      return true;
-    }
+void setRegBytes(uint8_t *reg, uint16_t value) {
+  if (gSnapshot.regLen == 2) {
+    reg[0] = static_cast<uint8_t>(value >> 8);
+    reg[1] = static_cast<uint8_t>(value);
+  } else {
+    reg[0] = static_cast<uint8_t>(value);
+  }
+}
 
-    const size_t dataLen = argc - 2;
-    if (dataLen == 0 || dataLen > kI2cMaxTransferLen) {
-      Serial.print(F("Data length must be 1.."));
-      Serial.println(kI2cMaxTransferLen);
-      return true;
-    }
+#if FEATURE_I2C_SNAPSHOT
+// Reads the snapshot's registers again in one transaction and prints only those that
+// changed; the snapshot takes the new values.
+void dumpDiff() {
+  if (gSnapshot.regLen == 0) {
+    Serial.println(F("No snapshot yet. Run i2cdump first."));
+    return;
+  }
+  uint8_t reg[2] = {};
+  setRegBytes(reg, gSnapshot.start);
+  gDiffChanged = 0;
+  TwiStatus status = TwiStatus::Ok;
+  const uint32_t startUs = micros();
+  const uint16_t received =
+      readChunks(gSnapshot.address, reg, gSnapshot.regLen, gSnapshot.len, printDiffRow, status);
+  const uint32_t us = micros() - startUs;
+  printShortRead(received, gSnapshot.len, status);
+  if (received == 0) {
+    return;
+  }
+  Serial.print(gDiffChanged);
+  Serial.print(F(" of "));
+  Serial.print(received);
+  Serial.print(F(" register(s) of "));
+  printI2cAddress(gSnapshot.address);
+  Serial.print(F(" changed ("));
+  Serial.print(us / 1000UL);
+  Serial.println(F(" ms)."));
+}
+#endif
 
-    uint8_t data[kI2cMaxTransferLen] = {};
-    for (size_t i = 0; i < dataLen; ++i) {
-      if (!parseByteValue(argv[2 + i], data[i])) {
-        Serial.print(F("Invalid data byte: "));
-        Serial.println(argv[2 + i]);
-        return true;
-      }
-    }
+} // namespace
 
-    Wire.beginTransmission(address);
-    for (size_t i = 0; i < dataLen; ++i) {
-      Wire.write(data[i]);
-    }
-    const uint8_t status = Wire.endTransmission();
-    if (status != 0) {
-      printI2cTxStatus(status);
-      return true;
-    }
+void cmdI2cread(char *argv[], size_t argc) {
+  uint8_t address = 0;
+  uint16_t length = 0;
+  if (!parseI2cAddress(argv[1], address)) {
+    Serial.println(F("Invalid address. Use 0x00..0x7F."));
+    return;
+  }
+  if (!parseI2cLen(argv[2], length)) {
+    Serial.println(F("Invalid length. Use 1..65535."));
+    return;
+  }
+  readAndPrint(address, nullptr, 0, length);
+}
 
-    Serial.print(F("Wrote "));
-    Serial.print(dataLen);
-    Serial.print(F(" byte(s) to "));
-    printI2cAddress(address);
-    Serial.println();
-    return true;
+void cmdI2cwrite(char *argv[], size_t argc) {
+  uint8_t address = 0;
+  if (!parseI2cAddress(argv[1], address)) {
+    Serial.println(F("Invalid address. Use 0x00..0x7F."));
+    return;
   }
 
-  if (argc > 0 && strcmp(argv[0], "i2cwr") == 0) {
-    if (argc < 4) {
-      Serial.println(F("Usage: i2cwr <addr> <reg> <bytes...>"));
-      return true;
-    }
+  uint8_t data[kI2cMaxTransferLen] = {};
+  size_t dataLen = 0;
+  if (!parseDataTokens(argv + 2, argc - 2, data, kI2cMaxTransferLen, dataLen)) {
+    return;
+  }
 
-    uint8_t address = 0;
-    uint8_t reg = 0;
-    if (!parseI2cAddress(argv[1], address)) {
-      Serial.println(F("Invalid address. Use 0x00..0x7F."));
-      return true;
-    }
-    if (!parseByteValue(argv[2], reg)) {
-      Serial.println(F("Invalid register. Use 0..255 or 0x00..0xFF."));
-      return true;
-    }
+  const uint8_t status = i2cWriteBytes(address, data, dataLen);
+  if (status != 0) {
+    printI2cTxStatus(status);
+    return;
+  }
 
-    const size_t dataLen = argc - 3;
-    if (dataLen == 0 || (1 + dataLen) > kI2cMaxTransferLen) {
-      Serial.print(F("Payload too long. reg + data must be <= "));
-      Serial.print(kI2cMaxTransferLen);
-      Serial.println(F(" bytes."));
-      return true;
-    }
+  Serial.print(F("Wrote "));
+  Serial.print(dataLen);
+  Serial.print(F(" byte(s) to "));
+  printI2cAddress(address);
+  Serial.println();
+}
 
-    uint8_t data[kI2cMaxTransferLen - 1] = {};
-    for (size_t i = 0; i < dataLen; ++i) {
-      if (!parseByteValue(argv[3 + i], data[i])) {
-        Serial.print(F("Invalid data byte: "));
-        Serial.println(argv[3 + i]);
-        return true;
-      }
+void cmdI2cwr(char *argv[], size_t argc) {
+  uint8_t address = 0;
+  if (!parseI2cAddress(argv[1], address)) {
+    Serial.println(F("Invalid address. Use 0x00..0x7F."));
+    return;
+  }
+
+  uint8_t data[kI2cMaxTransferLen] = {};
+  size_t regLen = 0;
+  if (!parseRegToken(argv[2], data, regLen)) {
+    return;
+  }
+  size_t len = regLen;
+  if (!parseDataTokens(argv + 3, argc - 3, data, kI2cMaxTransferLen, len)) {
+    return;
+  }
+
+  const uint8_t status = i2cWriteBytes(address, data, len);
+  if (status != 0) {
+    printI2cTxStatus(status);
+    return;
+  }
+
+  Serial.print(F("Wrote reg "));
+  printReg(data, regLen);
+  Serial.print(F(" + "));
+  Serial.print(len - regLen);
+  Serial.print(F(" byte(s) to "));
+  printI2cAddress(address);
+  Serial.println();
+}
+
+void cmdI2crr(char *argv[], size_t argc) {
+  uint8_t address = 0;
+  uint8_t reg[2] = {};
+  size_t regLen = 0;
+  uint16_t length = 0;
+  if (!parseI2cAddress(argv[1], address)) {
+    Serial.println(F("Invalid address. Use 0x00..0x7F."));
+    return;
+  }
+  if (!parseRegToken(argv[2], reg, regLen)) {
+    return;
+  }
+  if (!parseI2cLen(argv[3], length)) {
+    Serial.println(F("Invalid length. Use 1..65535."));
+    return;
+  }
+  readAndPrint(address, reg, regLen, length);
+}
+
+void cmdI2cpage(char *argv[], size_t argc) {
+  uint8_t address = 0;
+  uint8_t memAddr[2] = {};
+  size_t memLen = 0;
+  uint8_t page = 0;
+  if (!parseI2cAddress(argv[1], address)) {
+    Serial.println(F("Invalid address. Use 0x00..0x7F."));
+    return;
+  }
+  if (!parseRegToken(argv[2], memAddr, memLen)) {
+    return;
+  }
+  if (!parseByteValue(argv[3], page) || page == 0 || page > kI2cMaxPage) {
+    Serial.print(F("Invalid page size. Use 1.."));
+    Serial.println(kI2cMaxPage);
+    return;
+  }
+
+  uint16_t repeat = 1;
+  if (argv[argc - 1][0] == '*') {
+    unsigned long raw = 0;
+    if (argc == 5 || !parseUnsignedAuto(argv[argc - 1] + 1, raw) || raw == 0 || raw > 0xFFFFUL) {
+      Serial.println(F("Invalid repeat. Use *1..*65535 after the data."));
+      return;
     }
+    repeat = static_cast<uint16_t>(raw);
+    --argc;
+  }
 
-    Wire.beginTransmission(address);
-    Wire.write(reg);
-    for (size_t i = 0; i < dataLen; ++i) {
-      Wire.write(data[i]);
+  uint8_t pattern[kI2cMaxTransferLen] = {};
+  PageSource source = {pattern, 0, 0, false};
+  if (argv[4][0] == '/') {
+#if FEATURE_FS
+    uint8_t nodeIndex = kFsRootParent;
+    FsEntry entry;
+    if (argc != 5 || !fsResolvePath(argv[4], nodeIndex, entry) || entry.isDir ||
+        entry.dataLen == 0) {
+      Serial.println(F("File not found or empty."));
+      return;
     }
-    const uint8_t status = Wire.endTransmission();
-    if (status != 0) {
-      printI2cTxStatus(status);
-      return true;
+    source = {nullptr, entry.dataStart, entry.dataLen, true};
+#else
+    Serial.println(F("File data needs feature_fs=1."));
+    return;
+#endif
+  } else {
+    size_t len = 0;
+    if (!parseDataTokens(argv + 4, argc - 4, pattern, kI2cMaxTransferLen, len)) {
+      return;
     }
+    source.len = static_cast<uint16_t>(len);
+  }
 
-    Serial.print(F("Wrote reg 0x"));
-    printHexByte(reg);
-    Serial.print(F(" + "));
-    Serial.print(dataLen);
-    Serial.print(F(" byte(s) to "));
-    printI2cAddress(address);
-    Serial.println();
-    return true;
+  const uint32_t start = regValue(memAddr, memLen);
+  const uint32_t total = static_cast<uint32_t>(source.len) * repeat;
+  if (start + total > (memLen == 2 ? 0x10000UL : 0x100UL)) {
+    Serial.println(F("Write runs past the end of the address space."));
+    return;
   }
 
-  if (argc > 0 && strcmp(argv[0], "i2crr") == 0) {
-    if (argc != 4) {
-      Serial.println(F("Usage: i2crr <addr> <reg> <n>"));
-      Serial.print(F("n range: 1.."));
-      Serial.println(kI2cMaxTransferLen);
-      return true;
+  uint8_t frame[2 + kI2cMaxPage];
+  uint16_t pages = 0;
+  uint32_t polls = 0;
+  const uint32_t startUs = micros();
+  for (uint32_t done = 0; done < total;) {
+    const uint32_t mem = start + done;
+    uint32_t chunk = page - mem % page;
+    if (chunk > total - done) {
+      chunk = total - done;
     }
-
-    uint8_t address = 0;
-    uint8_t reg = 0;
-    uint8_t length = 0;
-    if (!parseI2cAddress(argv[1], address)) {
-      Serial.println(F("Invalid address. Use 0x00..0x7F."));
-      return true;
+    if (memLen == 2) {
+      frame[0] = static_cast<uint8_t>(mem >> 8);
     }
-    if (!parseByteValue(argv[2], reg)) {
-      Serial.println(F("Invalid register. Use 0..255 or 0x00..0xFF."));
-      return true;
+    frame[memLen - 1] = static_cast<uint8_t>(mem);
+    for (uint8_t i = 0; i < chunk; ++i) {
+      frame[memLen + i] = sourceByte(source, done + i);
     }
-    if (!parseI2cLen(argv[3], length)) {
-      Serial.print(F("Invalid length. Use 1.."));
-      Serial.println(kI2cMaxTransferLen);
-      return true;
+    uint8_t status = i2cWriteBytes(address, frame, memLen + chunk);
+    if (status == 0) {
+      status = static_cast<uint8_t>(pollAck(address, polls));
     }
-
-    Wire.beginTransmission(address);
-    Wire.write(reg);
-    const uint8_t txStatus = Wire.endTransmission(false);
-    if (txStatus != 0) {
-      printI2cTxStatus(txStatus);
-      return true;
+    if (status != 0) {
+      printI2cTxStatus(status);
+      Serial.print(F("Stopped at 0x"));
+      printHexWord(static_cast<uint16_t>(mem));
+      Serial.print(F(" after "));
+      Serial.print(done);
+      Serial.println(F(" byte(s)."));
+      return;
     }
+    done += chunk;
+    ++pages;
+  }
+  const uint32_t us = micros() - startUs;
+
+  Serial.print(F("Wrote "));
+  printI2cAddress(address);
+  Serial.print(F(" @ "));
+  printReg(memAddr, memLen);
+  Serial.print(F(", "));
+  Serial.print(pages);
+  Serial.print(F(" page(s), "));
+  Serial.print(polls);
+  Serial.println(F(" ack poll(s)."));
+  printThroughput(total, us);
+}
 
-    const uint8_t received =
-        Wire.requestFrom(static_cast<int>(address), static_cast<int>(length));
-    Serial.print(F("i2crr "));
-    printI2cAddress(address);
-    Serial.print(F(" reg 0x"));
-    printHexByte(reg);
-    Serial.print(F(" -> "));
-    Serial.print(received);
-    Serial.print(F(" byte(s):"));
-
-    for (uint8_t i = 0; i < received && Wire.available() > 0; ++i) {
-      const uint8_t value = static_cast<uint8_t>(Wire.read());
-      Serial.write(' ');
-      Serial.print(F("0x"));
-      printHexByte(value);
+void cmdI2cdump(char *argv[], size_t argc) {
+  if (equalsIgnoreCase(argv[1], F("diff"))) {
+#if FEATURE_I2C_SNAPSHOT
+    if (argc != 2) {
+      Serial.println(F("Usage: i2cdump diff"));
+      return;
     }
-    Serial.println();
+    dumpDiff();
+#else
+    Serial.println(F("i2cdump diff needs feature_i2c_snapshot = 1."));
+#endif
+    return;
+  }
 
-    if (received != length) {
-      Serial.print(F("Short read (requested "));
-      Serial.print(length);
-      Serial.println(F(")."));
+  uint8_t address = 0;
+  if (!parseI2cAddress(argv[1], address)) {
+    Serial.println(F("Invalid address. Use 0x00..0x7F."));
+    return;
+  }
+  uint8_t regLen = 1;
+  unsigned long bounds[2] = {0, 0};
+  uint8_t given = 0;
+  for (size_t i = 2; i < argc; ++i) {
+    if (equalsIgnoreCase(argv[i], F("width8"))) {
+      regLen = 1;
+    } else if (equalsIgnoreCase(argv[i], F("width16"))) {
+      regLen = 2;
+    } else if (given < 2 && parseUnsignedAuto(argv[i], bounds[given]) &&
+               bounds[given] <= 0xFFFFUL) {
+      ++given;
+    } else {
+      Serial.println(F("Usage: i2cdump <addr> [start] [end] [width8|width16]"));
+      return;
     }
-    return true;
   }
-#else
-  (void)argv;
-  (void)argc;
-#endif
+  const unsigned long regMax = regLen == 2 ? 0xFFFFUL : 0xFFUL;
+  if (given < 2) {
+    bounds[1] = bounds[0] + 0xFFUL < regMax ? bounds[0] + 0xFFUL : regMax;
+  }
+  if (bounds[0] > bounds[1]) {
+    Serial.println(F("Invalid range: start is past end."));
+    return;
+  }
+  if (bounds[1] > regMax || bounds[1] - bounds[0] >= 0xFFFFUL) {
+    Serial.println(regLen == 2 ? F("Invalid range. At most 65535 registers at a time.")
+                               : F("Invalid range. Use 0x00..0xFF, or width16 for more."));
+    return;
+  }
 
-  return false;
+  gSnapshot.address = address;
+  gSnapshot.regLen = regLen;
+  gSnapshot.start = static_cast<uint16_t>(bounds[0]);
+  uint8_t reg[2] = {};
+  setRegBytes(reg, gSnapshot.start);
+  const uint16_t length = static_cast<uint16_t>(bounds[1] - bounds[0] + 1U);
+
+  TwiStatus status = TwiStatus::Ok;
+  const uint32_t startUs = micros();
+  const uint16_t received = readChunks(address, reg, regLen, length, printDumpRow, status);
+  const uint32_t us = micros() - startUs;
+  printShortRead(received, length, status);
+  gSnapshot.len = received < kI2cSnapshotBytes ? received : kI2cSnapshotBytes;
+  if (received == 0) {
+    gSnapshot.regLen = 0;
+    return;
+  }
+  printThroughput(received, us);
+#if FEATURE_I2C_SNAPSHOT
+  if (received > kI2cSnapshotBytes) {
+    Serial.print(F("i2cdump diff compares the first "));
+    Serial.print(kI2cSnapshotBytes);
+    Serial.println(F(" registers."));
+  }
+#endif
 }
+#endif
 
 } // namespace shell
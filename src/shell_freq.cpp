@@ -0,0 +1,403 @@
+#include "shell.hpp"
+
+#include <string.h>
+#include <util/atomic.h>
+
+namespace shell {
+
+namespace {
+
+bool gTimer1Claimed = false;
+uint8_t gSavedTccr1a = 0;
+uint8_t gSavedTccr1b = 0;
+uint8_t gSavedTimsk1 = 0;
+
+// Timer1 input engine state, shared with the ISRs below.
+volatile uint16_t gT1Overflows = 0;
+volatile uint32_t gCaptureFirst = 0;
+volatile uint32_t gCaptureLast = 0;
+volatile uint32_t gCaptureEdges = 0;
+volatile bool gCaptureTooFast = false;
+uint32_t gGateStartTicks = 0;
+
+// pwidth: the capture ISR queues edge stamps, widthStep() folds them into the statistics.
+struct WidthStats {
+  uint16_t count;
+  uint32_t min;
+  uint32_t max;
+  uint64_t sum;
+  uint32_t ref; // first level; deviations from it keep the sums for the jitter small
+  int64_t sumDev;
+  uint64_t sumDevSq;
+};
+
+static_assert((kWidthEdges & (kWidthEdges - 1)) == 0, "kWidthEdges must be a power of two");
+
+bool gWidthActive = false;
+uint32_t gWidthEdges[kWidthEdges];
+volatile uint8_t gWidthHead = 0;
+volatile uint8_t gWidthCount = 0;
+volatile bool gWidthOverrun = false;
+uint16_t gWidthLevels = 0;
+uint16_t gWidthFolded = 0; // stamps taken off the queue; even ones are rising edges
+uint32_t gWidthPrev = 0;
+uint32_t gWidthLastEdgeMs = 0;
+WidthStats gWidthHigh;
+WidthStats gWidthLow;
+
+// Overflow count extended by an overflow that is pending but not yet serviced. `count` must
+// be read after the flag, with interrupts off.
+uint32_t extendTimer1(uint16_t count) {
+  return timer1Stamp(gT1Overflows, (TIFR1 & _BV(TOV1)) != 0, count);
+}
+
+// Runs in the capture ISR while pwidth owns Timer1. Flipping the edge select after every
+// capture timestamps both edges of each level.
+void widthEdge(uint32_t stamp) {
+  const bool rose = (TCCR1B & _BV(ICES1)) != 0;
+  TCCR1B = static_cast<uint8_t>(TCCR1B ^ _BV(ICES1));
+  TIFR1 = _BV(ICF1); // changing the edge select can raise a false capture
+  // The pin has to still be at the level this edge made. If it is not, the next edge came
+  // before the edge select was flipped and went unseen.
+  const bool high = (PINB & _BV(PINB0)) != 0; // ICP1 is PB0 (kFreqCapturePin)
+  if (high != rose || (gCaptureEdges != 0 && captureTooClose(gCaptureLast, stamp))) {
+    gCaptureTooFast = true;
+  }
+  gCaptureLast = stamp;
+  ++gCaptureEdges;
+  if (gWidthCount == kWidthEdges) {
+    gWidthOverrun = true;
+    return;
+  }
+  gWidthEdges[(gWidthHead + gWidthCount) & (kWidthEdges - 1U)] = stamp;
+  ++gWidthCount;
+}
+
+void foldWidth(WidthStats &stats, uint32_t ticks) {
+  if (stats.count == 0) {
+    stats.min = ticks;
+    stats.max = ticks;
+    stats.ref = ticks;
+  }
+  if (ticks < stats.min) {
+    stats.min = ticks;
+  }
+  if (ticks > stats.max) {
+    stats.max = ticks;
+  }
+  stats.sum += ticks;
+  const int64_t dev = static_cast<int32_t>(ticks - stats.ref);
+  stats.sumDev += dev;
+  stats.sumDevSq += static_cast<uint64_t>(dev * dev);
+  ++stats.count;
+}
+
+uint32_t isqrt(uint64_t value) {
+  uint64_t root = 0;
+  uint64_t bit = 1ULL << 62;
+  while (bit > value) {
+    bit >>= 2;
+  }
+  while (bit != 0) {
+    if (value >= root + bit) {
+      value -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return static_cast<uint32_t>(root);
+}
+
+uint64_t meanX100(const WidthStats &stats) { return stats.sum * 100U / stats.count; }
+
+// "high min 3999 mean 4000.06 max 4001, p-p 2, sd 0.43 ticks = 250.00 us"
+void printWidthStats(const __FlashStringHelper *label, const WidthStats &stats) {
+  Serial.print(label);
+  Serial.print(F(" min "));
+  Serial.print(stats.min);
+  Serial.print(F(" mean "));
+  printHundredths(static_cast<uint32_t>(meanX100(stats)));
+  Serial.print(F(" max "));
+  Serial.print(stats.max);
+  Serial.print(F(", p-p "));
+  Serial.print(stats.max - stats.min);
+  // Kept to jitter below 16 bits of ticks so the sums cannot overflow; beyond that the
+  // spread is not jitter any more and p-p says enough.
+  if (stats.max - stats.min <= 0xFFFFUL) {
+    const uint64_t n = stats.count;
+    const uint64_t spread =
+        n * stats.sumDevSq - static_cast<uint64_t>(stats.sumDev * stats.sumDev);
+    Serial.print(F(", sd "));
+    printHundredths(isqrt(spread * 10000U / (n * n)));
+  }
+  Serial.print(F(" ticks = "));
+  printHundredths(static_cast<uint32_t>(meanX100(stats) / (F_CPU / 1000000UL)));
+  Serial.println(F(" us"));
+}
+
+} // namespace
+
+bool timer1Claim() {
+  // analogWrite() on D9/D10 drives the compare outputs; taking the timer would stop it.
+  if (gTimer1Claimed || (TCCR1A & (_BV(COM1A1) | _BV(COM1B1))) != 0) {
+    return false;
+  }
+  gSavedTccr1a = TCCR1A;
+  gSavedTccr1b = TCCR1B;
+  gSavedTimsk1 = TIMSK1;
+  gTimer1Claimed = true;
+  return true;
+}
+
+bool timer1InUse() { return gTimer1Claimed; }
+
+// Puts back the core's PWM configuration so later analogWrite() calls on D9/D10 work.
+void timer1Release() {
+  TCCR1B = 0;
+  TIMSK1 = gSavedTimsk1;
+  TCCR1A = gSavedTccr1a;
+  TCNT1 = 0;
+  TIFR1 = static_cast<uint8_t>(_BV(TOV1) | _BV(ICF1) | _BV(OCF1A) | _BV(OCF1B));
+  TCCR1B = gSavedTccr1b;
+  gTimer1Claimed = false;
+}
+
+bool freqStart(FreqMode mode) {
+  if (mode == FreqMode::Polled) {
+    return true;
+  }
+  if (!timer1Claim()) {
+    return false;
+  }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    TCCR1B = 0;
+    TCCR1A = 0;
+    TCNT1 = 0;
+    gT1Overflows = 0;
+    gCaptureEdges = 0;
+    gCaptureTooFast = false;
+    TIFR1 = static_cast<uint8_t>(_BV(TOV1) | _BV(ICF1));
+    if (mode == FreqMode::Gate) {
+      TIMSK1 = _BV(TOIE1);
+      gGateStartTicks = timerTicks();
+      TCCR1B = static_cast<uint8_t>(_BV(CS12) | _BV(CS11) | _BV(CS10)); // T1 rising edges
+    } else {
+      TIMSK1 = static_cast<uint8_t>(_BV(TOIE1) | _BV(ICIE1));
+      TCCR1B = static_cast<uint8_t>(_BV(ICNC1) | _BV(ICES1) | _BV(CS10)); // F_CPU, rising
+    }
+  }
+  return true;
+}
+
+void freqStop(FreqMode mode, FreqReading &out) {
+  out = FreqReading();
+  out.mode = mode;
+  if (mode == FreqMode::Polled || !gTimer1Claimed) {
+    return;
+  }
+  uint32_t events = 0;
+  uint32_t span = 0;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (mode == FreqMode::Gate) {
+      TCCR1B = 0; // freeze the count before the gate time is read
+      span = gateSpanUs(timerTicks() - gGateStartTicks);
+      events = extendTimer1(TCNT1);
+    } else {
+      TIMSK1 = 0;
+      if (gCaptureEdges >= 2) {
+        events = gCaptureEdges - 1U;
+        span = gCaptureLast - gCaptureFirst;
+      }
+      out.tooFast = gCaptureTooFast;
+    }
+  }
+  timer1Release();
+  freqCompute(mode, events, span, out);
+}
+
+bool widthStart(uint16_t levels) {
+  if (!timer1Claim()) {
+    return false;
+  }
+  memset(&gWidthHigh, 0, sizeof(gWidthHigh));
+  memset(&gWidthLow, 0, sizeof(gWidthLow));
+  gWidthLevels = levels;
+  gWidthFolded = 0;
+  gWidthLastEdgeMs = millis();
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    TCCR1B = 0;
+    TCCR1A = 0;
+    TCNT1 = 0;
+    gT1Overflows = 0;
+    gCaptureEdges = 0;
+    gCaptureTooFast = false;
+    gWidthHead = 0;
+    gWidthCount = 0;
+    gWidthOverrun = false;
+    gWidthActive = true;
+    TIFR1 = static_cast<uint8_t>(_BV(TOV1) | _BV(ICF1));
+    TIMSK1 = static_cast<uint8_t>(_BV(TOIE1) | _BV(ICIE1));
+    TCCR1B = static_cast<uint8_t>(_BV(ICNC1) | _BV(ICES1) | _BV(CS10)); // F_CPU, rising first
+  }
+  return true;
+}
+
+// The interval after a rising edge is a high level, the one after a falling edge a low
+// level. Returns true once the measurement is over: every level counted, an edge missed,
+// or no edge for kWidthTimeoutMs.
+bool widthStep() {
+  while (gWidthLow.count < gWidthLevels) {
+    bool popped = false;
+    uint32_t stamp = 0;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      if (gWidthCount != 0) {
+        stamp = gWidthEdges[gWidthHead];
+        gWidthHead = static_cast<uint8_t>((gWidthHead + 1U) & (kWidthEdges - 1U));
+        --gWidthCount;
+        popped = true;
+      }
+    }
+    if (!popped) {
+      break;
+    }
+    gWidthLastEdgeMs = millis();
+    if (gWidthFolded != 0) {
+      foldWidth((gWidthFolded & 1U) != 0 ? gWidthHigh : gWidthLow, stamp - gWidthPrev);
+    }
+    gWidthPrev = stamp;
+    ++gWidthFolded;
+  }
+  return gWidthLow.count >= gWidthLevels || gCaptureTooFast || gWidthOverrun ||
+         millis() - gWidthLastEdgeMs >= kWidthTimeoutMs;
+}
+
+void widthStop() {
+  if (!gWidthActive) {
+    return;
+  }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    TIMSK1 = 0;
+    gWidthActive = false;
+  }
+  timer1Release();
+}
+
+void printWidthReport() {
+  Serial.print(F("pwidth "));
+  printPinLabel(kFreqCapturePin);
+  if (gCaptureTooFast) {
+    Serial.print(F(": a level was shorter than input capture can follow ("));
+    Serial.print(kCaptureMinCycles);
+    Serial.println(F(" cycles)."));
+    return;
+  }
+  if (gWidthOverrun) {
+    Serial.println(F(": edges came faster than they could be processed."));
+    return;
+  }
+  if (gWidthLow.count == 0) {
+    Serial.print(F(": no complete high and low level within "));
+    Serial.print(kWidthTimeoutMs);
+    Serial.println(F(" ms."));
+    return;
+  }
+  constexpr uint32_t kTickNsX10 = 10000000000ULL / F_CPU;
+  Serial.print(F(": "));
+  Serial.print(gWidthHigh.count);
+  Serial.print(F(" high / "));
+  Serial.print(gWidthLow.count);
+  Serial.print(F(" low levels"));
+  if (gWidthLow.count < gWidthLevels) {
+    Serial.print(F(" (signal stopped)"));
+  }
+  Serial.print(F(", 1 tick = "));
+  Serial.print(kTickNsX10 / 10U);
+  Serial.write('.');
+  Serial.print(kTickNsX10 % 10U);
+  Serial.println(F(" ns"));
+  printWidthStats(F("high"), gWidthHigh);
+  printWidthStats(F("low "), gWidthLow);
+
+  const uint64_t periodX100 = meanX100(gWidthHigh) + meanX100(gWidthLow);
+  Serial.print(F("period "));
+  printHundredths(static_cast<uint32_t>(periodX100 / (F_CPU / 1000000UL)));
+  Serial.print(F(" us = "));
+  printHundredths(static_cast<uint32_t>(F_CPU * 10000ULL / periodX100));
+  Serial.print(F(" Hz, duty "));
+  printHundredths(static_cast<uint32_t>(meanX100(gWidthHigh) * 10000U / periodX100));
+  Serial.println('%');
+}
+
+void printFreqReading(int pin, const FreqReading &reading) {
+  Serial.print(F("freq "));
+  printPinLabel(pin);
+  if (reading.mode == FreqMode::Reciprocal && reading.tooFast) {
+    Serial.println(F(": too fast for input capture; measure on D5."));
+    return;
+  }
+  if (reading.mode == FreqMode::Reciprocal && reading.span == 0) {
+    Serial.println(F(": fewer than 2 edges in the window."));
+    return;
+  }
+  Serial.print(F(" ~= "));
+  printHundredths(reading.hzX100);
+  Serial.print(F(" Hz"));
+  if (reading.mode != FreqMode::Polled) {
+    Serial.print(F(" +/- "));
+    printHundredths(reading.errX100);
+    Serial.print(F(" Hz"));
+  }
+  if (reading.resPpmX100 != 0) {
+    Serial.print(F(", res "));
+    printHundredths(reading.resPpmX100);
+    Serial.print(F(" ppm"));
+  }
+  switch (reading.mode) {
+    case FreqMode::Gate:
+      Serial.print(F(" (gate: "));
+      Serial.print(reading.events);
+      Serial.print(F(" counts in "));
+      Serial.print(reading.span);
+      Serial.println(F(" us)"));
+      break;
+    case FreqMode::Reciprocal:
+      Serial.print(F(" (reciprocal: "));
+      Serial.print(reading.events);
+      Serial.print(F(" periods in "));
+      Serial.print(reading.span);
+      Serial.println(F(" cycles)"));
+      break;
+    case FreqMode::Polled:
+      Serial.print(F(" (polled: edges="));
+      Serial.print(reading.events);
+      Serial.print(F(", sampled="));
+      Serial.print(reading.span);
+      Serial.println(F(" us)"));
+      break;
+  }
+}
+
+} // namespace shell
+
+ISR(TIMER1_OVF_vect) { ++shell::gT1Overflows; }
+
+ISR(TIMER1_CAPT_vect) {
+  using namespace shell;
+  const uint16_t icr = ICR1;
+  const uint32_t stamp = extendTimer1(icr);
+  if (gWidthActive) {
+    widthEdge(stamp);
+    return;
+  }
+  if (gCaptureEdges != 0 && captureTooClose(gCaptureLast, stamp)) {
+    // Edges closer than this handler's own cost may have overwritten ICR1 unseen.
+    gCaptureTooFast = true;
+  }
+  if (gCaptureEdges == 0) {
+    gCaptureFirst = stamp;
+  }
+  gCaptureLast = stamp;
+  ++gCaptureEdges;
+}
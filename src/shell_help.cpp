@@ -1,68 +1,70 @@
 #include "shell.hpp"
 
-namespace shell {
+#include <avr/pgmspace.h>
 
-void printHelp() {
-  Serial.println(F("\n=== Help ==="));
-  Serial.println(F("Shell:"));
-  Serial.println(F("  help                - show this help"));
-  Serial.println(F("  status              - show shell status"));
-  Serial.println(F("  ver                 - firmware/build info"));
-  Serial.println(F("  id                  - board + MCU signature"));
-  Serial.println(F("  echo <text>         - echo text back"));
-  Serial.println(F("  reset               - watchdog software reset"));
-  Serial.println(F("  free                - free RAM estimate"));
-  Serial.println(F("  uptime              - formatted uptime"));
+namespace shell {
 
-  Serial.println(F("Timing:"));
-  Serial.println(F("  micros              - current micros()"));
-  Serial.println(F("  delay <ms>          - blocking delay"));
-  Serial.println(F("  freq <pin> [ms]     - estimate input frequency"));
+namespace {
 
-  Serial.println(F("GPIO:"));
-  Serial.println(F("  pinmode <pin> <in|out|pullup>"));
-  Serial.println(F("  digitalread <pin>"));
-  Serial.println(F("  digitalwrite <pin> <0|1>"));
-  Serial.println(F("  analogread <A0-A5>"));
-  Serial.println(F("  pwm <pin> <0-255>"));
-#if FEATURE_TONE
-  Serial.println(F("  tone <pin> <freq> [ms]"));
-  Serial.println(F("  notone <pin>"));
-#endif
-  Serial.println(F("  pulse <pin> <count> <high_ms> <low_ms>"));
-  Serial.println(F("  watch <pin>         - press any key to stop"));
+constexpr uint8_t kHelpUsageWidth = 20;
 
-#if FEATURE_I2C
-  Serial.println(F("I2C:"));
-  Serial.println(F("  i2cscan             - scan I2C bus"));
-  Serial.println(F("  i2cspeed <100k|400k> - set bus speed"));
-  Serial.println(F("  i2cread <addr> <n>  - read N bytes"));
-  Serial.println(F("  i2cwrite <addr> <bytes...>"));
-  Serial.println(F("  i2cwr <addr> <reg> <bytes...>"));
-  Serial.println(F("  i2crr <addr> <reg> <n>"));
-#endif
+const __FlashStringHelper *groupTitle(CommandGroup group) {
+  switch (group) {
+  case CommandGroup::Shell:
+    return F("Shell:");
+  case CommandGroup::Timing:
+    return F("Timing:");
+  case CommandGroup::Tasks:
+    return F("Tasks & jobs:");
+  case CommandGroup::Gpio:
+    return F("GPIO:");
+  case CommandGroup::I2c:
+    return F("I2C:");
+  case CommandGroup::Eeprom:
+    return F("EEPROM:");
+  case CommandGroup::Fs:
+    return F("FS (EEPROM):");
+  case CommandGroup::LowLevel:
+    return F("Low-level AVR:");
+  }
+  return F("");
+}
 
-#if FEATURE_EEPROM
-  Serial.println(F("EEPROM:"));
-  Serial.println(F("  eepread <addr> [len]"));
-  Serial.println(F("  eepwrite <addr> <bytes...>"));
-  Serial.println(F("  eeperase confirm    - clear EEPROM"));
-#endif
+void printHelpLine(const CommandSpec &spec) {
+  Serial.print(F("  "));
+  const size_t usageLen = strlen_P(spec.usage);
+  Serial.print(reinterpret_cast<const __FlashStringHelper *>(spec.usage));
+  if (pgm_read_byte(spec.desc) != '\0') {
+    size_t pad = (usageLen < kHelpUsageWidth) ? (kHelpUsageWidth - usageLen) : 1;
+    while (pad-- > 0) {
+      Serial.write(' ');
+    }
+    Serial.print(F("- "));
+    Serial.print(reinterpret_cast<const __FlashStringHelper *>(spec.desc));
+  }
+  Serial.println();
+}
 
-#if FEATURE_FS
-  Serial.println(F("FS (EEPROM):"));
-  Serial.println(F("  fs help             - filesystem commands"));
-#endif
+} // namespace
 
-#if FEATURE_LOWLEVEL
-  Serial.println(F("Low-level AVR:"));
-  Serial.println(F("  ddr <port> [value]  - view/set DDRx"));
-  Serial.println(F("  port <port> [value] - view/set PORTx"));
-  Serial.println(F("  pin <port>          - read PINx"));
-  Serial.println(F("  peek <addr>         - read memory byte"));
-  Serial.println(F("  poke <addr> <val>   - write memory byte"));
-  Serial.println(F("  reg                 - dump AVR core registers"));
-#endif
+void printHelp() {
+  Serial.println(F("\n=== Help ==="));
+  CommandSpec spec;
+  for (uint8_t group = 0; group <= static_cast<uint8_t>(CommandGroup::LowLevel); ++group) {
+    bool titled = false;
+    for (size_t i = 0; i < commandCount(); ++i) {
+      readCommand(i, spec);
+      if (static_cast<uint8_t>(spec.group) != group) {
+        continue;
+      }
+      if (!titled) {
+        Serial.println(groupTitle(spec.group));
+        titled = true;
+      }
+      printHelpLine(spec);
+    }
+  }
+  Serial.println(F("End a [&] command with '&' to run it as a background job."));
   Serial.println();
 }
 
@@ -1,62 +1,287 @@
 #include "shell.hpp"
 
 #include <ctype.h>
+#include <util/atomic.h>
 
 namespace shell {
 
-void updateSerial() {
-  while (Serial.available() > 0) {
-    const char c = static_cast<char>(Serial.read());
+char gLineBuffer[kCmdBufferSize];
+volatile uint16_t gRxDroppedBytes = 0;
+volatile uint16_t gRxDroppedLines = 0;
 
-    if (gEscState == EscState::SeenEsc) {
-      gEscState = (c == '[') ? EscState::SeenEscBracket : EscState::None;
-      continue;
-    }
+namespace {
 
-    if (gEscState == EscState::SeenEscBracket) {
-      if (c == 'A') {
-        historyUp();
-      } else if (c == 'B') {
-        historyDown();
-      }
-      gEscState = EscState::None;
-      continue;
-    }
+// Line queue, filled by the RX ISR and drained by updateSerial().
+char gRxQueue[kRxLineQueueSize];
+uint8_t gRxQueueHead = 0;
+uint8_t gRxQueueTail = 0;
+volatile uint8_t gRxQueueUsed = 0;
+volatile uint8_t gRxQueueLines = 0;
+uint8_t gRxQueueHighWater = 0;
+
+// Echo bookkeeping: gEchoLen chars of the edit line are on the terminal, and the ISR
+// lowers gEditStableLen whenever it changes text the terminal has already seen.
+uint8_t gEchoLen = 0;
+volatile uint8_t gEditStableLen = 0;
+
+uint8_t nextQueueIndex(uint8_t index) {
+  return static_cast<uint8_t>((index + 1U) % kRxLineQueueSize);
+}
+
+void lowerEditStable(size_t len) {
+  if (len < gEditStableLen) {
+    gEditStableLen = static_cast<uint8_t>(len);
+  }
+}
 
-    if (c == 0x1B) {
-      gEscState = EscState::SeenEsc;
-      continue;
+void commitEditLine() {
+  gCmdBuffer[gCmdLen] = '\0';
+  const uint8_t needed = static_cast<uint8_t>(gCmdLen + 2U);
+  if (needed > static_cast<uint8_t>(kRxLineQueueSize - gRxQueueUsed)) {
+    ++gRxDroppedLines;
+  } else {
+    gRxQueue[gRxQueueHead] = static_cast<char>(gEditStableLen);
+    gRxQueueHead = nextQueueIndex(gRxQueueHead);
+    for (size_t i = 0; i <= gCmdLen; ++i) {
+      gRxQueue[gRxQueueHead] = gCmdBuffer[i];
+      gRxQueueHead = nextQueueIndex(gRxQueueHead);
     }
+    gRxQueueUsed = static_cast<uint8_t>(gRxQueueUsed + needed);
+    ++gRxQueueLines;
+    if (gRxQueueUsed > gRxQueueHighWater) {
+      gRxQueueHighWater = gRxQueueUsed;
+    }
+    pushHistory(gCmdBuffer);
+  }
+
+  gCmdLen = 0;
+  gEditStableLen = 0;
+  resetHistoryBrowse();
+}
 
-    if (c == '\r') {
-      continue;
+void syncInputEcho() {
+  size_t len = 0;
+  uint8_t keep = 0;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (gRxQueueLines > 0) {
+      return; // The edit line belongs to a later command; wait for the queue to drain.
     }
+    len = gCmdLen;
+    keep = gEditStableLen;
+    gEditStableLen = static_cast<uint8_t>(len);
+  }
 
-    if (c == '\b' || c == 127) {
-      if (gCmdLen > 0) {
-        --gCmdLen;
-        Serial.print(F("\b \b"));
-      }
-      continue;
+  if (keep > gEchoLen) {
+    keep = gEchoLen;
+  }
+  while (gEchoLen > keep) {
+    Serial.print(F("\b \b"));
+    --gEchoLen;
+  }
+  for (size_t i = gEchoLen; i < len; ++i) {
+    Serial.write(gCmdBuffer[i]);
+  }
+  gEchoLen = static_cast<uint8_t>(len);
+}
+
+} // namespace
+
+// Runs in the USART RX ISR: escape decoding, editing and history happen here so bytes
+// typed while a handler is busy are never left in a small hardware buffer.
+void assembleInputByte(char c) {
+#if FEATURE_BINARY
+  if (gBinaryMode) {
+    binaryRxByte(static_cast<uint8_t>(c));
+    return;
+  }
+  if (binaryMagicByte(c)) {
+    gCmdLen = 0;
+    gEditStableLen = 0;
+    gEscState = EscState::None;
+    return;
+  }
+#endif
+
+  if (gEscState == EscState::SeenEsc) {
+    gEscState = (c == '[') ? EscState::SeenEscBracket : EscState::None;
+    return;
+  }
+
+  if (gEscState == EscState::SeenEscBracket) {
+    if (c == 'A') {
+      historyUp();
+      gEditStableLen = 0;
+    } else if (c == 'B') {
+      historyDown();
+      gEditStableLen = 0;
     }
+    gEscState = EscState::None;
+    return;
+  }
+
+  if (c == 0x1B) {
+    gEscState = EscState::SeenEsc;
+    return;
+  }
+
+  if (c == '\r') {
+    return;
+  }
 
-    if (c == '\n') {
-      Serial.println();
-      gCmdBuffer[gCmdLen] = '\0';
-      pushHistory(gCmdBuffer);
-      handleCommand(gCmdBuffer);
-      gCmdLen = 0;
-      resetHistoryBrowse();
-      printPrompt();
-      continue;
+  if (c == '\b' || c == 127) {
+    if (gCmdLen > 0) {
+      --gCmdLen;
+      lowerEditStable(gCmdLen);
     }
+    return;
+  }
+
+  if (c == '\n') {
+    commitEditLine();
+    return;
+  }
 
-    if (isprint(static_cast<unsigned char>(c)) && gCmdLen < (kCmdBufferSize - 1)) {
+  if (isprint(static_cast<unsigned char>(c))) {
+    if (gCmdLen < (kCmdBufferSize - 1)) {
       gCmdBuffer[gCmdLen++] = c;
-      Serial.write(c); // Echo typed input.
+    } else {
+      ++gRxDroppedBytes;
     }
   }
 }
 
+bool popInputLine(char *out, uint8_t &echoKeep) {
+  if (gRxQueueLines == 0) {
+    return false;
+  }
+
+  // Single consumer: only the head moves under us, so copy without blocking the ISR.
+  uint8_t tail = gRxQueueTail;
+  uint8_t consumed = 1;
+  echoKeep = static_cast<uint8_t>(gRxQueue[tail]);
+  tail = nextQueueIndex(tail);
+  size_t len = 0;
+  while (true) {
+    const char c = gRxQueue[tail];
+    tail = nextQueueIndex(tail);
+    ++consumed;
+    out[len++] = c;
+    if (c == '\0') {
+      break;
+    }
+  }
+
+  gRxQueueTail = tail;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    gRxQueueUsed = static_cast<uint8_t>(gRxQueueUsed - consumed);
+    --gRxQueueLines;
+  }
+  return true;
+}
+
+uint8_t inputQueueUsed() { return gRxQueueUsed; }
+
+uint8_t inputQueueHighWater() { return gRxQueueHighWater; }
+
+void discardInput() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    gRxQueueTail = gRxQueueHead;
+    gRxQueueUsed = 0;
+    gRxQueueLines = 0;
+    gCmdLen = 0;
+    gEditStableLen = 0;
+    gEscState = EscState::None;
+  }
+}
+
+void clearPromptLine() {
+  const uint8_t width = static_cast<uint8_t>(strlen_P(kPrompt) + gEchoLen);
+  Serial.write('\r');
+  for (uint8_t i = 0; i < width; ++i) {
+    Serial.write(' ');
+  }
+  Serial.write('\r');
+  // The edit line is redrawn in full after the next prompt.
+  gEchoLen = 0;
+}
+
+void printUartStats() {
+  uint16_t droppedBytes = 0;
+  uint16_t droppedLines = 0;
+  uint8_t lines = 0;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    droppedBytes = gRxDroppedBytes;
+    droppedLines = gRxDroppedLines;
+    lines = gRxQueueLines;
+  }
+
+  Serial.println(F("\n=== UART ==="));
+  Serial.print(F("RX queue: "));
+  Serial.print(inputQueueUsed());
+  Serial.print(F("/"));
+  Serial.print(kRxLineQueueSize);
+  Serial.print(F(" bytes, "));
+  Serial.print(lines);
+  Serial.print(F(" line(s), peak "));
+  Serial.println(inputQueueHighWater());
+  Serial.print(F("RX dropped: "));
+  Serial.print(droppedBytes);
+  Serial.print(F(" byte(s), "));
+  Serial.print(droppedLines);
+  Serial.println(F(" line(s)"));
+  Serial.print(F("TX: "));
+  Serial.print(gTxBytes);
+  Serial.print(F(" byte(s), blocked "));
+  Serial.print(gTxBlockedUs);
+  Serial.print(F(" us in "));
+  Serial.print(gTxStalls);
+  Serial.print(F(" stall(s), ring "));
+  Serial.print(kTxRingSize);
+  Serial.println(F(" bytes"));
+  Serial.println(F("============\n"));
+}
+
+void resetUartStats() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    gRxDroppedBytes = 0;
+    gRxDroppedLines = 0;
+    gRxQueueHighWater = gRxQueueUsed;
+  }
+  gTxBytes = 0;
+  gTxBlockedUs = 0;
+  gTxStalls = 0;
+}
+
+void updateSerial() {
+#if FEATURE_BINARY
+  if (gBinaryMode) {
+    updateBinaryProtocol();
+    Serial.push();
+    return;
+  }
+#endif
+
+  uint8_t keep = 0;
+  if (popInputLine(gLineBuffer, keep)) {
+    // Finish echoing the line; text typed while a handler ran has not been shown yet.
+    if (keep > gEchoLen) {
+      keep = gEchoLen;
+    }
+    while (gEchoLen > keep) {
+      Serial.print(F("\b \b"));
+      --gEchoLen;
+    }
+    Serial.println(gLineBuffer + keep);
+    gEchoLen = 0;
+
+    handleCommand(gLineBuffer);
+    printPrompt();
+    Serial.push();
+    return;
+  }
+
+  syncInputEcho();
+  Serial.push();
+}
 
 } // namespace shell
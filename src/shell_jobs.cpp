@@ -0,0 +1,843 @@
+#include "shell.hpp"
+
+namespace shell {
+
+bool gJobDetach = false;
+
+namespace {
+
+enum class JobKind : uint8_t { Free, Delay, Freq, Width, Pulse, Watch, Capture, Adc, Scan };
+
+struct Job {
+  JobKind kind = JobKind::Free;
+  bool foreground = false;
+  bool levelHigh = false; // pulse: level currently driven
+  uint8_t pin = 0;
+  FastPin io = {nullptr, 0}; // pulse output, polled freq input
+  uint32_t startMs = 0;
+  uint32_t dueMs = 0; // next step for delay/pulse
+  union {
+    struct {
+      uint32_t ms;
+    } delay;
+    struct {
+      uint32_t windowUs;
+      uint32_t startUs;
+      uint32_t sampledUs; // polled only
+      uint32_t edges;     // polled only
+      FreqMode mode;
+      bool probing;
+    } freq;
+    struct {
+      uint32_t left; // software trains; Timer1 keeps its own count
+      uint32_t highMs;
+      uint32_t lowMs;
+      int8_t channel; // Timer1 compare channel, or -1 for a software train
+    } pulse;
+    struct {
+      uint32_t pinMask;
+      uint32_t prevTicks; // last edge printed, 0 before the first
+    } watch;
+    struct {
+      bool binary;
+    } adc;
+#if FEATURE_I2C
+    struct {
+      TwiTxn txn;          // the address probe, or the id read after a hit
+      uint32_t startTicks; // timerTicks() at the start, for the finer fast-scan timing
+      I2cClock clock;      // SCL of a fast scan's own transactions
+      uint8_t address;     // last address probed, 0 before the first
+      uint8_t found;
+      uint8_t reg; // id register and the value read from it
+      uint8_t value;
+      bool waiting;     // txn was submitted and its answer has not been looked at yet
+      bool identifying; // txn is (or is next to be) the id read
+      bool fast;
+      bool identify;
+    } scan;
+#endif
+  };
+
+  Job() : freq{0, 0, 0, 0, FreqMode::Polled, false} {}
+};
+
+Job gJobs[kJobSlots];
+// True while updateJobs() steps jobs with the prompt on screen; output then has to clear
+// the prompt line first and redraw it afterwards.
+bool gJobsAtPrompt = false;
+
+bool dueBefore(uint32_t a, uint32_t b) { return static_cast<int32_t>(a - b) < 0; }
+
+int8_t allocJob(JobKind kind) {
+  for (uint8_t i = 0; i < kJobSlots; ++i) {
+    if (gJobs[i].kind != JobKind::Free) {
+      continue;
+    }
+    gJobs[i] = Job();
+    gJobs[i].kind = kind;
+    gJobs[i].startMs = millis();
+    gJobs[i].dueMs = gJobs[i].startMs;
+    return static_cast<int8_t>(i);
+  }
+  return kNoJob;
+}
+
+bool keyStopsJob(const Job &job) {
+  return job.kind == JobKind::Pulse || job.kind == JobKind::Watch ||
+         job.kind == JobKind::Capture || job.kind == JobKind::Adc;
+}
+
+void printJobId(uint8_t slot) {
+  Serial.write('[');
+  Serial.print(slot + 1U);
+  Serial.print(F("] "));
+}
+
+void printJobDescription(const Job &job) {
+  switch (job.kind) {
+    case JobKind::Delay:
+      Serial.print(F("delay "));
+      Serial.print(job.delay.ms);
+      Serial.print(F(" ms"));
+      break;
+    case JobKind::Freq:
+      Serial.print(F("freq "));
+      if (job.freq.probing) {
+        Serial.print(F("auto"));
+      } else {
+        printPinLabel(job.pin);
+      }
+      Serial.write(' ');
+      Serial.print(job.freq.windowUs / 1000UL);
+      Serial.print(F(" ms"));
+      break;
+    case JobKind::Width:
+      Serial.print(F("pwidth "));
+      printPinLabel(kFreqCapturePin);
+      break;
+    case JobKind::Pulse:
+      Serial.print(F("pulse "));
+      printPinLabel(job.pin);
+      Serial.print(F(", "));
+      Serial.print(job.pulse.channel >= 0 ? pulseGenLeft(job.pulse.channel) : job.pulse.left);
+      Serial.print(F(" left"));
+      break;
+    case JobKind::Watch:
+      Serial.print(F("watch "));
+      printPinList(job.watch.pinMask);
+      break;
+    case JobKind::Capture:
+      Serial.print(F("capture"));
+      break;
+    case JobKind::Adc:
+      Serial.print(F("adc"));
+      break;
+    case JobKind::Scan:
+      Serial.print(F("i2cscan"));
+#if FEATURE_I2C
+      if (job.scan.fast) {
+        Serial.print(F(" fast"));
+      }
+      if (job.scan.identify) {
+        Serial.print(F(" id"));
+      }
+#endif
+      break;
+    case JobKind::Free:
+      break;
+  }
+}
+
+// Every line a job prints goes through these two: background lines are tagged with the job
+// id, and at the prompt the half-typed command is moved below the output.
+void beginJobLine(uint8_t slot) {
+  if (gJobsAtPrompt) {
+    clearPromptLine();
+  }
+  if (!gJobs[slot].foreground) {
+    printJobId(slot);
+  }
+}
+
+void endJobLine() {
+  if (gJobsAtPrompt) {
+    printPrompt();
+  }
+}
+
+void finishJob(uint8_t slot, const __FlashStringHelper *message) {
+  beginJobLine(slot);
+  Serial.println(message);
+  endJobLine();
+  gJobs[slot].kind = JobKind::Free;
+}
+
+void finishFreq(uint8_t slot) {
+  Job &job = gJobs[slot];
+  FreqReading reading;
+  if (job.freq.mode == FreqMode::Polled) {
+    freqCompute(FreqMode::Polled, job.freq.edges, job.freq.sampledUs, reading);
+  } else {
+    freqStop(job.freq.mode, reading);
+  }
+  beginJobLine(slot);
+  printFreqReading(job.pin, reading);
+  endJobLine();
+  job.kind = JobKind::Free;
+}
+
+// The Timer1 engines count in hardware, so their step only watches the clock. The polled
+// fallback samples for one slice per step; edges are only counted inside slices and divided
+// by the sampled time, so the gaps left for the rest of the loop do not skew the estimate.
+void stepFreq(uint8_t slot) {
+  Job &job = gJobs[slot];
+  const uint32_t spentUs = micros() - job.freq.startUs;
+  if (job.freq.probing) {
+    if (spentUs < kFreqProbeMs * 1000UL) {
+      return;
+    }
+    FreqReading probe;
+    freqStop(FreqMode::Gate, probe);
+    job.freq.probing = false;
+    if (probe.hzX100 > kFreqReciprocalMaxHz * 100UL) {
+      job.freq.mode = FreqMode::Gate;
+      job.pin = kFreqCounterPin;
+    } else {
+      job.freq.mode = FreqMode::Reciprocal;
+      job.pin = kFreqCapturePin;
+    }
+    freqStart(job.freq.mode); // Timer1 was just released by this job, so this cannot fail
+    job.freq.startUs = micros();
+    return;
+  }
+  if (spentUs >= job.freq.windowUs) {
+    finishFreq(slot);
+    return;
+  }
+  if (job.freq.mode != FreqMode::Polled) {
+    return;
+  }
+
+  const uint32_t sliceUs = (job.freq.windowUs - spentUs < kFreqSliceUs)
+                               ? job.freq.windowUs - spentUs
+                               : static_cast<uint32_t>(kFreqSliceUs);
+  const uint32_t sliceStart = micros();
+  bool prev = fastRead(job.io);
+  uint32_t elapsedUs = 0;
+  do {
+    const bool curr = fastRead(job.io);
+    if (!prev && curr) {
+      ++job.freq.edges;
+    }
+    prev = curr;
+    elapsedUs = micros() - sliceStart;
+  } while (elapsedUs < sliceUs);
+  job.freq.sampledUs += elapsedUs;
+}
+
+// Input capture stamps every edge in hardware; the step only folds them into the statistics.
+void stepWidth(uint8_t slot) {
+  if (!widthStep()) {
+    return;
+  }
+  widthStop();
+  beginJobLine(slot);
+  printWidthReport();
+  endJobLine();
+  gJobs[slot].kind = JobKind::Free;
+}
+
+#if FEATURE_CAPTURE
+// A foreground capture streams its dump straight away; a background one only reports, so
+// the dump is not split up by job tags and prompt redraws.
+void stepCapture(uint8_t slot) {
+  Job &job = gJobs[slot];
+  if (captureRunning()) {
+    return;
+  }
+  if (job.foreground) {
+    printCaptureDump();
+  } else {
+    beginJobLine(slot);
+    printCaptureSummary();
+    endJobLine();
+  }
+  job.kind = JobKind::Free;
+}
+#endif
+
+// Edges are timestamped by the PCINT handlers; a step prints what has queued since the
+// last one, at most one ring's worth so a chattering input cannot hold up the loop.
+void stepWatch(uint8_t slot) {
+  Job &job = gJobs[slot];
+  WatchEvent event;
+  for (uint8_t n = 0; n < kWatchEvents && watchPop(event); ++n) {
+    beginJobLine(slot);
+    printWatchEvent(event, job.watch.prevTicks);
+    endJobLine();
+  }
+  const uint16_t dropped = watchTakeDropped();
+  if (dropped != 0) {
+    beginJobLine(slot);
+    Serial.print(dropped);
+    Serial.println(F(" edge event(s) dropped: ring full."));
+    endJobLine();
+  }
+}
+
+#if FEATURE_ADC
+// Blocks are drained every step. Summaries go out at most once per kAdcSummaryMs, so the
+// UART keeps up whatever the conversion rate; binary blocks go out as they fill.
+void stepAdc(uint8_t slot) {
+  Job &job = gJobs[slot];
+  const bool running = adcRunning();
+  for (uint8_t n = 0; n < 2 && adcBlockReady(); ++n) {
+    if (job.adc.binary) {
+      adcWriteBlock();
+    } else {
+      adcFoldBlock();
+    }
+  }
+  if (running && adcBlockReady()) {
+    return;
+  }
+  const uint32_t now = millis();
+  if (!job.adc.binary && adcSummaryReady() && (!running || !dueBefore(now, job.dueMs))) {
+    beginJobLine(slot);
+    printAdcSummary();
+    endJobLine();
+    job.dueMs = now + kAdcSummaryMs;
+  }
+  if (!running) {
+    adcStop();
+    beginJobLine(slot);
+    printAdcEnd();
+    endJobLine();
+    job.kind = JobKind::Free;
+  }
+}
+#endif
+
+#if FEATURE_I2C
+constexpr uint16_t kProbeTimeoutTicks =
+    kI2cProbeTimeoutUs * (F_CPU / 1000000UL) / kCyclesPerTick;
+constexpr uint16_t kScanSliceTicks = kI2cScanSliceUs * (F_CPU / 1000000UL) / kCyclesPerTick;
+
+void printScanHit(uint8_t slot) {
+  const Job &job = gJobs[slot];
+  const TwiTxn &txn = job.scan.txn;
+  beginJobLine(slot);
+  Serial.print(txn.status == TwiStatus::Ok || job.scan.identifying ? F("  found @ ")
+                                                                   : F("  bus error @ "));
+  printI2cAddress(job.scan.address);
+  if (job.scan.identifying) {
+    const __FlashStringHelper *name = i2cIdName(job.scan.address, job.scan.value);
+    if (txn.status == TwiStatus::Ok && name != nullptr) {
+      Serial.print(F(": "));
+      Serial.print(name);
+    }
+    Serial.print(F(" (reg 0x"));
+    printHexByte(job.scan.reg);
+    if (txn.status == TwiStatus::Ok) {
+      Serial.print(F(" = 0x"));
+      printHexByte(job.scan.value);
+      Serial.write(')');
+    } else {
+      Serial.print(F(" read failed)"));
+    }
+  }
+  Serial.println();
+  endJobLine();
+}
+
+void finishScan(uint8_t slot) {
+  Job &job = gJobs[slot];
+  beginJobLine(slot);
+  if (job.scan.found == 0) {
+    Serial.print(F("No I2C devices found"));
+  } else {
+    Serial.print(F("I2C devices found: "));
+    Serial.print(job.scan.found);
+  }
+  Serial.print(F(" ("));
+  printHundredths((timerTicks() - job.scan.startTicks) * kCyclesPerTick / (F_CPU / 100000UL));
+  Serial.println(F(" ms)."));
+  endJobLine();
+  job.kind = JobKind::Free;
+}
+
+// Looks at the answer to the last transaction and queues the next: the probe of the next
+// address, or first the id read of a device that just answered. Returns whether a
+// transaction is now waiting on the bus.
+bool advanceScan(uint8_t slot) {
+  Job &job = gJobs[slot];
+  TwiTxn &txn = job.scan.txn;
+  if (txn.queued) {
+    return false;
+  }
+  if (job.scan.waiting) {
+    job.scan.waiting = false;
+    if (job.scan.identifying) {
+      printScanHit(slot);
+      job.scan.identifying = false;
+      ++job.scan.found;
+    } else if (txn.status == TwiStatus::Ok && job.scan.identify &&
+               i2cIdRegister(job.scan.address, job.scan.reg)) {
+      job.scan.identifying = true;
+    } else if (txn.status != TwiStatus::AddrNack) {
+      printScanHit(slot);
+      if (txn.status == TwiStatus::Ok) {
+        ++job.scan.found;
+      }
+    }
+  }
+
+  txn = TwiTxn();
+  txn.ownClock = job.scan.fast;
+  txn.clock = job.scan.clock;
+  if (job.scan.identifying) {
+    txn.address = job.scan.address;
+    txn.tx = &job.scan.reg;
+    txn.txLen = 1;
+    txn.rx = &job.scan.value;
+    txn.rxLen = 1;
+  } else if (job.scan.address == 0x7F) {
+    finishScan(slot);
+    return false;
+  } else {
+    txn.address = static_cast<uint8_t>(job.scan.address + 1U);
+    txn.timeoutTicks = job.scan.fast ? kProbeTimeoutTicks : 0;
+  }
+  if (!twiSubmit(txn)) {
+    return false;
+  }
+  job.scan.address = txn.address;
+  job.scan.waiting = true;
+  return true;
+}
+
+// A plain scan keeps one transaction on the queue and leaves the loop in between, so the
+// prompt, tasks and other I2C traffic run alongside it. A fast scan waits out each probe
+// here instead, for up to kI2cScanSliceUs per step, so the whole bus takes a few steps.
+void stepScan(uint8_t slot) {
+  Job &job = gJobs[slot];
+  const uint32_t sliceStart = timerTicks();
+  while (advanceScan(slot) && job.scan.fast && timerTicks() - sliceStart < kScanSliceTicks) {
+    while (job.scan.txn.queued) {
+      updateTwi();
+    }
+  }
+}
+#endif
+
+void stepTimedPulse(uint8_t slot) {
+  Job &job = gJobs[slot];
+  if (pulseGenRunning(job.pulse.channel)) {
+    return;
+  }
+  const uint16_t late = pulseGenStop(job.pulse.channel);
+  if (late == 0) {
+    finishJob(slot, F("Pulse completed."));
+    return;
+  }
+  beginJobLine(slot);
+  Serial.print(F("Pulse completed; "));
+  Serial.print(late);
+  Serial.println(F(" edge(s) were late."));
+  endJobLine();
+  job.kind = JobKind::Free;
+}
+
+void stepJob(uint8_t slot) {
+  Job &job = gJobs[slot];
+  if (job.kind == JobKind::Freq) {
+    stepFreq(slot);
+    return;
+  }
+  if (job.kind == JobKind::Width) {
+    stepWidth(slot);
+    return;
+  }
+  if (job.kind == JobKind::Watch) {
+    stepWatch(slot);
+    return;
+  }
+  if (job.kind == JobKind::Pulse && job.pulse.channel >= 0) {
+    stepTimedPulse(slot);
+    return;
+  }
+#if FEATURE_CAPTURE
+  if (job.kind == JobKind::Capture) {
+    stepCapture(slot);
+    return;
+  }
+#endif
+#if FEATURE_ADC
+  if (job.kind == JobKind::Adc) {
+    stepAdc(slot);
+    return;
+  }
+#endif
+#if FEATURE_I2C
+  if (job.kind == JobKind::Scan) {
+    stepScan(slot);
+    return;
+  }
+#endif
+  const uint32_t now = millis();
+  if (job.kind == JobKind::Free || dueBefore(now, job.dueMs)) {
+    return;
+  }
+
+  switch (job.kind) {
+    case JobKind::Delay:
+      finishJob(slot, F("Done."));
+      break;
+    case JobKind::Pulse:
+      if (job.levelHigh) {
+        fastWrite(job.io, false);
+        job.levelHigh = false;
+        if (--job.pulse.left == 0) {
+          finishJob(slot, F("Pulse completed."));
+          break;
+        }
+        job.dueMs += job.pulse.lowMs;
+      } else {
+        fastWrite(job.io, true);
+        job.levelHigh = true;
+        job.dueMs += job.pulse.highMs;
+      }
+      break;
+    case JobKind::Freq:
+    case JobKind::Width:
+    case JobKind::Watch:
+    case JobKind::Capture:
+    case JobKind::Adc:
+    case JobKind::Scan:
+    case JobKind::Free:
+      break;
+  }
+}
+
+void stepJobs() {
+  for (uint8_t i = 0; i < kJobSlots; ++i) {
+    stepJob(i);
+  }
+}
+
+void stopJob(uint8_t slot) {
+  Job &job = gJobs[slot];
+  if (job.kind == JobKind::Pulse && job.pulse.channel >= 0) {
+    pulseGenStop(job.pulse.channel);
+  } else if (job.kind == JobKind::Pulse) {
+    fastWrite(job.io, false);
+  }
+  if (job.kind == JobKind::Watch) {
+    watchStop();
+  }
+  if (job.kind == JobKind::Freq && job.freq.mode != FreqMode::Polled) {
+    FreqReading unused;
+    freqStop(job.freq.mode, unused);
+  }
+  if (job.kind == JobKind::Width) {
+    widthStop();
+  }
+#if FEATURE_CAPTURE
+  if (job.kind == JobKind::Capture) {
+    captureAbort();
+  }
+#endif
+#if FEATURE_ADC
+  if (job.kind == JobKind::Adc) {
+    adcStop();
+  }
+#endif
+#if FEATURE_I2C
+  // The descriptor lives in the slot, so it has to come off the queue first.
+  while (job.kind == JobKind::Scan && job.scan.txn.queued) {
+    updateTwi();
+  }
+#endif
+  job.kind = JobKind::Free;
+}
+
+// Runs the job to completion from inside its command while background jobs and tasks keep
+// going. A keypress stops pulse and watch, as it always has; other input waits its turn.
+void waitForeground(uint8_t slot) {
+  Job &job = gJobs[slot];
+  job.foreground = true;
+  const bool keyStops = keyStopsJob(job);
+  if (job.kind == JobKind::Watch) {
+    Serial.println(F("Press any key to stop."));
+  }
+  if (keyStops) {
+    Serial.discardInput();
+  }
+
+  while (job.kind != JobKind::Free) {
+    updateBackgroundTasks();
+    stepJobs();
+    if (keyStops && job.kind != JobKind::Free && Serial.available() > 0) {
+      Serial.discardInput();
+#if FEATURE_ADC
+      if (job.kind == JobKind::Adc) {
+        // The job drains what was acquired and prints its own end line.
+        adcStop();
+        continue;
+      }
+#endif
+      if (job.kind == JobKind::Watch) {
+        Serial.println(F("Watch stopped."));
+      } else if (job.kind == JobKind::Pulse) {
+        Serial.println(F("Pulse aborted by keypress."));
+      } else {
+        Serial.println(F("Capture stopped."));
+      }
+      stopJob(slot);
+    }
+  }
+}
+
+} // namespace
+
+int8_t jobStartDelay(uint32_t ms) {
+  const int8_t slot = allocJob(JobKind::Delay);
+  if (slot != kNoJob) {
+    gJobs[slot].delay.ms = ms;
+    gJobs[slot].dueMs += ms;
+  }
+  return slot;
+}
+
+int8_t jobStartFreq(uint8_t pin, FreqMode mode, bool probe, uint32_t windowMs) {
+  const int8_t slot = allocJob(JobKind::Freq);
+  if (slot == kNoJob) {
+    return kNoJob;
+  }
+  if (!freqStart(mode)) {
+    gJobs[slot].kind = JobKind::Free;
+    Serial.println(F("Timer1 is busy (PWM or pulse on D9/D10, or another freq job)."));
+    return kJobRefused;
+  }
+  gJobs[slot].pin = pin;
+  gJobs[slot].io = fastPin(pin);
+  gJobs[slot].freq = {windowMs * 1000U, static_cast<uint32_t>(micros()), 0, 0, mode, probe};
+  return slot;
+}
+
+int8_t jobStartWidth(uint16_t levels) {
+  const int8_t slot = allocJob(JobKind::Width);
+  if (slot == kNoJob) {
+    return kNoJob;
+  }
+  if (!widthStart(levels)) {
+    gJobs[slot].kind = JobKind::Free;
+    Serial.println(F("Timer1 is busy (pwmcfg, pulse or adc on Timer1, or a freq job)."));
+    return kJobRefused;
+  }
+  gJobs[slot].pin = kFreqCapturePin;
+  return slot;
+}
+
+int8_t jobStartPulse(uint8_t pin, uint32_t count, uint32_t highUs, uint32_t lowUs) {
+  const int8_t slot = allocJob(JobKind::Pulse);
+  if (slot == kNoJob) {
+    return kNoJob;
+  }
+  Job &job = gJobs[slot];
+  job.pin = pin;
+  const int8_t channel = pulseChannelForPin(pin);
+  job.pulse = {count, highUs / 1000U, lowUs / 1000U, channel};
+  if (channel >= 0) {
+    job.io = fastOutput(pin, false);
+    if (!pulseGenStart(static_cast<uint8_t>(channel), count, highUs, lowUs)) {
+      job.kind = JobKind::Free;
+      Serial.println(F("Timer1 is busy (PWM on D9/D10, a freq job, or a pulse on this pin)."));
+      return kJobRefused;
+    }
+    return slot;
+  }
+  job.io = fastOutput(pin, true);
+  job.levelHigh = true;
+  job.dueMs += job.pulse.highMs;
+  return slot;
+}
+
+int8_t jobStartWatch(uint32_t pinMask) {
+  const int8_t slot = allocJob(JobKind::Watch);
+  if (slot == kNoJob) {
+    return kNoJob;
+  }
+  if (!watchStart(pinMask)) {
+    gJobs[slot].kind = JobKind::Free;
+    Serial.println(F("Another watch is already running."));
+    return kJobRefused;
+  }
+  gJobs[slot].watch = {pinMask, 0};
+  Serial.print(F("Watching "));
+  printWatchLevels();
+  return slot;
+}
+
+#if FEATURE_CAPTURE
+int8_t jobStartCapture(PortId port, uint32_t rateHz, uint32_t samples,
+                       const CaptureTrigger &trigger) {
+  const int8_t slot = allocJob(JobKind::Capture);
+  if (slot == kNoJob) {
+    return kNoJob;
+  }
+  if (!captureArm(port, rateHz, samples, trigger)) {
+    gJobs[slot].kind = JobKind::Free;
+    Serial.println(F("Timer2 is busy (tone, PWM on D3/D11, or another capture)."));
+    return kJobRefused;
+  }
+  return slot;
+}
+#endif
+
+#if FEATURE_ADC
+int8_t jobStartAdc(const AdcConfig &config) {
+  const int8_t slot = allocJob(JobKind::Adc);
+  if (slot == kNoJob) {
+    return kNoJob;
+  }
+  if (!adcStart(config)) {
+    gJobs[slot].kind = JobKind::Free;
+    Serial.println(F("ADC or Timer1 is busy (another adc, freq, or PWM/pulse on D9/D10)."));
+    return kJobRefused;
+  }
+  gJobs[slot].adc.binary = config.binary;
+  gJobs[slot].dueMs = millis() + kAdcSummaryMs;
+  printAdcHeader();
+  return slot;
+}
+#endif
+
+#if FEATURE_I2C
+int8_t jobStartScan(bool fast, bool identify) {
+  const int8_t slot = allocJob(JobKind::Scan);
+  if (slot == kNoJob) {
+    return kNoJob;
+  }
+  Job &job = gJobs[slot];
+  const uint32_t hz = gI2cClockHz < kI2cScanFastHz ? kI2cScanFastHz : gI2cClockHz;
+  if (fast) {
+    uint8_t pulses = 0;
+    if (!twiRecoverBus(pulses)) {
+      job.kind = JobKind::Free;
+      Serial.println(F("SDA or SCL is held low; the bus could not be recovered."));
+      return kJobRefused;
+    }
+    if (pulses != 0) {
+      Serial.print(F("Bus recovered after "));
+      Serial.print(pulses);
+      Serial.println(F(" clock pulse(s)."));
+    }
+    i2cClockFor(hz, job.scan.clock); // 400 kHz or the i2cspeed rate, both in range
+  }
+  job.scan.txn = TwiTxn();
+  job.scan.startTicks = timerTicks();
+  job.scan.address = 0;
+  job.scan.found = 0;
+  job.scan.waiting = false;
+  job.scan.identifying = false;
+  job.scan.fast = fast;
+  job.scan.identify = identify;
+  Serial.print(F("Scanning I2C addresses 0x01..0x7F"));
+  if (fast) {
+    Serial.print(F(" at "));
+    Serial.print(hz);
+    Serial.print(F(" Hz"));
+  }
+  Serial.println(F("..."));
+  return slot;
+}
+#endif
+
+void runJob(int8_t slot) {
+  if (slot == kNoJob) {
+    Serial.println(F("No free job slot."));
+    return;
+  }
+  if (slot < 0) {
+    return;
+  }
+  if (gJobDetach) {
+    printJobId(static_cast<uint8_t>(slot));
+    printJobDescription(gJobs[slot]);
+    Serial.println();
+    return;
+  }
+  waitForeground(static_cast<uint8_t>(slot));
+}
+
+bool jobForeground(int8_t slot) {
+  if (slot == kNoJob) {
+    // Newest job first, like a shell's bare `fg`.
+    uint32_t newestAge = 0xFFFFFFFFUL;
+    const uint32_t now = millis();
+    for (uint8_t i = 0; i < kJobSlots; ++i) {
+      if (gJobs[i].kind != JobKind::Free && now - gJobs[i].startMs <= newestAge) {
+        newestAge = now - gJobs[i].startMs;
+        slot = static_cast<int8_t>(i);
+      }
+    }
+  }
+  if (slot < 0 || slot >= static_cast<int8_t>(kJobSlots) || gJobs[slot].kind == JobKind::Free) {
+    return false;
+  }
+  printJobDescription(gJobs[slot]);
+  Serial.println();
+  waitForeground(static_cast<uint8_t>(slot));
+  return true;
+}
+
+bool jobKill(uint8_t slot) {
+  if (slot >= kJobSlots || gJobs[slot].kind == JobKind::Free) {
+    return false;
+  }
+  stopJob(slot);
+  return true;
+}
+
+void updateJobs() {
+#if FEATURE_BINARY
+  // Job output would corrupt binary frames; jobs resume when the shell is back in text mode.
+  if (gBinaryMode) {
+    return;
+  }
+#endif
+  gJobsAtPrompt = true;
+  stepJobs();
+  gJobsAtPrompt = false;
+}
+
+void printJobs() {
+  const uint32_t now = millis();
+  Serial.println(F("\n=== Jobs ==="));
+  uint8_t shown = 0;
+  for (uint8_t i = 0; i < kJobSlots; ++i) {
+    const Job &job = gJobs[i];
+    if (job.kind == JobKind::Free) {
+      continue;
+    }
+    ++shown;
+    printJobId(i);
+    printJobDescription(job);
+    Serial.print(F(", running "));
+    Serial.print(now - job.startMs);
+    Serial.print(F(" ms"));
+    if (job.kind == JobKind::Delay) {
+      Serial.print(F(", "));
+      Serial.print(dueBefore(now, job.dueMs) ? job.dueMs - now : 0UL);
+      Serial.print(F(" ms left"));
+    }
+    Serial.println();
+  }
+  if (shown == 0) {
+    Serial.println(F("(no jobs)"));
+  }
+  Serial.println(F("============\n"));
+}
+
+} // namespace shell
@@ -0,0 +1,147 @@
+#include "shell_math.hpp"
+
+#include <assert.h>
+
+#ifdef __AVR__
+#include <util/crc16.h>
+#endif
+
+namespace shell {
+
+bool i2cClockFor(uint32_t hz, I2cClock &clock) {
+  if (hz < kI2cMinHz || hz > kI2cMaxHz) {
+    return false;
+  }
+  uint64_t bestNum = 0;
+  uint32_t bestDivider = 0;
+  for (uint8_t twps = 0; twps < 4; ++twps) {
+    // The divider 16 + 2 * TWBR * 4^twps grows with TWBR, so only the two TWBR values around
+    // the exact one can be closest. On a tie the first setting found, with the smaller
+    // prescaler, is kept.
+    const uint8_t shift = static_cast<uint8_t>(2U * twps + 1U);
+    const uint32_t exact = (F_CPU / hz > 16UL) ? (F_CPU / hz - 16UL) >> shift : 0;
+    for (uint32_t twbr = exact; twbr <= exact + 1U && twbr <= 255U; ++twbr) {
+      const uint32_t divider = 16UL + (twbr << shift);
+      // The error |F_CPU / divider - hz| is num / divider; compared without dividing.
+      const uint64_t target = static_cast<uint64_t>(hz) * divider;
+      const uint64_t num = target > F_CPU ? target - F_CPU : F_CPU - target;
+      if (bestDivider == 0 || num * bestDivider < bestNum * divider) {
+        bestNum = num;
+        bestDivider = divider;
+        clock = {static_cast<uint8_t>(twbr), twps};
+      }
+    }
+  }
+  return true;
+}
+
+uint32_t i2cClockHzX100(const I2cClock &clock) {
+  const uint32_t divider = 16UL + (static_cast<uint32_t>(clock.twbr) << (2U * clock.twps + 1U));
+  return (F_CPU * 100ULL + divider / 2U) / divider;
+}
+
+namespace {
+
+uint32_t ceilDiv(uint64_t num, uint64_t den) {
+  return static_cast<uint32_t>((num + den - 1U) / den);
+}
+
+} // namespace
+
+// Gate and polled readings count edges over `span` microseconds: one count of resolution,
+// plus a gate length that is only known to one Timer0 tick at each end. Reciprocal
+// readings time whole periods in F_CPU cycles, each capture uncertain by one cycle.
+void freqCompute(FreqMode mode, uint32_t events, uint32_t span, FreqReading &out) {
+  out.mode = mode;
+  out.events = events;
+  out.span = span;
+  out.hzX100 = 0;
+  out.errX100 = 0;
+  out.resPpmX100 = 0;
+  if (span == 0) {
+    return;
+  }
+  const uint64_t span64 = span;
+  if (mode == FreqMode::Reciprocal) {
+    out.hzX100 = static_cast<uint32_t>(static_cast<uint64_t>(events) * F_CPU * 100U / span64);
+    out.errX100 = ceilDiv(static_cast<uint64_t>(events) * F_CPU * 200U, span64 * span64);
+    out.resPpmX100 = ceilDiv(100000000ULL, span64);
+    return;
+  }
+  out.hzX100 = static_cast<uint32_t>(static_cast<uint64_t>(events) * 100000000ULL / span64);
+  if (events > 0) {
+    out.resPpmX100 = ceilDiv(100000000ULL, events);
+  }
+  if (mode == FreqMode::Gate) {
+    const uint64_t gateSlackUs = 2U * (kCyclesPerTick / (F_CPU / 1000000UL));
+    out.errX100 = ceilDiv(100000000ULL * (span64 + gateSlackUs * events), span64 * span64);
+  }
+}
+
+
+uint16_t crc16(const uint8_t *data, uint8_t len) {
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i = 0; i < len; ++i) {
+#ifdef __AVR__
+    crc = _crc_xmodem_update(crc, data[i]);
+#else
+    // The C equivalent avr-libc gives for _crc_xmodem_update().
+    crc = static_cast<uint16_t>(crc ^ (static_cast<uint16_t>(data[i]) << 8));
+    for (uint8_t bit = 0; bit < 8; ++bit) {
+      crc = (crc & 0x8000U) != 0 ? static_cast<uint16_t>((crc << 1) ^ 0x1021U)
+                                 : static_cast<uint16_t>(crc << 1);
+    }
+#endif
+  }
+  return crc;
+}
+
+bool frameCrcOk(const uint8_t *frame, uint8_t len) {
+  const uint16_t rxCrc = static_cast<uint16_t>(frame[len - 2] | (frame[len - 1] << 8));
+  return crc16(frame, static_cast<uint8_t>(len - 2U)) == rxCrc;
+}
+
+uint8_t cobsDecode(uint8_t *buf, uint8_t len) {
+  uint8_t r = 0;
+  uint8_t w = 0;
+  while (r < len) {
+    const uint8_t code = buf[r++];
+    if (code == 0 || static_cast<uint16_t>(r) + code - 1U > len) {
+      return 0;
+    }
+    for (uint8_t i = 1; i < code; ++i) {
+      buf[w++] = buf[r++];
+    }
+    if (code != 0xFF && r < len) {
+      buf[w++] = 0;
+    }
+  }
+  return w;
+}
+
+void encodeFrame(uint8_t *data, uint8_t len, void (*put)(const uint8_t *bytes, uint8_t count)) {
+  assert(len <= kFrameMaxData);
+  const uint16_t crc = crc16(data, len);
+  data[len++] = static_cast<uint8_t>(crc & 0xFFU);
+  data[len++] = static_cast<uint8_t>(crc >> 8);
+
+  uint8_t start = 0;
+  while (true) {
+    uint8_t end = start;
+    while (end < len && data[end] != 0 && (end - start) < 254) {
+      ++end;
+    }
+    const uint8_t code = static_cast<uint8_t>(end - start + 1);
+    put(&code, 1);
+    put(data + start, static_cast<uint8_t>(end - start));
+    if (end >= len) {
+      break;
+    }
+    // A full block (code 0xFF) implies no zero; a zero right after it opens the next block.
+    start = (end - start < 254 && data[end] == 0) ? static_cast<uint8_t>(end + 1) : end;
+  }
+  const uint8_t delimiter = 0;
+  put(&delimiter, 1);
+}
+
+} // namespace shell
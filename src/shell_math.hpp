@@ -0,0 +1,75 @@
+#pragma once
+
+// Arithmetic that needs neither the Arduino core nor the AVR registers, so the native test
+// environment can build it on the host.
+
+#include <stdint.h>
+
+namespace shell {
+
+// Timer0 runs at F_CPU/64; its count is the profiler's time base.
+constexpr uint8_t kCyclesPerTick = 64;
+// Capture intervals shorter than this may hide edges lost while the capture ISR ran.
+constexpr uint16_t kCaptureMinCycles = 256;
+
+// SCL = F_CPU / (16 + 2 * TWBR * 4^TWPS): TWBR 0 is the fastest rate, TWBR 255 with the
+// /64 prescaler the slowest.
+constexpr uint32_t kI2cMaxHz = F_CPU / 16UL;
+constexpr uint32_t kI2cMinHz = F_CPU / (16UL + 2UL * 255UL * 64UL) + 1U;
+
+struct I2cClock {
+  uint8_t twbr;
+  uint8_t twps; // prescaler 4^twps
+};
+// Searches every prescaler for the TWBR whose SCL comes closest to hz; false when hz is
+// outside kI2cMinHz..kI2cMaxHz.
+bool i2cClockFor(uint32_t hz, I2cClock &clock);
+uint32_t i2cClockHzX100(const I2cClock &clock);
+
+enum class FreqMode : uint8_t { Polled, Gate, Reciprocal };
+
+struct FreqReading {
+  FreqMode mode = FreqMode::Polled;
+  bool tooFast = false;
+  uint32_t events = 0; // counts (gate), whole periods (reciprocal) or polled edges
+  uint32_t span = 0;   // us, or F_CPU cycles for reciprocal readings
+  uint32_t hzX100 = 0;
+  uint32_t errX100 = 0; // quantization bound only; the clock's own tolerance is not included
+  uint32_t resPpmX100 = 0;
+};
+
+// Timer1 count extended by its serviced overflows, plus one still pending in TOV1. A low
+// count was read after that overflow, a high one before it.
+inline uint32_t timer1Stamp(uint16_t overflows, bool overflowPending, uint16_t count) {
+  if (overflowPending && count < 0x8000U) {
+    ++overflows;
+  }
+  return (static_cast<uint32_t>(overflows) << 16) | count;
+}
+
+// Whether two captures are closer than the capture ISR can follow; wrap-safe.
+inline bool captureTooClose(uint32_t last, uint32_t stamp) {
+  return stamp - last < kCaptureMinCycles;
+}
+
+// Length of a gate that spanned `ticks` Timer0 ticks, in us.
+inline uint32_t gateSpanUs(uint32_t ticks) {
+  return ticks * (kCyclesPerTick / (F_CPU / 1000000UL));
+}
+
+// events over span (us, or F_CPU cycles for Reciprocal) into Hz, error bound and resolution.
+void freqCompute(FreqMode mode, uint32_t events, uint32_t span, FreqReading &out);
+
+// Binary protocol framing. CRC-16/CCITT-FALSE: poly 0x1021, init 0xFFFF.
+uint16_t crc16(const uint8_t *data, uint8_t len);
+// Whether a decoded frame ends in the CRC (low byte first) of the bytes before it.
+bool frameCrcOk(const uint8_t *frame, uint8_t len);
+// In-place COBS decode; returns the decoded length or 0 for a malformed frame.
+uint8_t cobsDecode(uint8_t *buf, uint8_t len);
+// Longest payload encodeFrame() takes: with its CRC the frame must fit an 8-bit length.
+constexpr uint8_t kFrameMaxData = 253;
+// Appends the CRC to data, which needs two free bytes past len, and hands the COBS-encoded
+// frame plus its 0x00 delimiter to `put` a piece at a time. len is at most kFrameMaxData.
+void encodeFrame(uint8_t *data, uint8_t len, void (*put)(const uint8_t *bytes, uint8_t count));
+
+} // namespace shell
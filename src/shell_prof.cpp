@@ -0,0 +1,135 @@
+#include "shell.hpp"
+
+#include <string.h>
+#include <util/atomic.h>
+
+extern "C" volatile unsigned long timer0_overflow_count;
+
+namespace shell {
+
+namespace {
+
+#if FEATURE_PROF
+struct ProfSlot {
+  int8_t command = kStackNoCommand; // Registry index; kStackNoCommand marks a free slot.
+  uint16_t calls = 0;
+  uint32_t totalTicks = 0;
+  uint32_t minTicks = 0;
+  uint32_t maxTicks = 0;
+  uint16_t peakStack = 0;
+};
+
+ProfSlot gProfSlots[kProfSlots];
+
+ProfSlot &slotForCommand(int8_t command) {
+  ProfSlot *fewest = &gProfSlots[0];
+  for (uint8_t i = 0; i < kProfSlots; ++i) {
+    ProfSlot &slot = gProfSlots[i];
+    if (slot.command == command) {
+      return slot;
+    }
+    if (slot.calls < fewest->calls) {
+      fewest = &slot;
+    }
+  }
+  // Table full: the least-used command gives up its slot.
+  *fewest = ProfSlot();
+  fewest->command = command;
+  fewest->minTicks = 0xFFFFFFFFUL;
+  return *fewest;
+}
+
+void printPadded(uint32_t value, uint8_t width) {
+  uint8_t digits = 1;
+  for (uint32_t v = value; v >= 10; v /= 10) {
+    ++digits;
+  }
+  while (digits++ < width) {
+    Serial.write(' ');
+  }
+  Serial.print(value);
+}
+#endif
+
+} // namespace
+
+uint32_t timerTicks() {
+  uint32_t overflows = 0;
+  uint8_t count = 0;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    overflows = timer0_overflow_count;
+    count = TCNT0;
+    // Same correction as micros(): an overflow may be pending behind the atomic block.
+    if ((TIFR0 & _BV(TOV0)) && count < 255) {
+      ++overflows;
+    }
+  }
+  return (overflows << 8) | count;
+}
+
+void printTicks(uint32_t ticks) {
+  if (ticks < (0xFFFFFFFFUL / kCyclesPerTick)) {
+    Serial.print(ticks * kCyclesPerTick);
+    Serial.print(F(" cycles, "));
+  }
+  Serial.print(ticks * (kCyclesPerTick / (F_CPU / 1000000UL)));
+  Serial.print(F(" us"));
+}
+
+#if FEATURE_PROF
+void profRecord(int8_t command, uint32_t ticks, uint16_t stackBytes) {
+  ProfSlot &slot = slotForCommand(command);
+  if (slot.calls < 0xFFFF) {
+    ++slot.calls;
+  }
+  slot.totalTicks += ticks;
+  if (ticks < slot.minTicks) {
+    slot.minTicks = ticks;
+  }
+  if (ticks > slot.maxTicks) {
+    slot.maxTicks = ticks;
+  }
+  if (stackBytes > slot.peakStack) {
+    slot.peakStack = stackBytes;
+  }
+}
+
+void resetProfile() {
+  for (uint8_t i = 0; i < kProfSlots; ++i) {
+    gProfSlots[i] = ProfSlot();
+  }
+}
+
+void printProfile() {
+  Serial.print(F("\n=== Profile (1 tick = "));
+  Serial.print(kCyclesPerTick);
+  Serial.println(F(" cycles) ==="));
+  Serial.println(F("command       calls     min     avg     max  stack"));
+  CommandSpec spec;
+  uint8_t shown = 0;
+  for (uint8_t i = 0; i < kProfSlots; ++i) {
+    const ProfSlot &slot = gProfSlots[i];
+    if (slot.command == kStackNoCommand) {
+      continue;
+    }
+    ++shown;
+    readCommand(static_cast<size_t>(slot.command), spec);
+    Serial.print(spec.name);
+    for (size_t pad = strlen(spec.name); pad < kCommandNameSize; ++pad) {
+      Serial.write(' ');
+    }
+    printPadded(slot.calls, 5);
+    printPadded(slot.minTicks, 8);
+    printPadded(slot.totalTicks / slot.calls, 8);
+    printPadded(slot.maxTicks, 8);
+    printPadded(slot.peakStack, 7);
+    Serial.println();
+  }
+  if (shown == 0) {
+    Serial.println(F("(no commands recorded)"));
+  }
+  Serial.println(F("==================================\n"));
+}
+#endif
+
+} // namespace shell
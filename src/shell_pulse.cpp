@@ -0,0 +1,164 @@
+#include "shell.hpp"
+
+#include <util/atomic.h>
+
+namespace shell {
+
+namespace {
+
+constexpr uint8_t kPulseTicksPerUs = F_CPU / 8UL / 1000000UL; // Timer1 at clk/8
+constexpr uint16_t kPulseLeadTicks = 64;                        // start to first edge
+constexpr uint16_t kPulseChunkTicks = 0x8000;                   // longest single compare step
+
+struct PulseChannel {
+  bool attached; // owns its OC1x pin, from start until pulseGenStop()
+  volatile bool running;
+  bool levelHigh; // level the pin has now
+  volatile uint32_t left;
+  uint32_t highTicks;
+  uint32_t lowTicks;
+  uint32_t segLeft; // ticks of the current level not yet handed to the compare unit
+  uint16_t late;
+};
+
+PulseChannel gChannels[2];
+
+volatile uint16_t &ocrFor(uint8_t channel) { return channel == 0 ? OCR1A : OCR1B; }
+
+uint8_t comShift(uint8_t channel) { return channel == 0 ? COM1A0 : COM1B0; }
+
+// 0b10 clears the pin on the next match, 0b11 sets it, 0b00 hands it back to PORTx.
+void setCompareAction(uint8_t channel, uint8_t action) {
+  const uint8_t shift = comShift(channel);
+  TCCR1A = static_cast<uint8_t>((TCCR1A & ~(3U << shift)) | (action << shift));
+}
+
+void forceCompare(uint8_t channel) { TCCR1C = channel == 0 ? _BV(FOC1A) : _BV(FOC1B); }
+
+uint8_t compareEnableBit(uint8_t channel) { return channel == 0 ? _BV(OCIE1A) : _BV(OCIE1B); }
+
+// Makes "now" the reference for the next step. One tick behind the counter, so the compare
+// unit cannot match on it while the next step is being written.
+void rebaseCompare(uint8_t channel) { ocrFor(channel) = static_cast<uint16_t>(TCNT1 - 1U); }
+
+// Hands the next step of the current level to the compare unit. Levels longer than 16 bits
+// of ticks are split; the intermediate matches drive the pin to the level it already has.
+// Returns false if the match time had already passed by the time it was written.
+bool scheduleStep(uint8_t channel, PulseChannel &c) {
+  const uint16_t step =
+      c.segLeft > 0xFFFFUL ? kPulseChunkTicks : static_cast<uint16_t>(c.segLeft);
+  c.segLeft -= step;
+  const bool driveHigh = (c.segLeft == 0) ? !c.levelHigh : c.levelHigh;
+  setCompareAction(channel, driveHigh ? 3 : 2);
+  volatile uint16_t &ocr = ocrFor(channel);
+  ocr = static_cast<uint16_t>(ocr + step);
+  const uint16_t ahead = static_cast<uint16_t>(ocr - TCNT1);
+  return ahead != 0 && ahead <= step;
+}
+
+// Runs in the compare ISRs. The edge itself was made by the hardware at the match; this
+// only works out the next one. A step that is already late (another ISR held this one off)
+// is applied at once with a forced compare and counted, so the train stays in step.
+void pulseCompare(uint8_t channel) {
+  PulseChannel &c = gChannels[channel];
+  while (true) {
+    if (c.segLeft == 0) {
+      c.levelHigh = !c.levelHigh;
+      if (!c.levelHigh && --c.left == 0) {
+        TIMSK1 = static_cast<uint8_t>(TIMSK1 & ~compareEnableBit(channel));
+        c.running = false;
+        return;
+      }
+      c.segLeft = c.levelHigh ? c.highTicks : c.lowTicks;
+    }
+    if (scheduleStep(channel, c)) {
+      return;
+    }
+    forceCompare(channel);
+    rebaseCompare(channel);
+    if (c.late != 0xFFFF) {
+      ++c.late;
+    }
+  }
+}
+
+} // namespace
+
+int8_t pulseChannelForPin(uint8_t pin) {
+  if (pin == kPulseOc1aPin) {
+    return 0;
+  }
+  if (pin == kPulseOc1bPin) {
+    return 1;
+  }
+  return -1;
+}
+
+// The caller has made the pin an output driven LOW, so it stays LOW when the compare unit
+// lets go of it again.
+bool pulseGenStart(uint8_t channel, uint32_t count, uint32_t highUs, uint32_t lowUs) {
+  PulseChannel &c = gChannels[channel];
+  const bool timerOurs = gChannels[channel ^ 1U].attached;
+  if (c.attached || count == 0 || (!timerOurs && !timer1Claim())) {
+    return false;
+  }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (!timerOurs) {
+      TCCR1B = 0;
+      TCCR1A = 0;
+      TIMSK1 = 0;
+      TCNT1 = 0;
+      TCCR1B = _BV(CS11);
+    }
+    c.left = count;
+    c.highTicks = highUs * kPulseTicksPerUs;
+    c.lowTicks = lowUs * kPulseTicksPerUs;
+    c.late = 0;
+    c.levelHigh = false;
+    c.segLeft = kPulseLeadTicks;
+    setCompareAction(channel, 2);
+    forceCompare(channel); // the output latch may hold a stale HIGH
+    rebaseCompare(channel);
+    scheduleStep(channel, c);
+    TIFR1 = channel == 0 ? _BV(OCF1A) : _BV(OCF1B);
+    TIMSK1 = static_cast<uint8_t>(TIMSK1 | compareEnableBit(channel));
+    c.running = true;
+  }
+  c.attached = true;
+  return true;
+}
+
+bool pulseGenRunning(uint8_t channel) { return gChannels[channel].running; }
+
+uint32_t pulseGenLeft(uint8_t channel) {
+  uint32_t left = 0;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { left = gChannels[channel].left; }
+  return left;
+}
+
+uint16_t pulseGenStop(uint8_t channel) {
+  PulseChannel &c = gChannels[channel];
+  if (!c.attached) {
+    return 0;
+  }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    TIMSK1 = static_cast<uint8_t>(TIMSK1 & ~compareEnableBit(channel));
+    setCompareAction(channel, 2);
+    forceCompare(channel);
+    setCompareAction(channel, 0);
+    c.running = false;
+    c.left = 0;
+    c.segLeft = 0;
+  }
+  c.attached = false;
+  if (!gChannels[channel ^ 1U].attached) {
+    timer1Release();
+  }
+  return c.late;
+}
+
+} // namespace shell
+
+ISR(TIMER1_COMPA_vect) { shell::pulseCompare(0); }
+
+ISR(TIMER1_COMPB_vect) { shell::pulseCompare(1); }
@@ -0,0 +1,169 @@
+#include "shell.hpp"
+
+#include <util/atomic.h>
+
+namespace shell {
+
+namespace {
+
+constexpr uint16_t kTimer1Prescalers[] = {1, 8, 64, 256, 1024};
+constexpr uint8_t kNoPrescaler = 0xFF;
+
+struct PwmCfgChannel {
+  bool active;
+  uint32_t dutyMilli; // thousandths of a percent, as asked for
+  uint16_t high;      // counts of the period the pin spends HIGH
+};
+
+PwmCfgChannel gPwmChannels[2];
+bool gPwmPhaseCorrect = false;
+uint8_t gPwmCs = kNoPrescaler; // index into kTimer1Prescalers while Timer1 is ours
+uint16_t gPwmTop = 0;
+
+// Fast PWM (mode 14) counts 0..TOP, so a period is TOP + 1 counts. Phase-correct PWM
+// (mode 10) counts up and back down, so a period is 2 * TOP counts and the duty has TOP + 1
+// levels.
+uint32_t periodSpan() { return gPwmPhaseCorrect ? gPwmTop : gPwmTop + 1UL; }
+
+uint32_t periodDivider(uint8_t cs, uint16_t top, bool phaseCorrect) {
+  return phaseCorrect ? 2UL * kTimer1Prescalers[cs] * top
+                      : static_cast<uint32_t>(kTimer1Prescalers[cs]) * (top + 1UL);
+}
+
+// Picks the finest prescaler whose TOP fits in 16 bits, which gives the most duty steps.
+bool choosePeriod(uint32_t hz, bool phaseCorrect, uint8_t &cs, uint16_t &top) {
+  for (cs = 0; cs < sizeof(kTimer1Prescalers) / sizeof(kTimer1Prescalers[0]); ++cs) {
+    const uint32_t clock = F_CPU / kTimer1Prescalers[cs] / (phaseCorrect ? 2U : 1U);
+    const uint32_t counts = (clock + hz / 2U) / hz;
+    if (counts < kPwmCfgMinSteps) {
+      return false;
+    }
+    if (counts <= (phaseCorrect ? 0xFFFFUL : 0x10000UL)) {
+      top = static_cast<uint16_t>(phaseCorrect ? counts : counts - 1U);
+      return true;
+    }
+  }
+  return false;
+}
+
+uint8_t comShift(uint8_t channel) { return channel == 0 ? COM1A0 : COM1B0; }
+
+// A duty of 0 disconnects the compare output so the pin sits LOW on its PORT bit; the
+// compare unit itself always leaves a one-count spike in fast mode.
+void applyDuty(uint8_t channel) {
+  PwmCfgChannel &c = gPwmChannels[channel];
+  const uint32_t span = periodSpan();
+  c.high = static_cast<uint16_t>(
+      (static_cast<uint64_t>(c.dutyMilli) * span + kPwmCfgDutyFull / 2U) / kPwmCfgDutyFull);
+  const uint8_t shift = comShift(channel);
+  uint8_t tccr1a = static_cast<uint8_t>(TCCR1A & ~(3U << shift));
+  if (c.high != 0) {
+    const uint16_t ocr = gPwmPhaseCorrect ? c.high : static_cast<uint16_t>(c.high - 1U);
+    (channel == 0 ? OCR1A : OCR1B) = ocr;
+    tccr1a = static_cast<uint8_t>(tccr1a | (2U << shift)); // clear on match, non-inverting
+  }
+  TCCR1A = tccr1a;
+}
+
+uint8_t pinForChannel(uint8_t channel) { return channel == 0 ? kPulseOc1aPin : kPulseOc1bPin; }
+
+} // namespace
+
+uint32_t pwmCfgMaxHz(bool phaseCorrect) {
+  return F_CPU / (phaseCorrect ? 2UL : 1UL) / kPwmCfgMinSteps;
+}
+
+// The two channels share TOP and the prescaler, so a new frequency or mode moves the other
+// channel too; it keeps its duty. A duty change alone only writes OCR1x, which the timer
+// picks up at the end of the period without a glitch.
+bool pwmCfgStart(uint8_t channel, uint32_t hz, uint32_t dutyMilli, bool phaseCorrect) {
+  uint8_t cs = 0;
+  uint16_t top = 0;
+  if (hz == 0 || dutyMilli > kPwmCfgDutyFull || !choosePeriod(hz, phaseCorrect, cs, top)) {
+    return false;
+  }
+  const bool timerOurs = gPwmCs != kNoPrescaler;
+  if (!timerOurs && !timer1Claim()) {
+    return false;
+  }
+  if (!gPwmChannels[channel].active) {
+    fastOutput(pinForChannel(channel), false);
+  }
+  gPwmChannels[channel].active = true;
+  gPwmChannels[channel].dutyMilli = dutyMilli;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (timerOurs && cs == gPwmCs && top == gPwmTop && phaseCorrect == gPwmPhaseCorrect) {
+      applyDuty(channel);
+    } else {
+      // ICR1 is not double-buffered, so the timer is stopped while TOP changes. OCR1x is
+      // written in normal mode, where it takes effect at once.
+      TCCR1B = 0;
+      TCCR1A = 0;
+      TIMSK1 = 0;
+      TCNT1 = 0;
+      ICR1 = top;
+      gPwmCs = cs;
+      gPwmTop = top;
+      gPwmPhaseCorrect = phaseCorrect;
+      for (uint8_t i = 0; i < 2; ++i) {
+        if (gPwmChannels[i].active) {
+          applyDuty(i);
+        }
+      }
+      TCCR1A = static_cast<uint8_t>(TCCR1A | _BV(WGM11));
+      TCCR1B = static_cast<uint8_t>(_BV(WGM13) | (phaseCorrect ? 0 : _BV(WGM12)) | (cs + 1U));
+    }
+  }
+  return true;
+}
+
+bool pwmCfgActive(uint8_t channel) { return gPwmChannels[channel].active; }
+
+void pwmCfgStop(uint8_t channel) {
+  PwmCfgChannel &c = gPwmChannels[channel];
+  if (!c.active) {
+    return;
+  }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    TCCR1A = static_cast<uint8_t>(TCCR1A & ~(3U << comShift(channel)));
+  }
+  fastOutput(pinForChannel(channel), false);
+  c.active = false;
+  if (!gPwmChannels[channel ^ 1U].active) {
+    timer1Release();
+    gPwmCs = kNoPrescaler;
+  }
+}
+
+// "D9 fast 1000.00 Hz, duty 25.00% (4000/16000), 16000 steps = 13 bits"
+void printPwmCfg(uint8_t channel) {
+  const PwmCfgChannel &c = gPwmChannels[channel];
+  printPinLabel(pinForChannel(channel));
+  if (!c.active) {
+    Serial.println(F(" off"));
+    return;
+  }
+  const uint32_t divider = periodDivider(gPwmCs, gPwmTop, gPwmPhaseCorrect);
+  const uint32_t span = periodSpan();
+  const uint32_t levels = gPwmTop + 1UL;
+  uint8_t bits = 0;
+  while ((2UL << bits) <= levels) {
+    ++bits;
+  }
+  Serial.print(gPwmPhaseCorrect ? F(" phase ") : F(" fast "));
+  printHundredths((F_CPU * 100UL + divider / 2U) / divider);
+  Serial.print(F(" Hz, duty "));
+  printHundredths((c.high * 10000UL + span / 2U) / span);
+  Serial.print(F("% ("));
+  Serial.print(c.high);
+  Serial.write('/');
+  Serial.print(span);
+  Serial.print(F("), "));
+  Serial.print(levels);
+  Serial.print(F(" steps = "));
+  Serial.print(bits);
+  Serial.println(F(" bits"));
+}
+
+} // namespace shell
@@ -0,0 +1,245 @@
+#include "shell.hpp"
+
+#include <avr/pgmspace.h>
+#include <string.h>
+
+namespace shell {
+
+namespace {
+
+#define COMMAND_TEXT(id, usage, desc)                                                           \
+  const char kUsage##id[] PROGMEM = usage;                                                      \
+  const char kDesc##id[] PROGMEM = desc
+
+#define COMMAND(name, id, minArgc, maxArgc, group)                                              \
+  { name, kUsage##id, kDesc##id, cmd##id, minArgc, maxArgc, CommandGroup::group, false }
+
+// A command that also accepts a trailing '&' to run as a background job.
+#define JOB_COMMAND(name, id, minArgc, maxArgc, group)                                          \
+  { name, kUsage##id, kDesc##id, cmd##id, minArgc, maxArgc, CommandGroup::group, true }
+
+#if FEATURE_ADC
+COMMAND_TEXT(Adc, "adc <A0[,A1...]> <hz|max> [n=N] [os=N] [clk=N] [bin] [&]",
+             "interrupt-driven ADC scan; summary or binary stream");
+#endif
+COMMAND_TEXT(Analogread, "analogread <A0-A5>", "");
+#if FEATURE_EEPROM
+COMMAND_TEXT(Baud, "baud [rate] [save]", "switch UART rate (confirm with 'ok')");
+#else
+COMMAND_TEXT(Baud, "baud [rate]", "switch UART rate (confirm with 'ok')");
+#endif
+COMMAND_TEXT(Bench, "bench gpio [pin]", "time digitalWrite against direct port access");
+COMMAND_TEXT(Blink, "blink <pin[,pin...]> <ms>", "blink pins in the background");
+#if FEATURE_CAPTURE
+COMMAND_TEXT(Capture, "capture <B|C|D> <hz> <samples> [trigger] [&]",
+             "sample a port into RAM; 'capture dump' prints it");
+#endif
+COMMAND_TEXT(Delay, "delay <ms> [&]", "wait");
+COMMAND_TEXT(Digitalread, "digitalread <pin>", "");
+COMMAND_TEXT(Digitalwrite, "digitalwrite <pin> <0|1>", "");
+COMMAND_TEXT(Echo, "echo <text>", "echo text back");
+COMMAND_TEXT(Free, "free", "free RAM estimate");
+COMMAND_TEXT(Fg, "fg [id]", "wait for a background job");
+COMMAND_TEXT(Freq, "freq <pin|auto> [ms] [&]", "input frequency (D5/D8 in hardware)");
+COMMAND_TEXT(Help, "help", "show this help");
+COMMAND_TEXT(Id, "id", "board + MCU signature");
+COMMAND_TEXT(Jobs, "jobs", "list background jobs");
+COMMAND_TEXT(Kill, "kill <id>", "stop a background job");
+COMMAND_TEXT(Mem, "mem [reset]", "RAM layout + stack low-water mark");
+COMMAND_TEXT(Micros, "micros", "current micros()");
+COMMAND_TEXT(Pinmode, "pinmode <pin> <in|out|pullup>", "");
+COMMAND_TEXT(Pins, "pins", "mode/latch/level of every pin, one snapshot");
+COMMAND_TEXT(Pinset, "pinset <pin[,pin...]> <0|1|bits>", "set output pins, one write per port");
+COMMAND_TEXT(Pulse, "pulse <pin> <count> <high> <low> [&]",
+             "times in ms, or <n>us; D9/D10 are hardware-timed");
+COMMAND_TEXT(Pwidth, "pwidth <pin> [n] [&]", "high/low time + duty via input capture (D8)");
+COMMAND_TEXT(Pwm, "pwm <pin> <0-255>", "");
+COMMAND_TEXT(Pwmcfg, "pwmcfg [<D9|D10> <hz> <duty%> [fast|phase]] | <D9|D10> off",
+             "Timer1 PWM, ICR1 TOP, up to 16-bit");
+#if FEATURE_PROF
+COMMAND_TEXT(Prof, "prof [reset]", "per-command time/stack profile");
+#endif
+COMMAND_TEXT(Reset, "reset", "watchdog software reset");
+COMMAND_TEXT(Status, "status", "show shell status");
+COMMAND_TEXT(Task, "task stop <id>", "stop a background task");
+COMMAND_TEXT(Tasks, "tasks", "list background tasks");
+COMMAND_TEXT(Time, "time <command...>", "run a command and print its duration");
+COMMAND_TEXT(Uart, "uart [reset]", "serial RX/TX counters");
+COMMAND_TEXT(Uptime, "uptime", "formatted uptime");
+COMMAND_TEXT(Ver, "ver", "firmware/build info");
+#if FEATURE_WAVE
+COMMAND_TEXT(Wave, "wave [<pin> <sine|tri|/file> <hz>] | wave off",
+             "DDS waveform on PWM (D3/D11/D9/D10)");
+#endif
+COMMAND_TEXT(Watch, "watch <pin[,pin...]> [&]", "log every edge via pin-change IRQ; key stops");
+#if FEATURE_TONE
+COMMAND_TEXT(Tone, "tone <pin> <freq> [ms]", "");
+COMMAND_TEXT(Notone, "notone <pin>", "");
+#endif
+#if FEATURE_I2C
+#if FEATURE_I2C_SNAPSHOT
+COMMAND_TEXT(I2cdump, "i2cdump <addr> [start] [end] [width8|width16] | diff", "register table");
+#else
+COMMAND_TEXT(I2cdump, "i2cdump <addr> [start] [end] [width8|width16]", "register table");
+#endif
+COMMAND_TEXT(I2cpage, "i2cpage <addr> <mem> <page> <bytes...|/file> [*n]", "paged EEPROM write");
+COMMAND_TEXT(I2cread, "i2cread <addr> <n>", "read N bytes");
+COMMAND_TEXT(I2crr, "i2crr <addr> <reg> <n>", "");
+COMMAND_TEXT(I2cscan, "i2cscan [fast] [id] [&]", "scan I2C bus");
+COMMAND_TEXT(I2cspeed, "i2cspeed [hz|<n>k]", "show/set SCL rate");
+COMMAND_TEXT(I2cstat, "i2cstat [reset]", "I2C transaction status and latency");
+COMMAND_TEXT(I2cwr, "i2cwr <addr> <reg> <bytes...>", "");
+COMMAND_TEXT(I2cwrite, "i2cwrite <addr> <bytes...>", "");
+#endif
+#if FEATURE_EEPROM
+COMMAND_TEXT(Eeperase, "eeperase confirm", "clear EEPROM");
+COMMAND_TEXT(Eepread, "eepread <addr> [len]", "");
+COMMAND_TEXT(Eepwrite, "eepwrite <addr> <bytes...>", "");
+#endif
+#if FEATURE_FS
+COMMAND_TEXT(Fs, "fs help", "filesystem commands");
+#endif
+#if FEATURE_LOWLEVEL
+COMMAND_TEXT(Ddr, "ddr <port> [value]", "view/set DDRx");
+COMMAND_TEXT(Peek, "peek <addr>", "read memory byte");
+COMMAND_TEXT(Pin, "pin <port>", "read PINx");
+COMMAND_TEXT(Poke, "poke <addr> <val>", "write memory byte");
+COMMAND_TEXT(Port, "port <port> [value]", "view/set PORTx");
+COMMAND_TEXT(Reg, "reg", "dump AVR core registers");
+#endif
+
+// Sorted by name (checked below) so lookup is a binary search. Help lists the rows of
+// each group in table order.
+constexpr CommandSpec kCommands[] PROGMEM = {
+#if FEATURE_ADC
+    JOB_COMMAND("adc", Adc, 3, 7, Gpio),
+#endif
+    COMMAND("analogread", Analogread, 2, 2, Gpio),
+    COMMAND("baud", Baud, 1, 3, Shell),
+    COMMAND("bench", Bench, 2, 3, Timing),
+    COMMAND("blink", Blink, 3, 3, Tasks),
+#if FEATURE_CAPTURE
+    JOB_COMMAND("capture", Capture, 2, 5, Gpio),
+#endif
+#if FEATURE_LOWLEVEL
+    COMMAND("ddr", Ddr, 2, 3, LowLevel),
+#endif
+    JOB_COMMAND("delay", Delay, 2, 2, Timing),
+    COMMAND("digitalread", Digitalread, 2, 2, Gpio),
+    COMMAND("digitalwrite", Digitalwrite, 3, 3, Gpio),
+    COMMAND("echo", Echo, 1, kMaxArgs, Shell),
+#if FEATURE_EEPROM
+    COMMAND("eeperase", Eeperase, 2, 2, Eeprom),
+    COMMAND("eepread", Eepread, 2, 3, Eeprom),
+    COMMAND("eepwrite", Eepwrite, 3, kMaxArgs, Eeprom),
+#endif
+    COMMAND("fg", Fg, 1, 2, Tasks),
+    COMMAND("free", Free, 1, 1, Shell),
+    JOB_COMMAND("freq", Freq, 2, 3, Timing),
+#if FEATURE_FS
+    COMMAND("fs", Fs, 1, kMaxArgs, Fs),
+#endif
+    COMMAND("help", Help, 1, 1, Shell),
+#if FEATURE_I2C
+    COMMAND("i2cdump", I2cdump, 2, 5, I2c),
+    COMMAND("i2cpage", I2cpage, 5, kMaxArgs, I2c),
+    COMMAND("i2cread", I2cread, 3, 3, I2c),
+    COMMAND("i2crr", I2crr, 4, 4, I2c),
+    JOB_COMMAND("i2cscan", I2cscan, 1, 3, I2c),
+    COMMAND("i2cspeed", I2cspeed, 1, 2, I2c),
+    COMMAND("i2cstat", I2cstat, 1, 2, I2c),
+    COMMAND("i2cwr", I2cwr, 4, kMaxArgs, I2c),
+    COMMAND("i2cwrite", I2cwrite, 3, kMaxArgs, I2c),
+#endif
+    COMMAND("id", Id, 1, 1, Shell),
+    COMMAND("jobs", Jobs, 1, 1, Tasks),
+    COMMAND("kill", Kill, 2, 2, Tasks),
+    COMMAND("mem", Mem, 1, 2, Shell),
+    COMMAND("micros", Micros, 1, 1, Timing),
+#if FEATURE_TONE
+    COMMAND("notone", Notone, 2, 2, Gpio),
+#endif
+#if FEATURE_LOWLEVEL
+    COMMAND("peek", Peek, 2, 2, LowLevel),
+    COMMAND("pin", Pin, 2, 2, LowLevel),
+#endif
+    COMMAND("pinmode", Pinmode, 3, 3, Gpio),
+    COMMAND("pins", Pins, 1, 1, Gpio),
+    COMMAND("pinset", Pinset, 3, 3, Gpio),
+#if FEATURE_LOWLEVEL
+    COMMAND("poke", Poke, 3, 3, LowLevel),
+    COMMAND("port", Port, 2, 3, LowLevel),
+#endif
+#if FEATURE_PROF
+    COMMAND("prof", Prof, 1, 2, Timing),
+#endif
+    JOB_COMMAND("pulse", Pulse, 5, 5, Gpio),
+    JOB_COMMAND("pwidth", Pwidth, 2, 3, Timing),
+    COMMAND("pwm", Pwm, 3, 3, Gpio),
+    COMMAND("pwmcfg", Pwmcfg, 1, 5, Gpio),
+#if FEATURE_LOWLEVEL
+    COMMAND("reg", Reg, 1, 1, LowLevel),
+#endif
+    COMMAND("reset", Reset, 1, 1, Shell),
+    COMMAND("status", Status, 1, 1, Shell),
+    COMMAND("task", Task, 3, 3, Tasks),
+    COMMAND("tasks", Tasks, 1, 1, Tasks),
+    COMMAND("time", Time, 2, kMaxArgs, Timing),
+#if FEATURE_TONE
+    COMMAND("tone", Tone, 3, 4, Gpio),
+#endif
+    COMMAND("uart", Uart, 1, 2, Shell),
+    COMMAND("uptime", Uptime, 1, 1, Shell),
+    COMMAND("ver", Ver, 1, 1, Shell),
+    JOB_COMMAND("watch", Watch, 2, 2, Gpio),
+#if FEATURE_WAVE
+    COMMAND("wave", Wave, 1, 4, Gpio),
+#endif
+};
+
+#undef COMMAND
+#undef JOB_COMMAND
+#undef COMMAND_TEXT
+
+constexpr size_t kCommandCount = sizeof(kCommands) / sizeof(kCommands[0]);
+
+constexpr bool nameLess(const char *a, const char *b) {
+  return (*a != *b) ? (static_cast<unsigned char>(*a) < static_cast<unsigned char>(*b))
+                    : (*a != '\0' && nameLess(a + 1, b + 1));
+}
+
+constexpr bool sortedFrom(size_t i) {
+  return (i + 1 >= kCommandCount) ||
+         (nameLess(kCommands[i].name, kCommands[i + 1].name) && sortedFrom(i + 1));
+}
+
+static_assert(sortedFrom(0), "kCommands must be sorted by name with no duplicates");
+static_assert(kCommandCount < 128, "findCommand returns an int index");
+
+} // namespace
+
+size_t commandCount() { return kCommandCount; }
+
+void readCommand(size_t index, CommandSpec &out) {
+  memcpy_P(&out, &kCommands[index], sizeof(CommandSpec));
+}
+
+int findCommand(const char *name) {
+  int lo = 0;
+  int hi = static_cast<int>(kCommandCount) - 1;
+  while (lo <= hi) {
+    const int mid = (lo + hi) / 2;
+    const int cmp = strcmp_P(name, kCommands[mid].name);
+    if (cmp == 0) {
+      return mid;
+    }
+    if (cmp < 0) {
+      hi = mid - 1;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  return -1;
+}
+
+} // namespace shell
@@ -6,6 +6,7 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
+#include <util/atomic.h>
 
 extern "C" char __heap_start;
 extern "C" void *__brkval;
@@ -15,6 +16,7 @@ namespace shell {
 uint8_t gResetFlags = 0;
 #if FEATURE_I2C
 uint32_t gI2cClockHz = kI2cSpeed100kHz;
+I2cClock gI2cClock = {0, 0}; // set by twiBegin()
 #endif
 
 const char kEepromEraseToken[] = "confirm";
@@ -29,34 +31,56 @@ char gEditBackup[kCmdBufferSize];
 size_t gEditBackupLen = 0;
 EscState gEscState = EscState::None;
 
-void printPrompt() { Serial.print(F("arduino$ ")); }
+const char kPrompt[] PROGMEM = "arduino$ ";
+
+void printPrompt() { Serial.print(reinterpret_cast<const __FlashStringHelper *>(kPrompt)); }
 
 void print2Digits(uint32_t value) {
-  if (value < 10) {
-    Serial.write('0');
+  if (value < 100) {
+    const char text[2] = {static_cast<char>('0' + value / 10U),
+                          static_cast<char>('0' + value % 10U)};
+    Serial.write(text, sizeof(text));
+    return;
   }
   Serial.print(value);
 }
 
 void print3Digits(uint32_t value) {
-  if (value < 100) {
-    Serial.write('0');
-  }
-  if (value < 10) {
-    Serial.write('0');
+  if (value < 1000) {
+    const char text[3] = {static_cast<char>('0' + value / 100U),
+                          static_cast<char>('0' + (value / 10U) % 10U),
+                          static_cast<char>('0' + value % 10U)};
+    Serial.write(text, sizeof(text));
+    return;
   }
   Serial.print(value);
 }
 
+void printHundredths(uint32_t valueX100) {
+  Serial.print(valueX100 / 100UL);
+  Serial.write('.');
+  print2Digits(valueX100 % 100UL);
+}
+
+namespace {
+
+char hexDigit(uint8_t nibble) {
+  return static_cast<char>(nibble < 10 ? ('0' + nibble) : ('A' + nibble - 10));
+}
+
+} // namespace
+
 void printHexByte(uint8_t value) {
-  const char hex[] = "0123456789ABCDEF";
-  Serial.write(hex[(value >> 4) & 0x0F]);
-  Serial.write(hex[value & 0x0F]);
+  const char text[2] = {hexDigit(value >> 4), hexDigit(value & 0x0F)};
+  Serial.write(text, sizeof(text));
 }
 
 void printHexWord(uint16_t value) {
-  printHexByte(static_cast<uint8_t>(value >> 8));
-  printHexByte(static_cast<uint8_t>(value & 0xFF));
+  const char text[4] = {hexDigit(static_cast<uint8_t>(value >> 12)),
+                        hexDigit(static_cast<uint8_t>((value >> 8) & 0x0F)),
+                        hexDigit(static_cast<uint8_t>((value >> 4) & 0x0F)),
+                        hexDigit(static_cast<uint8_t>(value & 0x0F))};
+  Serial.write(text, sizeof(text));
 }
 
 void printUptimeFormatted(uint32_t ms) {
@@ -165,6 +189,10 @@ bool equalsIgnoreCase(const char *a, const char *b) {
   return *a == '\0' && *b == '\0';
 }
 
+bool equalsIgnoreCase(const char *a, const __FlashStringHelper *b) {
+  return a != nullptr && strcasecmp_P(a, reinterpret_cast<const char *>(b)) == 0;
+}
+
 size_t splitArgs(char *text, char *argv[], size_t maxArgs) {
   size_t argc = 0;
   char *p = text;
@@ -187,6 +215,17 @@ size_t splitArgs(char *text, char *argv[], size_t maxArgs) {
   return argc;
 }
 
+const char *argTail(char *argv[], size_t argc, size_t from) {
+  if (from >= argc) {
+    return "";
+  }
+  // splitArgs replaced only the first space after each token, so this restores the text.
+  for (size_t i = from; i + 1 < argc; ++i) {
+    argv[i][strlen(argv[i])] = ' ';
+  }
+  return argv[from];
+}
+
 bool parseUnsigned(const char *token, unsigned long &value) {
   if (token == nullptr || *token == '\0') {
     return false;
@@ -205,6 +244,52 @@ bool parseUnsignedAuto(const char *token, unsigned long &value) {
   return *end == '\0';
 }
 
+bool parseDurationUs(const char *token, uint32_t &us) {
+  if (token == nullptr || *token < '0' || *token > '9') {
+    return false;
+  }
+  char *end = nullptr;
+  const unsigned long value = strtoul(token, &end, 10);
+  if (equalsIgnoreCase(end, F("us"))) {
+    us = value;
+    return true;
+  }
+  if ((*end != '\0' && !equalsIgnoreCase(end, F("ms"))) || value > 0xFFFFFFFFUL / 1000UL) {
+    return false;
+  }
+  us = value * 1000UL;
+  return true;
+}
+
+bool parseThousandths(const char *token, uint32_t &value, char suffix) {
+  uint32_t whole = 0;
+  uint8_t digits = 0;
+  for (; *token >= '0' && *token <= '9'; ++token, ++digits) {
+    whole = whole * 10U + static_cast<uint8_t>(*token - '0');
+    if (whole > 4000000UL) {
+      return false;
+    }
+  }
+  uint32_t frac = 0;
+  uint8_t fracDigits = 0;
+  if (*token == '.') {
+    for (++token; *token >= '0' && *token <= '9'; ++token, ++fracDigits) {
+      if (fracDigits == 3) {
+        return false;
+      }
+      frac = frac * 10U + static_cast<uint8_t>(*token - '0');
+    }
+  }
+  for (uint8_t i = fracDigits; i < 3; ++i) {
+    frac *= 10U;
+  }
+  if (suffix != '\0' && *token == suffix) {
+    ++token;
+  }
+  value = whole * 1000UL + frac;
+  return *token == '\0' && digits + fracDigits != 0;
+}
+
 bool parseByteValue(const char *token, uint8_t &value) {
   unsigned long raw = 0;
   if (!parseUnsignedAuto(token, raw) || raw > 0xFFUL) {
@@ -240,25 +325,58 @@ bool parseI2cSpeedToken(const char *token, uint32_t &hz) {
     return false;
   }
 
-  if (strcmp(token, "100k") == 0 || strcmp(token, "100") == 0 ||
-      strcmp(token, "100000") == 0) {
-    hz = kI2cSpeed100kHz;
-    return true;
+  const char last = token[strlen(token) - 1];
+  if (last == 'k' || last == 'K') {
+    return parseThousandths(token, hz, last); // thousandths of a kHz are Hz
   }
-  if (strcmp(token, "400k") == 0 || strcmp(token, "400") == 0 ||
-      strcmp(token, "400000") == 0) {
-    hz = kI2cSpeed400kHz;
-    return true;
+  unsigned long raw = 0;
+  if (!parseUnsigned(token, raw) || raw > 0xFFFFFFFFUL / 1000UL) {
+    return false;
   }
-  return false;
+  // "100" and "400" meant kHz before any rate could be set; every other bare number is Hz.
+  hz = (raw == 100UL || raw == 400UL) ? raw * 1000UL : raw;
+  return true;
 }
 
-bool parseI2cLen(const char *token, uint8_t &length) {
+bool parseI2cLen(const char *token, uint16_t &length) {
   unsigned long raw = 0;
-  if (!parseUnsignedAuto(token, raw) || raw == 0 || raw > kI2cMaxTransferLen) {
+  if (!parseUnsignedAuto(token, raw) || raw == 0 || raw > 0xFFFFUL) {
     return false;
   }
-  length = static_cast<uint8_t>(raw);
+  length = static_cast<uint16_t>(raw);
+  return true;
+}
+
+namespace {
+
+int8_t hexNibble(char c) {
+  if (c >= '0' && c <= '9') {
+    return static_cast<int8_t>(c - '0');
+  }
+  c = static_cast<char>(c | 0x20);
+  return c >= 'a' && c <= 'f' ? static_cast<int8_t>(c - 'a' + 10) : -1;
+}
+
+} // namespace
+
+bool parseDataToken(const char *token, uint8_t *out, size_t max, size_t &count) {
+  const size_t len = strlen(token);
+  if (len > 4 && len % 2 == 0 && token[0] == '0' && (token[1] | 0x20) == 'x') {
+    for (size_t i = 2; i < len; i += 2) {
+      const int8_t high = hexNibble(token[i]);
+      const int8_t low = hexNibble(token[i + 1]);
+      if (high < 0 || low < 0 || count == max) {
+        return false;
+      }
+      out[count++] = static_cast<uint8_t>((high << 4) | low);
+    }
+    return true;
+  }
+  uint8_t value = 0;
+  if (count == max || !parseByteValue(token, value)) {
+    return false;
+  }
+  out[count++] = value;
   return true;
 }
 #endif
@@ -307,16 +425,11 @@ size_t fsEntryAddress(uint8_t index) {
          (static_cast<size_t>(index) * static_cast<size_t>(kFsEntrySize));
 }
 
-bool fsIsValidNameToken(const char *name) {
-  if (name == nullptr || *name == '\0') {
+bool fsIsValidNameToken(const char *name, size_t len) {
+  if (name == nullptr || len == 0 || len >= kFsNameBytes) {
     return false;
   }
-  if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
-    return false;
-  }
-
-  const size_t len = strlen(name);
-  if (len == 0 || len >= kFsNameBytes) {
+  if (name[0] == '.' && (len == 1 || (len == 2 && name[1] == '.'))) {
     return false;
   }
 
@@ -427,7 +540,7 @@ void fsFormat() {
   EEPROM.update(5, kFsMaxEntries);
   eepromWriteU16(6U, kFsDataStart);
   fsSetNextFree(kFsDataStart);
-  for (size_t i = 10; i < kFsHeaderSize; ++i) {
+  for (size_t i = kFsHeaderClearStart; i < kFsHeaderSize; ++i) {
     EEPROM.update(static_cast<int>(i), 0);
   }
 
@@ -444,11 +557,16 @@ void fsEnsureInitialized() {
 }
 #endif
 
-bool fsFindChild(uint8_t parent, const char *name, uint8_t &indexOut, FsEntry &entryOut) {
+bool fsFindChild(uint8_t parent, const char *name, size_t nameLen, uint8_t &indexOut,
+                 FsEntry &entryOut) {
+  if (nameLen >= kFsNameBytes) {
+    return false;
+  }
   for (uint8_t i = 0; i < kFsMaxEntries; ++i) {
     FsEntry entry;
     fsLoadEntry(i, entry);
-    if (entry.used && entry.parent == parent && strcmp(entry.name, name) == 0) {
+    if (entry.used && entry.parent == parent && strncmp(entry.name, name, nameLen) == 0 &&
+        entry.name[nameLen] == '\0') {
       indexOut = i;
       entryOut = entry;
       return true;
@@ -480,65 +598,49 @@ bool fsHasChildren(uint8_t parentIndex) {
   return false;
 }
 
-bool fsResolvePath(const char *path, uint8_t &indexOut, FsEntry &entryOut) {
-  if (path == nullptr) {
-    return false;
-  }
-
-  char work[kCmdBufferSize];
-  strncpy(work, path, kCmdBufferSize - 1);
-  work[kCmdBufferSize - 1] = '\0';
-
-  char *start = work;
-  while (*start != '\0' && isspace(static_cast<unsigned char>(*start))) {
-    ++start;
-  }
+namespace {
 
-  size_t len = strlen(start);
-  while (len > 0 && isspace(static_cast<unsigned char>(start[len - 1]))) {
-    start[len - 1] = '\0';
+// Drops surrounding whitespace and trailing slashes from a path span.
+void fsTrimPath(const char *&path, size_t &len) {
+  while (len > 0 && isspace(static_cast<unsigned char>(*path))) {
+    ++path;
     --len;
   }
-
-  while (len > 1 && start[len - 1] == '/') {
-    start[len - 1] = '\0';
+  while (len > 0 && (isspace(static_cast<unsigned char>(path[len - 1])) || path[len - 1] == '/')) {
     --len;
   }
+}
 
-  if (len == 0 || (len == 1 && start[0] == '/')) {
-    indexOut = kFsRootParent;
-    fsSetRootEntry(entryOut);
-    return true;
-  }
+} // namespace
 
-  while (*start == '/') {
-    ++start;
-  }
-  if (*start == '\0') {
-    indexOut = kFsRootParent;
-    fsSetRootEntry(entryOut);
-    return true;
+bool fsResolvePath(const char *path, size_t len, uint8_t &indexOut, FsEntry &entryOut) {
+  if (path == nullptr) {
+    return false;
   }
+  fsTrimPath(path, len);
 
-  uint8_t currentParent = kFsRootParent;
   uint8_t currentIndex = kFsRootParent;
   FsEntry currentEntry;
+  fsSetRootEntry(currentEntry);
 
-  char *saveptr = nullptr;
-  char *token = strtok_r(start, "/", &saveptr);
-  while (token != nullptr) {
-    if (!fsIsValidNameToken(token)) {
-      return false;
+  const char *p = path;
+  const char *const end = path + len;
+  while (true) {
+    while (p < end && *p == '/') {
+      ++p;
     }
-    if (!fsFindChild(currentParent, token, currentIndex, currentEntry)) {
-      return false;
+    if (p == end) {
+      break;
     }
-
-    token = strtok_r(nullptr, "/", &saveptr);
-    if (token != nullptr && !currentEntry.isDir) {
+    const char *segment = p;
+    while (p < end && *p != '/') {
+      ++p;
+    }
+    const size_t segmentLen = static_cast<size_t>(p - segment);
+    if (!currentEntry.isDir || !fsIsValidNameToken(segment, segmentLen) ||
+        !fsFindChild(currentIndex, segment, segmentLen, currentIndex, currentEntry)) {
       return false;
     }
-    currentParent = currentIndex;
   }
 
   indexOut = currentIndex;
@@ -546,89 +648,207 @@ bool fsResolvePath(const char *path, uint8_t &indexOut, FsEntry &entryOut) {
   return true;
 }
 
-bool fsResolveDirectory(const char *path, uint8_t &indexOut, FsEntry &entryOut) {
-  if (!fsResolvePath(path, indexOut, entryOut)) {
+bool fsResolvePath(const char *path, uint8_t &indexOut, FsEntry &entryOut) {
+  return path != nullptr && fsResolvePath(path, strlen(path), indexOut, entryOut);
+}
+
+bool fsResolveDirectory(const char *path, size_t len, uint8_t &indexOut, FsEntry &entryOut) {
+  if (!fsResolvePath(path, len, indexOut, entryOut)) {
     return false;
   }
   return entryOut.isDir;
 }
 
-bool fsSplitParentLeaf(const char *path, char *parentOut, size_t parentOutSize, char *leafOut,
-                       size_t leafOutSize) {
-  if (path == nullptr || parentOut == nullptr || leafOut == nullptr || parentOutSize == 0 ||
-      leafOutSize == 0) {
+bool fsResolveDirectory(const char *path, uint8_t &indexOut, FsEntry &entryOut) {
+  return path != nullptr && fsResolveDirectory(path, strlen(path), indexOut, entryOut);
+}
+
+bool fsSplitParentLeaf(const char *path, size_t &parentLen, const char *&leaf, size_t &leafLen) {
+  if (path == nullptr) {
+    return false;
+  }
+  const char *start = path;
+  size_t len = strlen(path);
+  fsTrimPath(start, len);
+  if (len == 0) {
     return false;
   }
 
-  char work[kCmdBufferSize];
-  strncpy(work, path, kCmdBufferSize - 1);
-  work[kCmdBufferSize - 1] = '\0';
+  size_t slash = len;
+  while (slash > 0 && start[slash - 1] != '/') {
+    --slash;
+  }
+  leaf = start + slash;
+  leafLen = len - slash;
+  // Measured from path itself so fsResolveDirectory(path, parentLen, ...) sees the parent.
+  parentLen = static_cast<size_t>(start - path) + ((slash > 0) ? slash - 1 : 0);
+  return fsIsValidNameToken(leaf, leafLen);
+}
 
-  char *start = work;
-  while (*start != '\0' && isspace(static_cast<unsigned char>(*start))) {
-    ++start;
+#if FEATURE_FS
+FsWriteStatus fsWriteFile(const char *path, const uint8_t *data, size_t len) {
+  size_t parentLen = 0;
+  const char *leaf = nullptr;
+  size_t leafLen = 0;
+  if (!fsSplitParentLeaf(path, parentLen, leaf, leafLen)) {
+    return FsWriteStatus::InvalidPath;
   }
 
-  size_t len = strlen(start);
-  while (len > 0 && isspace(static_cast<unsigned char>(start[len - 1]))) {
-    start[len - 1] = '\0';
-    --len;
+  uint8_t parentIndex = kFsRootParent;
+  FsEntry parentEntry;
+  if (!fsResolveDirectory(path, parentLen, parentIndex, parentEntry)) {
+    return FsWriteStatus::NoParent;
   }
 
-  while (len > 1 && start[len - 1] == '/') {
-    start[len - 1] = '\0';
-    --len;
+  uint8_t nodeIndex = 0;
+  FsEntry nodeEntry;
+  const bool exists = fsFindChild(parentIndex, leaf, leafLen, nodeIndex, nodeEntry);
+  if (exists && nodeEntry.isDir) {
+    return FsWriteStatus::IsDirectory;
+  }
+  if (!exists) {
+    if (!fsFindFreeEntry(nodeIndex)) {
+      return FsWriteStatus::TableFull;
+    }
+    nodeEntry.used = true;
+    nodeEntry.isDir = false;
+    nodeEntry.parent = parentIndex;
+    memcpy(nodeEntry.name, leaf, leafLen);
+    nodeEntry.name[leafLen] = '\0';
   }
 
-  if (len == 0 || (len == 1 && start[0] == '/')) {
-    return false;
+  if (len == 0) {
+    nodeEntry.dataLen = 0;
+    nodeEntry.dataStart = 0;
+    fsStoreEntry(nodeIndex, nodeEntry);
+    return FsWriteStatus::Ok;
   }
 
-  char *lastSlash = strrchr(start, '/');
-  const char *leaf = nullptr;
-  const char *parent = nullptr;
+  // Append-only data area: a rewrite allocates fresh space at nextFree.
+  const size_t size = eepromSize();
+  const uint16_t nextFree = fsNextFree();
+  if (nextFree > size || len > (size - nextFree)) {
+    return FsWriteStatus::NoSpace;
+  }
 
-  if (lastSlash == nullptr) {
-    parent = "/";
-    leaf = start;
-  } else {
-    *lastSlash = '\0';
-    leaf = lastSlash + 1;
-    parent = (start[0] == '\0') ? "/" : start;
+  for (size_t i = 0; i < len; ++i) {
+    EEPROM.update(static_cast<int>(nextFree + i), data[i]);
   }
 
-  if (!fsIsValidNameToken(leaf)) {
+  nodeEntry.dataStart = nextFree;
+  nodeEntry.dataLen = static_cast<uint16_t>(len);
+  fsStoreEntry(nodeIndex, nodeEntry);
+  fsSetNextFree(static_cast<uint16_t>(nextFree + len));
+  return FsWriteStatus::Ok;
+}
+#endif
+
+#if FEATURE_I2C
+bool setI2cClock(uint32_t hz) {
+  I2cClock clock;
+  if (!i2cClockFor(hz, clock)) {
     return false;
   }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { gI2cClock = clock; }
+  gI2cClockHz = hz;
+  return true;
+}
 
-  const size_t leafLen = strlen(leaf);
-  const size_t parentLen = strlen(parent);
-  if (leafLen >= leafOutSize || parentLen >= parentOutSize) {
-    return false;
+void printI2cClock(uint32_t hz) {
+  I2cClock clock;
+  if (!i2cClockFor(hz, clock)) {
+    return;
   }
+  const uint32_t actualX100 = i2cClockHzX100(clock);
+  Serial.print(F("SCL "));
+  printHundredths(actualX100);
+  Serial.print(F(" Hz (TWBR "));
+  Serial.print(clock.twbr);
+  Serial.print(F(", prescaler "));
+  Serial.print(1U << (2U * clock.twps));
+  Serial.print(F("), error "));
+  const bool fast = actualX100 >= hz * 100UL;
+  Serial.write(fast ? '+' : '-');
+  const uint32_t diff = fast ? actualX100 - hz * 100UL : hz * 100UL - actualX100;
+  printHundredths(static_cast<uint32_t>((diff * 100ULL + hz / 2U) / hz));
+  Serial.println('%');
+}
 
-  strncpy(leafOut, leaf, leafOutSize - 1);
-  leafOut[leafOutSize - 1] = '\0';
-  strncpy(parentOut, parent, parentOutSize - 1);
-  parentOut[parentOutSize - 1] = '\0';
-  return true;
+uint8_t i2cWriteBytes(uint8_t address, const uint8_t *data, size_t len) {
+  if (len > 0xFF) {
+    return 1;
+  }
+  TwiTxn txn;
+  txn.address = address;
+  txn.tx = data;
+  txn.txLen = static_cast<uint8_t>(len);
+  return static_cast<uint8_t>(twiRun(txn));
 }
 
-#if FEATURE_I2C
-void setI2cClock(uint32_t hz) {
-#if defined(TWBR) && defined(TWPS0) && defined(TWPS1) && defined(F_CPU)
-  // Force prescaler=1 and compute TWBR from AVR datasheet formula.
-  TWSR = static_cast<uint8_t>(TWSR & ~(_BV(TWPS0) | _BV(TWPS1)));
-  const uint32_t twbrValue = ((F_CPU / hz) - 16UL) / 2UL;
-  TWBR = static_cast<uint8_t>(twbrValue);
-#else
-  Wire.setClock(hz);
-#endif
-  gI2cClockHz = hz;
+uint8_t i2cReadBytes(uint8_t address, uint8_t *out, uint8_t len, uint8_t &received) {
+  return i2cWriteRead(address, nullptr, 0, out, len, received);
+}
+
+uint8_t i2cWriteRead(uint8_t address, const uint8_t *data, uint8_t len, uint8_t *out,
+                     uint8_t outLen, uint8_t &received) {
+  TwiTxn txn;
+  txn.address = address;
+  txn.tx = data;
+  txn.txLen = len;
+  txn.rx = out;
+  txn.rxLen = outLen;
+  const TwiStatus status = twiRun(txn);
+  received = txn.rxCount;
+  return static_cast<uint8_t>(status);
+}
+
+namespace {
+
+struct I2cIdEntry {
+  uint8_t address;
+  uint8_t reg; // the same for every row of an address
+  uint8_t value;
+  char name[9];
+};
+
+const I2cIdEntry kI2cIds[] PROGMEM = {
+    {0x18, 0x0F, 0x33, "LIS3DH"},   {0x19, 0x0F, 0x33, "LIS3DH"},
+    {0x1E, 0x0A, 0x48, "HMC5883L"}, {0x29, 0xC0, 0xEE, "VL53L0X"},
+    {0x53, 0x00, 0xE5, "ADXL345"},  {0x5A, 0x20, 0x81, "CCS811"},
+    {0x5B, 0x20, 0x81, "CCS811"},   {0x68, 0x75, 0x68, "MPU-6050"},
+    {0x68, 0x75, 0x70, "MPU-6500"}, {0x68, 0x75, 0x71, "MPU-9250"},
+    {0x69, 0x75, 0x68, "MPU-6050"}, {0x69, 0x75, 0x70, "MPU-6500"},
+    {0x69, 0x75, 0x71, "MPU-9250"}, {0x6A, 0x0F, 0x69, "LSM6DS3"},
+    {0x6A, 0x0F, 0x6A, "LSM6DSL"},  {0x6B, 0x0F, 0x69, "LSM6DS3"},
+    {0x6B, 0x0F, 0x6A, "LSM6DSL"},  {0x76, 0xD0, 0x58, "BMP280"},
+    {0x76, 0xD0, 0x60, "BME280"},   {0x76, 0xD0, 0x61, "BME680"},
+    {0x77, 0xD0, 0x55, "BMP180"},   {0x77, 0xD0, 0x58, "BMP280"},
+    {0x77, 0xD0, 0x60, "BME280"},   {0x77, 0xD0, 0x61, "BME680"},
+};
+constexpr uint8_t kI2cIdCount = sizeof(kI2cIds) / sizeof(kI2cIds[0]);
+
+} // namespace
+
+bool i2cIdRegister(uint8_t address, uint8_t &reg) {
+  for (uint8_t i = 0; i < kI2cIdCount; ++i) {
+    if (pgm_read_byte(&kI2cIds[i].address) == address) {
+      reg = pgm_read_byte(&kI2cIds[i].reg);
+      return true;
+    }
+  }
+  return false;
+}
+
+const __FlashStringHelper *i2cIdName(uint8_t address, uint8_t value) {
+  for (uint8_t i = 0; i < kI2cIdCount; ++i) {
+    if (pgm_read_byte(&kI2cIds[i].address) == address &&
+        pgm_read_byte(&kI2cIds[i].value) == value) {
+      return reinterpret_cast<const __FlashStringHelper *>(kI2cIds[i].name);
+    }
+  }
+  return nullptr;
 }
-#endif
 
-#if FEATURE_I2C
 void printI2cAddress(uint8_t address) {
   Serial.print(F("0x"));
   printHexByte(address);
@@ -649,11 +869,14 @@ void printI2cTxStatus(uint8_t status) {
       Serial.print(F("NACK on data"));
       break;
     case 4:
-      Serial.print(F("other bus error"));
+      Serial.print(F("bus error"));
       break;
     case 5:
       Serial.print(F("timeout"));
       break;
+    case 6:
+      Serial.print(F("arbitration lost"));
+      break;
     default:
       Serial.print(F("unknown"));
       break;
@@ -662,24 +885,24 @@ void printI2cTxStatus(uint8_t status) {
 }
 #endif
 
-#if FEATURE_LOWLEVEL
+#if FEATURE_LOWLEVEL || FEATURE_CAPTURE
 bool parsePortId(const char *token, PortId &port) {
   if (token == nullptr || *token == '\0') {
     return false;
   }
 
-  if (strcmp(token, "b") == 0 || strcmp(token, "portb") == 0 ||
-      strcmp(token, "ddrb") == 0 || strcmp(token, "pinb") == 0) {
+  if (equalsIgnoreCase(token, F("b")) || equalsIgnoreCase(token, F("portb")) ||
+      equalsIgnoreCase(token, F("ddrb")) || equalsIgnoreCase(token, F("pinb"))) {
     port = PortId::B;
     return true;
   }
-  if (strcmp(token, "c") == 0 || strcmp(token, "portc") == 0 ||
-      strcmp(token, "ddrc") == 0 || strcmp(token, "pinc") == 0) {
+  if (equalsIgnoreCase(token, F("c")) || equalsIgnoreCase(token, F("portc")) ||
+      equalsIgnoreCase(token, F("ddrc")) || equalsIgnoreCase(token, F("pinc"))) {
     port = PortId::C;
     return true;
   }
-  if (strcmp(token, "d") == 0 || strcmp(token, "portd") == 0 ||
-      strcmp(token, "ddrd") == 0 || strcmp(token, "pind") == 0) {
+  if (equalsIgnoreCase(token, F("d")) || equalsIgnoreCase(token, F("portd")) ||
+      equalsIgnoreCase(token, F("ddrd")) || equalsIgnoreCase(token, F("pind"))) {
     port = PortId::D;
     return true;
   }
@@ -735,6 +958,78 @@ volatile uint8_t &pinForPort(PortId port) {
 }
 #endif
 
+void fastPinMode(const FastPin &io, uint8_t mode) {
+  volatile uint8_t &ddr = io.in[1];
+  volatile uint8_t &port = io.in[2];
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (mode == OUTPUT) {
+      ddr = static_cast<uint8_t>(ddr | io.mask);
+      return;
+    }
+    ddr = static_cast<uint8_t>(ddr & ~io.mask);
+    port = static_cast<uint8_t>(mode == INPUT_PULLUP ? (port | io.mask) : (port & ~io.mask));
+  }
+}
+
+namespace {
+
+bool gTimer2Claimed = false;
+uint8_t gSavedTccr2a = 0;
+uint8_t gSavedTccr2b = 0;
+uint8_t gSavedOcr2a = 0;
+uint8_t gSavedOcr2b = 0;
+uint8_t gSavedTimsk2 = 0;
+
+} // namespace
+
+bool timer2Claim() {
+  // tone() runs from the COMPA interrupt; analogWrite() on D3/D11 drives the compare outputs.
+  if (gTimer2Claimed || (TIMSK2 & _BV(OCIE2A)) != 0 ||
+      (TCCR2A & (_BV(COM2A1) | _BV(COM2B1))) != 0) {
+    return false;
+  }
+  gSavedTccr2a = TCCR2A;
+  gSavedTccr2b = TCCR2B;
+  gSavedOcr2a = OCR2A;
+  gSavedOcr2b = OCR2B;
+  gSavedTimsk2 = TIMSK2;
+  gTimer2Claimed = true;
+  return true;
+}
+
+bool timer2InUse() { return gTimer2Claimed; }
+
+// Puts back the core's setup, so tone() and analogWrite() on D3/D11 work again.
+void timer2Release() {
+  TCCR2B = 0;
+  TIMSK2 = gSavedTimsk2;
+  TCCR2A = gSavedTccr2a;
+  OCR2A = gSavedOcr2a;
+  OCR2B = gSavedOcr2b;
+  TCNT2 = 0;
+  TIFR2 = static_cast<uint8_t>(_BV(OCF2A) | _BV(OCF2B) | _BV(TOV2));
+  TCCR2B = gSavedTccr2b;
+  gTimer2Claimed = false;
+}
+
+void detachPwm(uint8_t pin) {
+  PwmPinInfo info;
+  if (!isPwmCapablePin(pin, info)) {
+    return;
+  }
+  volatile uint8_t &tccr = info.timer == 0 ? TCCR0A : (info.timer == 1 ? TCCR1A : TCCR2A);
+  const uint8_t shift = info.channel == 'A' ? COM0A0 : COM0B0; // same on all three timers
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { tccr = static_cast<uint8_t>(tccr & ~(3U << shift)); }
+}
+
+FastPin fastOutput(uint8_t pin, bool high) {
+  detachPwm(pin);
+  const FastPin io = fastPin(pin);
+  fastWrite(io, high);
+  fastPinMode(io, OUTPUT);
+  return io;
+}
+
 bool parsePinToken(const char *token, int &pin) {
   if (token == nullptr || *token == '\0') {
     return false;
@@ -756,6 +1051,47 @@ bool parsePinToken(const char *token, int &pin) {
   return true;
 }
 
+uint8_t parsePinSequence(const char *token, uint8_t pins[], uint8_t maxPins) {
+  if (token == nullptr || *token == '\0') {
+    return 0;
+  }
+  uint8_t count = 0;
+  while (true) {
+    char piece[4];
+    size_t len = 0;
+    while (token[len] != '\0' && token[len] != ',') {
+      if (len >= sizeof(piece) - 1) {
+        return 0;
+      }
+      piece[len] = token[len];
+      ++len;
+    }
+    piece[len] = '\0';
+    int pin = -1;
+    if (count == maxPins || !parsePinToken(piece, pin) || pin >= 32) {
+      return 0;
+    }
+    pins[count++] = static_cast<uint8_t>(pin);
+    if (token[len] == '\0') {
+      return count;
+    }
+    token += len + 1;
+  }
+}
+
+bool parsePinList(const char *token, uint32_t &mask) {
+  uint8_t pins[kMaxPinList];
+  const uint8_t count = parsePinSequence(token, pins, kMaxPinList);
+  if (count == 0) {
+    return false;
+  }
+  mask = 0;
+  for (uint8_t i = 0; i < count; ++i) {
+    mask |= (1UL << pins[i]);
+  }
+  return true;
+}
+
 bool parseAnalogPinToken(const char *token, uint8_t &analogIndex, int &pin) {
   if (token == nullptr || *token == '\0') {
     return false;
@@ -798,36 +1134,69 @@ void printPinLabel(int pin) {
   Serial.print(pin);
 }
 
-bool isPwmCapablePin(int pin) {
-#if defined(digitalPinHasPWM)
-  return digitalPinHasPWM(pin);
-#else
-  return pin == 3 || pin == 5 || pin == 6 || pin == 9 || pin == 10 || pin == 11;
-#endif
+void printPinList(uint32_t mask) {
+  bool first = true;
+  for (uint8_t pin = 0; pin < NUM_DIGITAL_PINS && mask != 0; ++pin, mask >>= 1) {
+    if (mask & 1UL) {
+      if (!first) {
+        Serial.write(',');
+      }
+      printPinLabel(pin);
+      first = false;
+    }
+  }
 }
 
-void setCmdBuffer(const char *text) {
-  strncpy(gCmdBuffer, text, kCmdBufferSize - 1);
-  gCmdBuffer[kCmdBufferSize - 1] = '\0';
-  gCmdLen = strlen(gCmdBuffer);
+bool isPwmCapablePin(int pin, PwmPinInfo &info) {
+  switch (pin) {
+    case 3:
+      info = {2, 'B'};
+      return true;
+    case 5:
+      info = {0, 'B'};
+      return true;
+    case 6:
+      info = {0, 'A'};
+      return true;
+    case 9:
+      info = {1, 'A'};
+      return true;
+    case 10:
+      info = {1, 'B'};
+      return true;
+    case 11:
+      info = {2, 'A'};
+      return true;
+    default:
+      return false;
+  }
 }
 
-void redrawInputLine(size_t previousLen) {
-  Serial.write('\r');
-  printPrompt();
-  for (size_t i = 0; i < gCmdLen; ++i) {
-    Serial.write(gCmdBuffer[i]);
+// "D9  Timer1 OC1A: pwm 490 Hz, pwmcfg up to 16-bit, pulse, wave"
+void printPwmPinInfo(int pin, const PwmPinInfo &info) {
+  printPinLabel(pin);
+  Serial.print(pin < 10 ? F("  Timer") : F(" Timer"));
+  Serial.print(info.timer);
+  Serial.print(F(" OC"));
+  Serial.print(info.timer);
+  Serial.write(info.channel);
+  switch (info.timer) {
+    case 0:
+      Serial.println(F(": pwm 980 Hz; frequency fixed, Timer0 runs millis()"));
+      break;
+    case 1:
+      Serial.println(F(": pwm 490 Hz, pwmcfg up to 16-bit, pulse, wave"));
+      break;
+    default:
+      Serial.println(F(": pwm 490 Hz, wave; Timer2 is shared with tone and capture"));
+      break;
   }
+}
 
-  if (previousLen > gCmdLen) {
-    const size_t extra = previousLen - gCmdLen;
-    for (size_t i = 0; i < extra; ++i) {
-      Serial.write(' ');
-    }
-    for (size_t i = 0; i < extra; ++i) {
-      Serial.write('\b');
-    }
-  }
+void setCmdBuffer(const char *text) {
+  strncpy(gCmdBuffer, text, kCmdBufferSize - 1);
+  gCmdBuffer[kCmdBufferSize - 1] = '\0';
+  gCmdLen = strlen(gCmdBuffer);
 }
 
 const char *historyEntryFromNewest(size_t newestOffset) {
@@ -863,7 +1232,6 @@ void historyUp() {
     return;
   }
 
-  const size_t previousLen = gCmdLen;
   if (gHistoryCursor < 0) {
     strncpy(gEditBackup, gCmdBuffer, kCmdBufferSize - 1);
     gEditBackup[kCmdBufferSize - 1] = '\0';
@@ -874,7 +1242,6 @@ void historyUp() {
   }
 
   setCmdBuffer(historyEntryFromNewest((size_t)gHistoryCursor));
-  redrawInputLine(previousLen);
 }
 
 void historyDown() {
@@ -882,7 +1249,6 @@ void historyDown() {
     return;
   }
 
-  const size_t previousLen = gCmdLen;
   if (gHistoryCursor > 0) {
     --gHistoryCursor;
     setCmdBuffer(historyEntryFromNewest((size_t)gHistoryCursor));
@@ -892,8 +1258,6 @@ void historyDown() {
     gCmdLen = gEditBackupLen;
     gCmdBuffer[gCmdLen] = '\0';
   }
-
-  redrawInputLine(previousLen);
 }
 
 
@@ -0,0 +1,117 @@
+#include "shell.hpp"
+
+extern "C" char __data_start;
+extern "C" char __data_end;
+extern "C" char __bss_start;
+extern "C" char __bss_end;
+extern "C" char __heap_start;
+extern "C" void *__brkval;
+
+// Runs from .init3, after the runtime has cleared r1 and set SP but before any C++ code:
+// every byte from the end of .bss to RAMEND gets the canary. Naked and register-only, as
+// the stack is not in use yet.
+extern "C" void shellPaintStack() __attribute__((naked, used, section(".init3")));
+extern "C" void shellPaintStack() {
+  __asm__ volatile("    ldi r30, lo8(__heap_start)\n"
+                   "    ldi r31, hi8(__heap_start)\n"
+                   "    ldi r24, %0\n"
+                   "    ldi r25, hi8(%1)\n"
+                   "    rjmp 2f\n"
+                   "1:  st Z+, r24\n"
+                   "2:  cpi r30, lo8(%1)\n"
+                   "    cpc r31, r25\n"
+                   "    brlo 1b\n"
+                   "    breq 1b\n"
+                   :
+                   : "i"(shell::kStackCanary), "i"(RAMEND));
+}
+
+namespace shell {
+
+namespace {
+
+uint16_t gStackLowMargin = 0xFFFF;
+int8_t gStackLowCommand = kStackNoCommand;
+
+const uint8_t *heapTop() {
+  return reinterpret_cast<const uint8_t *>(__brkval == nullptr ? &__heap_start : __brkval);
+}
+
+} // namespace
+
+uint16_t stackFloor() { return reinterpret_cast<uint16_t>(heapTop()); }
+
+// Untouched canary bytes between the heap and the deepest point the stack has reached.
+uint16_t stackMargin() {
+  const uint8_t *p = heapTop();
+  const uint8_t *const sp = reinterpret_cast<const uint8_t *>(SP);
+  uint16_t margin = 0;
+  while (p < sp && *p == kStackCanary) {
+    ++p;
+    ++margin;
+  }
+  return margin;
+}
+
+// Nothing below SP is live in the main context (an ISR frame only exists while the ISR
+// runs), so this is safe with interrupts enabled.
+void paintFreeStack() {
+  uint8_t *p = const_cast<uint8_t *>(heapTop());
+  uint8_t *const sp = reinterpret_cast<uint8_t *>(SP);
+  while (p < sp) {
+    *p++ = kStackCanary;
+  }
+}
+
+uint16_t noteStackLowWater(int8_t command) {
+  const uint16_t margin = stackMargin();
+  if (margin < gStackLowMargin) {
+    gStackLowMargin = margin;
+    gStackLowCommand = command;
+  }
+  return margin;
+}
+
+void resetStackLowWater() {
+  paintFreeStack();
+  gStackLowMargin = 0xFFFF;
+  gStackLowCommand = kStackNoCommand;
+  noteStackLowWater(kStackNoCommand);
+}
+
+void printMemReport() {
+  noteStackLowWater(kStackNoCommand);
+  const uint16_t dataBytes = static_cast<uint16_t>(&__data_end - &__data_start);
+  const uint16_t bssBytes = static_cast<uint16_t>(&__bss_end - &__bss_start);
+  const uint16_t heapBytes =
+      static_cast<uint16_t>(heapTop() - reinterpret_cast<const uint8_t *>(&__heap_start));
+
+  Serial.println(F("\n=== Memory ==="));
+  Serial.print(F("SRAM: "));
+  Serial.print(RAMEND - RAMSTART + 1);
+  Serial.print(F(" bytes (.data "));
+  Serial.print(dataBytes);
+  Serial.print(F(", .bss "));
+  Serial.print(bssBytes);
+  Serial.print(F(", heap "));
+  Serial.print(heapBytes);
+  Serial.println(F(")"));
+  Serial.print(F("Stack free now: "));
+  Serial.print(freeRamEstimate());
+  Serial.println(F(" bytes"));
+  Serial.print(F("Stack low-water: "));
+  Serial.print(gStackLowMargin);
+  Serial.print(F(" bytes free"));
+  if (gStackLowCommand == kStackNoCommand) {
+    Serial.println(F(" (outside commands)"));
+  } else {
+    CommandSpec spec;
+    readCommand(static_cast<size_t>(gStackLowCommand), spec);
+    Serial.print(F(" (during '"));
+    Serial.print(spec.name);
+    Serial.println(F("')"));
+  }
+  Serial.println(F("==============\n"));
+}
+
+} // namespace shell
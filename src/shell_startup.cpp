@@ -11,46 +11,15 @@ namespace {
 
 const char kDefaultBootScriptPgm[] PROGMEM =
     "# Startup script\n"
-    "# blink <pin> <period_ms>\n"
+    "# blink <pin[,pin...]> <period_ms>\n"
     "blink 13 1000\n";
 
-bool gBlinkEnabled = false;
-uint8_t gBlinkPin = 13;
-bool gBlinkLevelHigh = false;
-uint16_t gBlinkHighMs = 500;
-uint16_t gBlinkLowMs = 500;
-uint32_t gBlinkNextToggleMs = 0;
-
-void setBlinkTask(int pin, uint16_t periodMs) {
-  if (periodMs < 2) {
-    periodMs = 2;
-  }
-
-  uint16_t highMs = static_cast<uint16_t>(periodMs / 2U);
-  uint16_t lowMs = static_cast<uint16_t>(periodMs - highMs);
-  if (highMs == 0) {
-    highMs = 1;
-  }
-  if (lowMs == 0) {
-    lowMs = 1;
-  }
-
-  gBlinkPin = pin;
-  gBlinkHighMs = highMs;
-  gBlinkLowMs = lowMs;
-  gBlinkLevelHigh = false;
-  gBlinkEnabled = true;
-
-  pinMode(gBlinkPin, OUTPUT);
-  digitalWrite(gBlinkPin, LOW);
-  gBlinkNextToggleMs = millis() + gBlinkLowMs;
-}
-
 bool ensureScriptsDirectory() {
   char scriptsDirName[] = "scripts";
   uint8_t existingIndex = 0;
   FsEntry existingEntry;
-  if (fsFindChild(kFsRootParent, scriptsDirName, existingIndex, existingEntry)) {
+  if (fsFindChild(kFsRootParent, scriptsDirName, sizeof(scriptsDirName) - 1, existingIndex,
+                  existingEntry)) {
     return existingEntry.isDir;
   }
 
@@ -79,15 +48,16 @@ bool ensureDefaultBootScript() {
     return !nodeEntry.isDir;
   }
 
-  char parentPath[kCmdBufferSize];
-  char leaf[kFsNameBytes];
-  if (!fsSplitParentLeaf(bootScriptPath, parentPath, sizeof(parentPath), leaf, sizeof(leaf))) {
+  size_t parentLen = 0;
+  const char *leaf = nullptr;
+  size_t leafLen = 0;
+  if (!fsSplitParentLeaf(bootScriptPath, parentLen, leaf, leafLen)) {
     return false;
   }
 
   uint8_t parentIndex = kFsRootParent;
   FsEntry parentEntry;
-  if (!fsResolveDirectory(parentPath, parentIndex, parentEntry)) {
+  if (!fsResolveDirectory(bootScriptPath, parentLen, parentIndex, parentEntry)) {
     return false;
   }
 
@@ -112,8 +82,7 @@ bool ensureDefaultBootScript() {
   fileEntry.used = true;
   fileEntry.isDir = false;
   fileEntry.parent = parentIndex;
-  strncpy(fileEntry.name, leaf, kFsNameBytes - 1);
-  fileEntry.name[kFsNameBytes - 1] = '\0';
+  memcpy(fileEntry.name, leaf, leafLen);
   fileEntry.dataStart = nextFree;
   fileEntry.dataLen = static_cast<uint16_t>(textLen);
   fsStoreEntry(freeIndex, fileEntry);
@@ -150,20 +119,20 @@ void executeBootScriptLine(char *line) {
 
   char *argv[4] = {};
   const size_t argc = splitArgs(line, argv, 4);
-  if (argc != 3 || !equalsIgnoreCase(argv[0], "blink")) {
+  if (argc != 3 || !equalsIgnoreCase(argv[0], F("blink"))) {
     return;
   }
 
-  int pin = -1;
+  uint32_t pinMask = 0;
   unsigned long periodMs = 0;
-  if (!parsePinToken(argv[1], pin)) {
+  if (!parsePinList(argv[1], pinMask)) {
     return;
   }
-  if (!parseUnsignedAuto(argv[2], periodMs) || periodMs > 60000UL) {
+  if (!parseUnsignedAuto(argv[2], periodMs) || periodMs > kMaxBlinkPeriodMs) {
     return;
   }
 
-  setBlinkTask(pin, static_cast<uint16_t>(periodMs));
+  taskStartBlink(pinMask, static_cast<uint16_t>(periodMs));
 }
 
 void runBootScript() {
@@ -216,19 +185,4 @@ void startupScriptInit() {
 #endif
 }
 
-void updateBackgroundTasks() {
-  if (!gBlinkEnabled) {
-    return;
-  }
-
-  const uint32_t now = millis();
-  if (static_cast<int32_t>(now - gBlinkNextToggleMs) < 0) {
-    return;
-  }
-
-  gBlinkLevelHigh = !gBlinkLevelHigh;
-  digitalWrite(gBlinkPin, gBlinkLevelHigh ? HIGH : LOW);
-  gBlinkNextToggleMs = now + (gBlinkLevelHigh ? gBlinkHighMs : gBlinkLowMs);
-}
-
 } // namespace shell
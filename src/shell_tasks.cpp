@@ -0,0 +1,269 @@
+#include "shell.hpp"
+
+#include <util/atomic.h>
+
+namespace shell {
+
+namespace {
+
+enum class TaskKind : uint8_t { Free, Periodic, Once, Blink };
+
+struct Task {
+  TaskKind kind = TaskKind::Free;
+  uint32_t dueMs = 0;
+  union {
+    struct {
+      TaskCallback fn;
+      uint16_t arg;
+      uint32_t periodMs; // 0 for one-shot tasks
+      const __FlashStringHelper *label;
+    } call;
+    struct {
+      uint32_t pinMask;
+      uint8_t portMask[3]; // pinMask split by port, indexed like pinPortIndex()
+      uint16_t highMs;
+      uint16_t lowMs;
+      bool levelHigh;
+    } blink;
+  };
+  uint32_t runs = 0;
+  uint16_t overruns = 0;
+  uint16_t maxLateMs = 0;
+
+  Task() : call{nullptr, 0, 0, nullptr} {}
+};
+
+Task gTasks[kTaskSlots];
+// Slot indices of live tasks, earliest deadline first: the loop only ever looks at [0].
+uint8_t gTaskOrder[kTaskSlots];
+uint8_t gTaskCount = 0;
+bool gTasksRunning = false;
+
+bool dueBefore(uint32_t a, uint32_t b) { return static_cast<int32_t>(a - b) < 0; }
+
+void insertOrdered(uint8_t slot) {
+  uint8_t pos = gTaskCount;
+  while (pos > 0 && dueBefore(gTasks[slot].dueMs, gTasks[gTaskOrder[pos - 1]].dueMs)) {
+    gTaskOrder[pos] = gTaskOrder[pos - 1];
+    --pos;
+  }
+  gTaskOrder[pos] = slot;
+  ++gTaskCount;
+}
+
+void removeOrdered(uint8_t slot) {
+  for (uint8_t i = 0; i < gTaskCount; ++i) {
+    if (gTaskOrder[i] != slot) {
+      continue;
+    }
+    for (uint8_t j = i + 1; j < gTaskCount; ++j) {
+      gTaskOrder[j - 1] = gTaskOrder[j];
+    }
+    --gTaskCount;
+    return;
+  }
+}
+
+int8_t allocTask(TaskKind kind, uint32_t firstDelayMs) {
+  for (uint8_t i = 0; i < kTaskSlots; ++i) {
+    if (gTasks[i].kind != TaskKind::Free) {
+      continue;
+    }
+    gTasks[i] = Task();
+    gTasks[i].kind = kind;
+    gTasks[i].dueMs = millis() + firstDelayMs;
+    return static_cast<int8_t>(i);
+  }
+  return kNoTask;
+}
+
+// One read-modify-write per port rather than a digitalWrite() per pin. Interrupts are off
+// for it because tone() toggles its own PORTx bit from an ISR.
+void writeBlinkPins(const uint8_t (&portMask)[3], bool high) {
+  for (uint8_t i = 0; i < 3; ++i) {
+    if (portMask[i] == 0) {
+      continue;
+    }
+    volatile uint8_t &port = portInput(i)[2];
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      port = static_cast<uint8_t>(high ? (port | portMask[i]) : (port & ~portMask[i]));
+    }
+  }
+}
+
+// Advances a repeating deadline by one interval; whole intervals that already passed are
+// skipped and counted as overruns rather than run back to back.
+void advanceDeadline(Task &task, uint32_t intervalMs, uint32_t now) {
+  task.dueMs += intervalMs;
+  if (!dueBefore(now, task.dueMs)) {
+    const uint32_t missed = (now - task.dueMs) / intervalMs + 1U;
+    task.dueMs += missed * intervalMs;
+    task.overruns = static_cast<uint16_t>(
+        (task.overruns + missed > 0xFFFFU) ? 0xFFFFU : task.overruns + missed);
+  }
+}
+
+} // namespace
+
+int8_t taskStartPeriodic(TaskCallback fn, uint16_t arg, uint32_t periodMs,
+                         const __FlashStringHelper *label) {
+  if (fn == nullptr || periodMs == 0) {
+    return kNoTask;
+  }
+  const int8_t id = allocTask(TaskKind::Periodic, periodMs);
+  if (id != kNoTask) {
+    gTasks[id].call = {fn, arg, periodMs, label};
+    insertOrdered(static_cast<uint8_t>(id));
+  }
+  return id;
+}
+
+int8_t taskStartOnce(TaskCallback fn, uint16_t arg, uint32_t delayMs,
+                     const __FlashStringHelper *label) {
+  if (fn == nullptr) {
+    return kNoTask;
+  }
+  const int8_t id = allocTask(TaskKind::Once, delayMs);
+  if (id != kNoTask) {
+    gTasks[id].call = {fn, arg, 0, label};
+    insertOrdered(static_cast<uint8_t>(id));
+  }
+  return id;
+}
+
+int8_t taskStartBlink(uint32_t pinMask, uint16_t periodMs) {
+  if (pinMask == 0) {
+    return kNoTask;
+  }
+  // A pin belongs to one blink task at a time; older tasks on the same pins are replaced.
+  for (uint8_t i = 0; i < kTaskSlots; ++i) {
+    if (gTasks[i].kind == TaskKind::Blink && (gTasks[i].blink.pinMask & pinMask) != 0) {
+      taskStop(i);
+    }
+  }
+
+  if (periodMs < 2) {
+    periodMs = 2;
+  }
+  const uint16_t highMs = static_cast<uint16_t>(periodMs / 2U);
+  const uint16_t lowMs = static_cast<uint16_t>(periodMs - highMs);
+  const int8_t id = allocTask(TaskKind::Blink, lowMs);
+  if (id == kNoTask) {
+    return kNoTask;
+  }
+
+  Task &task = gTasks[id];
+  task.blink = {pinMask, {0, 0, 0}, highMs, lowMs, false};
+  uint32_t mask = pinMask;
+  for (uint8_t pin = 0; pin < NUM_DIGITAL_PINS && mask != 0; ++pin, mask >>= 1) {
+    if (mask & 1UL) {
+      fastOutput(pin, false);
+      task.blink.portMask[pinPortIndex(pin)] |= pinBitMask(pin);
+    }
+  }
+  insertOrdered(static_cast<uint8_t>(id));
+  return id;
+}
+
+bool taskStop(uint8_t id) {
+  if (id >= kTaskSlots || gTasks[id].kind == TaskKind::Free) {
+    return false;
+  }
+  removeOrdered(id);
+  gTasks[id].kind = TaskKind::Free;
+  return true;
+}
+
+void updateBackgroundTasks() {
+#if FEATURE_I2C
+  updateTwi();
+#endif
+  if (gTaskCount == 0 || gTasksRunning) {
+    return;
+  }
+  const uint32_t now = millis();
+  const uint8_t slot = gTaskOrder[0];
+  Task &task = gTasks[slot];
+  if (dueBefore(now, task.dueMs)) {
+    return;
+  }
+
+  gTasksRunning = true;
+  removeOrdered(slot);
+  const uint32_t lateMs = now - task.dueMs;
+  if (lateMs > task.maxLateMs) {
+    task.maxLateMs = static_cast<uint16_t>(lateMs > 0xFFFFUL ? 0xFFFFUL : lateMs);
+  }
+  ++task.runs;
+
+  switch (task.kind) {
+    case TaskKind::Periodic:
+      advanceDeadline(task, task.call.periodMs, now);
+      task.call.fn(task.call.arg);
+      break;
+    case TaskKind::Once:
+      task.kind = TaskKind::Free;
+      task.call.fn(task.call.arg);
+      break;
+    case TaskKind::Blink:
+      task.blink.levelHigh = !task.blink.levelHigh;
+      writeBlinkPins(task.blink.portMask, task.blink.levelHigh);
+      advanceDeadline(task, task.blink.levelHigh ? task.blink.highMs : task.blink.lowMs, now);
+      break;
+    case TaskKind::Free:
+      break;
+  }
+
+  // The callback may have stopped its own task (or stopped and reused the slot).
+  if (task.kind != TaskKind::Free) {
+    removeOrdered(slot);
+    insertOrdered(slot);
+  }
+  gTasksRunning = false;
+}
+
+void printTasks() {
+  const uint32_t now = millis();
+  Serial.println(F("\n=== Tasks ==="));
+  uint8_t shown = 0;
+  for (uint8_t i = 0; i < kTaskSlots; ++i) {
+    const Task &task = gTasks[i];
+    if (task.kind == TaskKind::Free) {
+      continue;
+    }
+    ++shown;
+    Serial.print(i);
+    Serial.write(' ');
+    if (task.kind == TaskKind::Blink) {
+      Serial.print(F("blink "));
+      printPinList(task.blink.pinMask);
+      Serial.print(F(" every "));
+      Serial.print(task.blink.highMs + task.blink.lowMs);
+      Serial.print(F(" ms"));
+    } else {
+      Serial.print(task.call.label != nullptr ? task.call.label : F("task"));
+      if (task.kind == TaskKind::Periodic) {
+        Serial.print(F(" every "));
+        Serial.print(task.call.periodMs);
+        Serial.print(F(" ms"));
+      } else {
+        Serial.print(F(" once"));
+      }
+    }
+    Serial.print(F(", next in "));
+    Serial.print(dueBefore(now, task.dueMs) ? task.dueMs - now : 0UL);
+    Serial.print(F(" ms, runs "));
+    Serial.print(task.runs);
+    Serial.print(F(", overruns "));
+    Serial.print(task.overruns);
+    Serial.print(F(", max late "));
+    Serial.print(task.maxLateMs);
+    Serial.println(F(" ms"));
+  }
+  if (shown == 0) {
+    Serial.println(F("(no tasks)"));
+  }
+  Serial.println(F("=============\n"));
+}
+
+} // namespace shell
@@ -0,0 +1,403 @@
+#include "shell.hpp"
+
+#include <util/atomic.h>
+#include <util/twi.h>
+
+namespace shell {
+
+#if FEATURE_I2C
+namespace {
+
+static_assert((kTwiQueueSlots & (kTwiQueueSlots - 1)) == 0,
+              "kTwiQueueSlots must be a power of two");
+
+constexpr uint32_t kTwiTimeoutTicks = kTwiTimeoutMs * (F_CPU / 1000UL) / kCyclesPerTick;
+constexpr uint8_t kTwcrGo = _BV(TWINT) | _BV(TWEN) | _BV(TWIE);
+
+// Submitted descriptors, oldest first. The first gStarted of them have been put on the bus
+// and all but the last of those have finished; updateTwi() hands them back from the front.
+TwiTxn *gQueue[kTwiQueueSlots];
+uint8_t gQueueHead = 0;
+volatile uint8_t gQueueCount = 0;
+volatile uint8_t gStarted = 0;
+TwiTxn *volatile gCurrent = nullptr;
+volatile uint32_t gProgressTicks = 0; // last TWI interrupt of the current transaction
+volatile uint32_t gStopTicks = 0;     // when the TWI went idle behind its last STOP
+bool gHandingBack = false;
+
+struct TwiLogEntry {
+  uint8_t address;
+  uint8_t txCount;
+  uint8_t rxCount;
+  TwiStatus status;
+  uint16_t waitUs; // queued until START
+  uint16_t busUs;  // START until STOP
+};
+
+TwiLogEntry gLog[kTwiLogEntries];
+uint8_t gLogNext = 0;
+uint8_t gLogCount = 0;
+uint32_t gTxnTotal = 0;
+uint16_t gStatusCounts[static_cast<uint8_t>(TwiStatus::ArbLost) + 1U];
+uint8_t gMaxDepth = 0;
+uint16_t gMaxWaitUs = 0;
+uint16_t gMaxBusUs = 0;
+
+uint16_t ticksToUs(uint32_t ticks) {
+  constexpr uint8_t kUsPerTick = kCyclesPerTick / (F_CPU / 1000000UL);
+  return ticks > 0xFFFFUL / kUsPerTick ? 0xFFFF : static_cast<uint16_t>(ticks * kUsPerTick);
+}
+
+// Puts the next queued descriptor on the bus, or leaves the TWI idle. `stop` sends a STOP
+// first; with TWSTA also set the hardware sends the STOP and then a START once the bus is
+// free, so back-to-back transactions need no trip through the main loop.
+void startNext(bool stop) {
+  const uint8_t twcr = stop ? _BV(TWSTO) : 0;
+  if (gStarted == gQueueCount) {
+    gCurrent = nullptr;
+    gStopTicks = timerTicks();
+    TWCR = static_cast<uint8_t>(twcr | _BV(TWINT) | _BV(TWEN));
+    return;
+  }
+  TwiTxn *txn = gQueue[(gQueueHead + gStarted) & (kTwiQueueSlots - 1U)];
+  ++gStarted;
+  // The STOP ahead of the START goes out at the new rate as well.
+  const I2cClock &clock = txn->ownClock ? txn->clock : gI2cClock;
+  TWSR = static_cast<uint8_t>((TWSR & ~(_BV(TWPS0) | _BV(TWPS1))) | clock.twps);
+  TWBR = clock.twbr;
+  txn->status = TwiStatus::Busy;
+  txn->startTicks = timerTicks();
+  gProgressTicks = txn->startTicks;
+  gCurrent = txn;
+  TWCR = static_cast<uint8_t>(twcr | kTwcrGo | _BV(TWSTA));
+}
+
+void finish(TwiStatus status, bool stop) {
+  TwiTxn *txn = gCurrent;
+  txn->endTicks = timerTicks();
+  txn->status = status;
+  startNext(stop);
+}
+
+// TWEA answers the byte being received with ACK; the last byte gets a NACK so the slave
+// lets go of SDA for the STOP.
+void receiveNext(const TwiTxn &txn) {
+  const bool last = txn.rxCount + 1U >= txn.rxLen && txn.rxMore == 0;
+  TWCR = static_cast<uint8_t>(kTwcrGo | (last ? 0 : _BV(TWEA)));
+}
+
+// Runs in the TWI ISR, once per bus event of the current transaction.
+void twiInterrupt() {
+  TwiTxn *txn = gCurrent;
+  if (txn == nullptr) {
+    TWCR = _BV(TWINT) | _BV(TWEN);
+    return;
+  }
+  gProgressTicks = timerTicks();
+  const uint8_t state = TW_STATUS;
+  switch (state) {
+    case TW_START:
+    case TW_REP_START: {
+      const bool read = state == TW_REP_START || (txn->txLen == 0 && txn->rxLen != 0);
+      TWDR = static_cast<uint8_t>((txn->address << 1) | (read ? TW_READ : TW_WRITE));
+      TWCR = kTwcrGo;
+      break;
+    }
+    case TW_MT_SLA_ACK:
+    case TW_MT_DATA_ACK:
+      if (txn->txCount < txn->txLen) {
+        TWDR = txn->tx[txn->txCount++];
+        TWCR = kTwcrGo;
+      } else if (txn->rxLen != 0) {
+        TWCR = kTwcrGo | _BV(TWSTA);
+      } else {
+        finish(TwiStatus::Ok, true);
+      }
+      break;
+    case TW_MT_SLA_NACK:
+    case TW_MR_SLA_NACK:
+      finish(TwiStatus::AddrNack, true);
+      break;
+    case TW_MT_DATA_NACK:
+      finish(TwiStatus::DataNack, true);
+      break;
+    case TW_MT_ARB_LOST: // same code as TW_MR_ARB_LOST; another master has the bus
+      finish(TwiStatus::ArbLost, false);
+      break;
+    case TW_MR_SLA_ACK:
+      receiveNext(*txn);
+      break;
+    case TW_MR_DATA_ACK:
+      txn->rx[txn->rxCount++] = TWDR;
+      if (txn->rxCount == txn->rxLen) {
+        // Leaving TWINT set holds SCL low; with TWIE off it does not fire again meanwhile.
+        txn->status = TwiStatus::Paused;
+        TWCR = _BV(TWEN);
+        break;
+      }
+      receiveNext(*txn);
+      break;
+    case TW_MR_DATA_NACK:
+      txn->rx[txn->rxCount++] = TWDR;
+      finish(TwiStatus::Ok, true);
+      break;
+    default: // TW_BUS_ERROR: a misplaced START or STOP; sending a STOP clears it
+      finish(TwiStatus::BusError, true);
+      break;
+  }
+}
+
+void logTxn(const TwiTxn &txn) {
+  const uint16_t waitUs = ticksToUs(txn.startTicks - txn.queuedTicks);
+  const uint16_t busUs = ticksToUs(txn.endTicks - txn.startTicks);
+  gLog[gLogNext] = {txn.address, txn.txCount, txn.rxCount, txn.status, waitUs, busUs};
+  gLogNext = static_cast<uint8_t>((gLogNext + 1U) % kTwiLogEntries);
+  if (gLogCount < kTwiLogEntries) {
+    ++gLogCount;
+  }
+  ++gTxnTotal;
+  uint16_t &count = gStatusCounts[static_cast<uint8_t>(txn.status)];
+  if (count != 0xFFFF) {
+    ++count;
+  }
+  gMaxWaitUs = waitUs > gMaxWaitUs ? waitUs : gMaxWaitUs;
+  gMaxBusUs = busUs > gMaxBusUs ? busUs : gMaxBusUs;
+}
+
+const __FlashStringHelper *statusName(TwiStatus status) {
+  switch (status) {
+    case TwiStatus::Ok:
+      return F("ok");
+    case TwiStatus::AddrNack:
+      return F("addr nack");
+    case TwiStatus::DataNack:
+      return F("data nack");
+    case TwiStatus::BusError:
+      return F("bus error");
+    case TwiStatus::Timeout:
+      return F("timeout");
+    case TwiStatus::ArbLost:
+      return F("arb lost");
+    case TwiStatus::Queued:
+    case TwiStatus::Busy:
+    case TwiStatus::Paused:
+      break;
+  }
+  return F("pending");
+}
+
+// SDA and SCL are open drain here as on the bus: a line is pulled low by making it an
+// output (PORT bit off) and let go by making it an input with the pull-up on again.
+void setLine(uint8_t mask, bool low) {
+  volatile uint8_t *pin = portInput(pinPortIndex(SDA));
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (low) {
+      pin[2] = static_cast<uint8_t>(pin[2] & ~mask);
+      pin[1] = static_cast<uint8_t>(pin[1] | mask);
+    } else {
+      pin[1] = static_cast<uint8_t>(pin[1] & ~mask);
+      pin[2] = static_cast<uint8_t>(pin[2] | mask);
+    }
+  }
+  delayMicroseconds(5); // half a 100 kHz clock
+}
+
+} // namespace
+
+// Internal pull-ups on SDA/SCL as Wire sets them; they only suit short buses.
+void twiBegin() {
+  volatile uint8_t &port = portInput(pinPortIndex(SDA))[2];
+  port = static_cast<uint8_t>(port | pinBitMask(SDA) | pinBitMask(SCL));
+  setI2cClock(gI2cClockHz);
+  TWCR = _BV(TWEN);
+}
+
+bool twiSubmit(TwiTxn &txn) {
+  if (gQueueCount == kTwiQueueSlots) {
+    return false;
+  }
+  txn.queued = true;
+  txn.status = TwiStatus::Queued;
+  txn.txCount = 0;
+  txn.rxCount = 0;
+  txn.queuedTicks = timerTicks();
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    gQueue[(gQueueHead + gQueueCount) & (kTwiQueueSlots - 1U)] = &txn;
+    ++gQueueCount;
+    if (gQueueCount > gMaxDepth) {
+      gMaxDepth = gQueueCount;
+    }
+    // While a STOP is still on its way out (a slave may be holding SCL low), the
+    // descriptor stays Queued and updateTwi() starts it.
+    if (gCurrent == nullptr && (TWCR & _BV(TWSTO)) == 0) {
+      startNext(false);
+    }
+  }
+  return true;
+}
+
+TwiStatus twiRun(TwiTxn &txn) {
+  txn.done = nullptr;
+  while (!twiSubmit(txn)) {
+    updateBackgroundTasks();
+  }
+  while (txn.queued) {
+    updateBackgroundTasks();
+  }
+  return txn.status;
+}
+
+void twiResume(TwiTxn &txn) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (txn.status != TwiStatus::Paused) {
+      return;
+    }
+    if (txn.rxMore < txn.rxLen) {
+      txn.rxLen = static_cast<uint8_t>(txn.rxMore);
+    }
+    txn.rxMore = static_cast<uint16_t>(txn.rxMore - txn.rxLen);
+    txn.rxCount = 0;
+    txn.status = TwiStatus::Busy;
+    gProgressTicks = timerTicks();
+    receiveNext(txn);
+  }
+}
+
+bool twiRecoverBus(uint8_t &pulses) {
+  while (gQueueCount != 0) {
+    updateTwi();
+  }
+  const volatile uint8_t *pin = portInput(pinPortIndex(SDA));
+  const uint8_t sda = pinBitMask(SDA);
+  const uint8_t scl = pinBitMask(SCL);
+  TWCR = 0;
+  for (pulses = 0; pulses < 9 && (*pin & sda) == 0; ++pulses) {
+    setLine(scl, true);
+    setLine(scl, false);
+  }
+  // SDA falling and then rising while SCL is high: a START and a STOP, which reset the bus
+  // logic of every slave.
+  setLine(sda, true);
+  setLine(sda, false);
+  const bool released = (*pin & (sda | scl)) == (sda | scl);
+  TWCR = _BV(TWEN);
+  return released;
+}
+
+void updateTwi() {
+  if (gHandingBack) {
+    return;
+  }
+  gHandingBack = true;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    // Nothing raises TWINT while a slave holds SCL low or the START never gets the bus.
+    // Turning the TWI off lets go of both lines; startNext() turns it back on. A paused
+    // read waits on its owner, not on the bus.
+    if (gCurrent != nullptr && gCurrent->status != TwiStatus::Paused &&
+        timerTicks() - gProgressTicks >
+            (gCurrent->timeoutTicks != 0 ? gCurrent->timeoutTicks : kTwiTimeoutTicks)) {
+      TWCR = 0;
+      finish(TwiStatus::Timeout, false);
+    }
+    // Work left waiting behind a STOP. A STOP that does not get out in kTwiTimeoutMs fails
+    // the next descriptor the same way.
+    if (gCurrent == nullptr && gStarted != gQueueCount) {
+      if ((TWCR & _BV(TWSTO)) == 0) {
+        startNext(false);
+      } else if (timerTicks() - gStopTicks > kTwiTimeoutTicks) {
+        TWCR = 0;
+        TwiTxn *txn = gQueue[(gQueueHead + gStarted) & (kTwiQueueSlots - 1U)];
+        ++gStarted;
+        txn->startTicks = timerTicks();
+        txn->endTicks = txn->startTicks;
+        txn->status = TwiStatus::Timeout;
+      }
+    }
+  }
+  while (gQueueCount != 0) {
+    TwiTxn &txn = *gQueue[gQueueHead];
+    const TwiStatus status = txn.status;
+    if (status == TwiStatus::Queued || status == TwiStatus::Busy ||
+        status == TwiStatus::Paused) {
+      break;
+    }
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      gQueueHead = static_cast<uint8_t>((gQueueHead + 1U) & (kTwiQueueSlots - 1U));
+      --gQueueCount;
+      --gStarted;
+    }
+    logTxn(txn);
+    txn.queued = false;
+    if (txn.done != nullptr) {
+      txn.done(txn);
+    }
+  }
+  gHandingBack = false;
+}
+
+// "0x3C w2 r0 ok, wait 8 us, bus 244 us", newest last.
+void printTwiStats() {
+  Serial.println(F("\n=== I2C ==="));
+  Serial.print(F("Transactions: "));
+  Serial.print(gTxnTotal);
+  Serial.print(F(" (ok "));
+  Serial.print(gStatusCounts[static_cast<uint8_t>(TwiStatus::Ok)]);
+  for (uint8_t i = static_cast<uint8_t>(TwiStatus::AddrNack);
+       i <= static_cast<uint8_t>(TwiStatus::ArbLost); ++i) {
+    if (gStatusCounts[i] != 0) {
+      Serial.print(F(", "));
+      Serial.print(statusName(static_cast<TwiStatus>(i)));
+      Serial.write(' ');
+      Serial.print(gStatusCounts[i]);
+    }
+  }
+  Serial.println(F(")"));
+  Serial.print(F("Queue: "));
+  Serial.print(gQueueCount);
+  Serial.write('/');
+  Serial.print(kTwiQueueSlots);
+  Serial.print(F(" in use, max "));
+  Serial.println(gMaxDepth);
+  Serial.print(F("Max wait: "));
+  Serial.print(gMaxWaitUs);
+  Serial.print(F(" us, max bus time: "));
+  Serial.print(gMaxBusUs);
+  Serial.println(F(" us"));
+  for (uint8_t n = 0; n < gLogCount; ++n) {
+    const TwiLogEntry &entry =
+        gLog[(gLogNext + kTwiLogEntries - gLogCount + n) % kTwiLogEntries];
+    Serial.print(F("  "));
+    printI2cAddress(entry.address);
+    Serial.print(F(" w"));
+    Serial.print(entry.txCount);
+    Serial.print(F(" r"));
+    Serial.print(entry.rxCount);
+    Serial.write(' ');
+    Serial.print(statusName(entry.status));
+    Serial.print(F(", wait "));
+    Serial.print(entry.waitUs);
+    Serial.print(F(" us, bus "));
+    Serial.print(entry.busUs);
+    Serial.println(F(" us"));
+  }
+  Serial.println(F("===========\n"));
+}
+
+void resetTwiStats() {
+  gLogCount = 0;
+  gTxnTotal = 0;
+  for (uint16_t &count : gStatusCounts) {
+    count = 0;
+  }
+  gMaxDepth = gQueueCount;
+  gMaxWaitUs = 0;
+  gMaxBusUs = 0;
+}
+
+#endif
+
+} // namespace shell
+
+#if FEATURE_I2C
+ISR(TWI_vect) { shell::twiInterrupt(); }
+#endif
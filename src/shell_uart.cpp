@@ -0,0 +1,227 @@
+#include "shell.hpp"
+
+#include <EEPROM.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+namespace shell {
+
+ShellSerial Serial;
+
+uint32_t gTxBytes = 0;
+uint32_t gTxBlockedUs = 0;
+uint16_t gTxStalls = 0;
+
+namespace {
+
+uint8_t gTxRing[kTxRingSize];
+volatile uint8_t gTxHead = 0;
+volatile uint8_t gTxTail = 0;
+uint8_t gTxStage[kTxStageSize];
+uint8_t gTxStageLen = 0;
+// Rates `baud` accepts; the EEPROM stores an index into this table.
+const uint32_t kSupportedBauds[] PROGMEM = {9600UL,   19200UL,  38400UL,  57600UL,
+                                            115200UL, 250000UL, 500000UL, 1000000UL};
+constexpr uint8_t kSupportedBaudCount = sizeof(kSupportedBauds) / sizeof(kSupportedBauds[0]);
+
+bool gTxInIdleHook = false;
+bool gTxWritten = false;
+
+uint8_t nextTxIndex(uint8_t index) {
+  return static_cast<uint8_t>((index + 1U) % kTxRingSize);
+}
+
+uint8_t txRoom() {
+  return static_cast<uint8_t>((gTxTail + kTxRingSize - gTxHead - 1U) % kTxRingSize);
+}
+
+void drainOneByHand() {
+  // Interrupts are off (ISR or atomic block): move a byte to the UART by polling.
+  if (gTxHead != gTxTail && (UCSR0A & _BV(UDRE0))) {
+    UDR0 = gTxRing[gTxTail];
+    gTxTail = nextTxIndex(gTxTail);
+  }
+}
+
+// The ring is full: account the stall and lend the CPU to background tasks.
+void waitForTxRoom() {
+  const uint32_t startUs = micros();
+  ++gTxStalls;
+  while (txRoom() == 0) {
+    if ((SREG & _BV(SREG_I)) == 0) {
+      drainOneByHand();
+    } else if (!gTxInIdleHook) {
+      // Background tasks run here must not print: the stage is mid-commit.
+      gTxInIdleHook = true;
+      updateBackgroundTasks();
+      gTxInIdleHook = false;
+    }
+  }
+  gTxBlockedUs += micros() - startUs;
+}
+
+void commitStage() {
+  uint8_t sent = 0;
+  while (sent < gTxStageLen) {
+    uint8_t room = txRoom();
+    if (room == 0) {
+      waitForTxRoom();
+      continue;
+    }
+    const uint8_t remaining = static_cast<uint8_t>(gTxStageLen - sent);
+    if (room > remaining) {
+      room = remaining;
+    }
+
+    // Single producer: the ISR only advances the tail, so fill outside the lock.
+    uint8_t head = gTxHead;
+    for (uint8_t i = 0; i < room; ++i) {
+      gTxRing[head] = gTxStage[sent++];
+      head = nextTxIndex(head);
+    }
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      gTxHead = head;
+      UCSR0B |= _BV(UDRIE0);
+    }
+  }
+  gTxBytes += gTxStageLen;
+  gTxStageLen = 0;
+  gTxWritten = true;
+}
+
+} // namespace
+
+bool isSupportedBaud(uint32_t baud) {
+  for (uint8_t i = 0; i < kSupportedBaudCount; ++i) {
+    if (pgm_read_dword(&kSupportedBauds[i]) == baud) {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint16_t ubrrForBaud(uint32_t baud) {
+  // Double-speed (U2X) divisor, rounded to nearest: exact for 250k/500k/1M at 16 MHz.
+  const uint32_t divisor = (F_CPU / 8UL + baud / 2UL) / baud;
+  return static_cast<uint16_t>(divisor > 0 ? divisor - 1UL : 0UL);
+}
+
+uint32_t actualBaud(uint32_t baud) {
+  return F_CPU / (8UL * (static_cast<uint32_t>(ubrrForBaud(baud)) + 1UL));
+}
+
+void printSupportedBauds() {
+  for (uint8_t i = 0; i < kSupportedBaudCount; ++i) {
+    if (i > 0) {
+      Serial.write(',');
+    }
+    Serial.print(pgm_read_dword(&kSupportedBauds[i]));
+  }
+}
+
+uint32_t savedBaudRate() {
+#if FEATURE_EEPROM
+  const uint8_t code = EEPROM.read(kEepromBaudCodeAddr);
+  if (EEPROM.read(kEepromBaudMagicAddr) == kEepromBaudMagic && code < kSupportedBaudCount) {
+    return pgm_read_dword(&kSupportedBauds[code]);
+  }
+#endif
+  return kBaudRate;
+}
+
+#if FEATURE_EEPROM
+void saveBaudRate(uint32_t baud) {
+  for (uint8_t i = 0; i < kSupportedBaudCount; ++i) {
+    if (pgm_read_dword(&kSupportedBauds[i]) == baud) {
+      EEPROM.update(kEepromBaudMagicAddr, kEepromBaudMagic);
+      EEPROM.update(kEepromBaudCodeAddr, i);
+      return;
+    }
+  }
+}
+#endif
+
+void ShellSerial::begin(uint32_t baud) {
+  flush();
+  const uint16_t ubrr = ubrrForBaud(baud);
+  baud_ = baud;
+  UCSR0A = _BV(U2X0);
+  UBRR0H = static_cast<uint8_t>(ubrr >> 8);
+  UBRR0L = static_cast<uint8_t>(ubrr & 0xFFU);
+  UCSR0C = static_cast<uint8_t>(_BV(UCSZ01) | _BV(UCSZ00));
+  UCSR0B = static_cast<uint8_t>(_BV(RXEN0) | _BV(TXEN0) | _BV(RXCIE0));
+}
+
+size_t ShellSerial::write(uint8_t value) {
+  gTxStage[gTxStageLen++] = value;
+  if (value == '\n' || gTxStageLen == kTxStageSize) {
+    commitStage();
+  }
+  return 1;
+}
+
+size_t ShellSerial::write(const uint8_t *buffer, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    const uint8_t value = buffer[i];
+    gTxStage[gTxStageLen++] = value;
+    if (value == '\n' || gTxStageLen == kTxStageSize) {
+      commitStage();
+    }
+  }
+  return size;
+}
+
+void ShellSerial::push() {
+  if (gTxStageLen > 0) {
+    commitStage();
+  }
+}
+
+void ShellSerial::flush() {
+  push();
+  if ((UCSR0B & _BV(TXEN0)) == 0 || !gTxWritten) {
+    return;
+  }
+  while (gTxHead != gTxTail || (UCSR0A & _BV(TXC0)) == 0) {
+    if ((SREG & _BV(SREG_I)) == 0) {
+      drainOneByHand();
+    }
+  }
+}
+
+int ShellSerial::available() {
+  size_t editLen = 0;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { editLen = gCmdLen; }
+  return static_cast<int>(inputQueueUsed() + editLen);
+}
+
+void ShellSerial::discardInput() { shell::discardInput(); }
+
+} // namespace shell
+
+ISR(USART_RX_vect) {
+  const uint8_t status = UCSR0A;
+  const char c = static_cast<char>(UDR0);
+  if (status & _BV(DOR0)) {
+    // Hardware overrun: at least one byte before this one was lost.
+    ++shell::gRxDroppedBytes;
+  }
+  if (status & _BV(FE0)) {
+    ++shell::gRxDroppedBytes;
+    return;
+  }
+  shell::assembleInputByte(c);
+}
+
+ISR(USART_UDRE_vect) {
+  using namespace shell;
+  const uint8_t tail = gTxTail;
+  UDR0 = gTxRing[tail];
+  UCSR0A = static_cast<uint8_t>((UCSR0A & _BV(U2X0)) | _BV(TXC0));
+  const uint8_t next = nextTxIndex(tail);
+  gTxTail = next;
+  if (next == gTxHead) {
+    UCSR0B &= static_cast<uint8_t>(~_BV(UDRIE0));
+  }
+}
@@ -0,0 +1,175 @@
+#include "shell.hpp"
+
+#include <util/atomic.h>
+
+namespace shell {
+
+namespace {
+
+static_assert((kWatchEvents & (kWatchEvents - 1)) == 0, "kWatchEvents must be a power of two");
+
+// Filled by the PCINT ISRs, drained by the watch job.
+WatchEvent gEvents[kWatchEvents];
+volatile uint8_t gEventHead = 0;
+volatile uint8_t gEventCount = 0;
+volatile uint16_t gDropped = 0;
+uint8_t gWatchMask[3] = {0, 0, 0}; // per PCINT group: 0 = port B, 1 = port C, 2 = port D
+uint8_t gWatchLast[3] = {0, 0, 0};
+uint32_t gWatchPins = 0;
+bool gWatchActive = false;
+uint8_t gSavedPcicr = 0;
+uint8_t gSavedPcmsk[3] = {0, 0, 0};
+
+volatile uint8_t &pcmskForGroup(uint8_t group) {
+  return group == 0 ? PCMSK0 : (group == 1 ? PCMSK1 : PCMSK2);
+}
+
+uint8_t readGroupPins(uint8_t group) { return group == 0 ? PINB : (group == 1 ? PINC : PIND); }
+
+// Runs in the PCINT ISRs. The port is read before anything else so the levels belong to
+// the edge that raised the interrupt; several pins changing together make one event.
+void watchPinChange(uint8_t group, uint8_t state) {
+  const uint8_t changed = static_cast<uint8_t>((state ^ gWatchLast[group]) & gWatchMask[group]);
+  gWatchLast[group] = state;
+  if (changed == 0) {
+    return;
+  }
+  if (gEventCount == kWatchEvents) {
+    if (gDropped != 0xFFFF) {
+      ++gDropped;
+    }
+    return;
+  }
+  WatchEvent &event = gEvents[(gEventHead + gEventCount) & (kWatchEvents - 1U)];
+  event.ticks = timerTicks();
+  event.group = group;
+  event.state = state;
+  event.changed = changed;
+  ++gEventCount;
+}
+
+} // namespace
+
+bool watchStart(uint32_t pinMask) {
+  if (gWatchActive || pinMask == 0) {
+    return false;
+  }
+  uint8_t masks[3] = {0, 0, 0};
+  uint32_t mask = pinMask;
+  for (uint8_t pin = 0; pin < NUM_DIGITAL_PINS && mask != 0; ++pin, mask >>= 1) {
+    if (mask & 1UL) { // every ATmega328P pin has a PCINT line
+      masks[digitalPinToPCICRbit(pin)] |= digitalPinToBitMask(pin);
+    }
+  }
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    gEventHead = 0;
+    gEventCount = 0;
+    gDropped = 0;
+    gSavedPcicr = PCICR;
+    for (uint8_t group = 0; group < 3; ++group) {
+      volatile uint8_t &pcmsk = pcmskForGroup(group);
+      gSavedPcmsk[group] = pcmsk;
+      gWatchMask[group] = masks[group];
+      gWatchLast[group] = readGroupPins(group);
+      pcmsk = static_cast<uint8_t>(pcmsk | masks[group]);
+      if (masks[group] != 0) {
+        PCICR = static_cast<uint8_t>(PCICR | _BV(group));
+      }
+    }
+    PCIFR = static_cast<uint8_t>(_BV(PCIF0) | _BV(PCIF1) | _BV(PCIF2));
+  }
+  gWatchPins = pinMask;
+  gWatchActive = true;
+  return true;
+}
+
+void watchStop() {
+  if (!gWatchActive) {
+    return;
+  }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    for (uint8_t group = 0; group < 3; ++group) {
+      pcmskForGroup(group) = gSavedPcmsk[group];
+      gWatchMask[group] = 0;
+    }
+    PCICR = gSavedPcicr;
+  }
+  gWatchActive = false;
+}
+
+bool watchPop(WatchEvent &event) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (gEventCount == 0) {
+      return false;
+    }
+    event = gEvents[gEventHead];
+    gEventHead = static_cast<uint8_t>((gEventHead + 1U) & (kWatchEvents - 1U));
+    --gEventCount;
+  }
+  return true;
+}
+
+uint16_t watchTakeDropped() {
+  uint16_t dropped = 0;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    dropped = gDropped;
+    gDropped = 0;
+  }
+  return dropped;
+}
+
+void printWatchLevels() {
+  uint32_t mask = gWatchPins;
+  bool first = true;
+  for (uint8_t pin = 0; pin < NUM_DIGITAL_PINS && mask != 0; ++pin, mask >>= 1) {
+    if ((mask & 1UL) == 0) {
+      continue;
+    }
+    if (!first) {
+      Serial.print(F(", "));
+    }
+    printPinLabel(pin);
+    Serial.print(fastRead(fastPin(pin)) ? F(" HIGH") : F(" LOW"));
+    first = false;
+  }
+  Serial.println();
+}
+
+// "<pin> rise|fall[, ...] @ <us> us (+<us since the previous edge> us)"
+void printWatchEvent(const WatchEvent &event, uint32_t &prevTicks) {
+  bool first = true;
+  uint32_t mask = gWatchPins;
+  for (uint8_t pin = 0; pin < NUM_DIGITAL_PINS && mask != 0; ++pin, mask >>= 1) {
+    const uint8_t bit = digitalPinToBitMask(pin);
+    if ((mask & 1UL) == 0 || digitalPinToPCICRbit(pin) != event.group ||
+        (event.changed & bit) == 0) {
+      continue;
+    }
+    if (!first) {
+      Serial.print(F(", "));
+    }
+    printPinLabel(pin);
+    Serial.print((event.state & bit) ? F(" rise") : F(" fall"));
+    first = false;
+  }
+  constexpr uint8_t kUsPerTick = kCyclesPerTick / (F_CPU / 1000000UL);
+  Serial.print(F(" @ "));
+  Serial.print(event.ticks * kUsPerTick);
+  Serial.print(F(" us"));
+  if (prevTicks != 0) {
+    Serial.print(F(" (+"));
+    Serial.print((event.ticks - prevTicks) * kUsPerTick);
+    Serial.print(F(" us)"));
+  }
+  Serial.println();
+  prevTicks = event.ticks;
+}
+
+} // namespace shell
+
+ISR(PCINT0_vect) { shell::watchPinChange(0, PINB); }
+
+ISR(PCINT1_vect) { shell::watchPinChange(1, PINC); }
+
+ISR(PCINT2_vect) { shell::watchPinChange(2, PIND); }
@@ -0,0 +1,297 @@
+#include "shell.hpp"
+
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+#if FEATURE_FS
+#include <EEPROM.h>
+#endif
+
+namespace shell {
+
+#if FEATURE_WAVE
+namespace {
+
+const uint8_t kSineTable[256] PROGMEM = {
+    128, 131, 134, 137, 140, 143, 146, 149, 152, 155, 158, 162, 165, 167, 170, 173,
+    176, 179, 182, 185, 188, 190, 193, 196, 198, 201, 203, 206, 208, 211, 213, 215,
+    218, 220, 222, 224, 226, 228, 230, 232, 234, 235, 237, 238, 240, 241, 243, 244,
+    245, 246, 248, 249, 250, 250, 251, 252, 253, 253, 254, 254, 254, 255, 255, 255,
+    255, 255, 255, 255, 254, 254, 254, 253, 253, 252, 251, 250, 250, 249, 248, 246,
+    245, 244, 243, 241, 240, 238, 237, 235, 234, 232, 230, 228, 226, 224, 222, 220,
+    218, 215, 213, 211, 208, 206, 203, 201, 198, 196, 193, 190, 188, 185, 182, 179,
+    176, 173, 170, 167, 165, 162, 158, 155, 152, 149, 146, 143, 140, 137, 134, 131,
+    128, 124, 121, 118, 115, 112, 109, 106, 103, 100, 97, 93, 90, 88, 85, 82,
+    79, 76, 73, 70, 67, 65, 62, 59, 57, 54, 52, 49, 47, 44, 42, 40,
+    37, 35, 33, 31, 29, 27, 25, 23, 21, 20, 18, 17, 15, 14, 12, 11,
+    10, 9, 7, 6, 5, 5, 4, 3, 2, 2, 1, 1, 1, 0, 0, 0,
+    0, 0, 0, 0, 1, 1, 1, 2, 2, 3, 4, 5, 5, 6, 7, 9,
+    10, 11, 12, 14, 15, 17, 18, 20, 21, 23, 25, 27, 29, 31, 33, 35,
+    37, 40, 42, 44, 47, 49, 52, 54, 57, 59, 62, 65, 67, 70, 73, 76,
+    79, 82, 85, 88, 90, 93, 97, 100, 103, 106, 109, 112, 115, 118, 121, 124,
+};
+
+const uint8_t kTriangleTable[256] PROGMEM = {
+    0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30,
+    32, 34, 36, 38, 40, 42, 44, 46, 48, 50, 52, 54, 56, 58, 60, 62,
+    64, 66, 68, 70, 72, 74, 76, 78, 80, 82, 84, 86, 88, 90, 92, 94,
+    96, 98, 100, 102, 104, 106, 108, 110, 112, 114, 116, 118, 120, 122, 124, 126,
+    128, 130, 132, 134, 136, 138, 140, 142, 144, 146, 148, 150, 152, 154, 156, 158,
+    160, 162, 164, 166, 168, 170, 172, 174, 176, 178, 180, 182, 184, 186, 188, 190,
+    192, 194, 196, 198, 200, 202, 204, 206, 208, 210, 212, 214, 216, 218, 220, 222,
+    224, 226, 228, 230, 232, 234, 236, 238, 240, 242, 244, 246, 248, 250, 252, 254,
+    255, 253, 251, 249, 247, 245, 243, 241, 239, 237, 235, 233, 231, 229, 227, 225,
+    223, 221, 219, 217, 215, 213, 211, 209, 207, 205, 203, 201, 199, 197, 195, 193,
+    191, 189, 187, 185, 183, 181, 179, 177, 175, 173, 171, 169, 167, 165, 163, 161,
+    159, 157, 155, 153, 151, 149, 147, 145, 143, 141, 139, 137, 135, 133, 131, 129,
+    127, 125, 123, 121, 119, 117, 115, 113, 111, 109, 107, 105, 103, 101, 99, 97,
+    95, 93, 91, 89, 87, 85, 83, 81, 79, 77, 75, 73, 71, 69, 67, 65,
+    63, 61, 59, 57, 55, 53, 51, 49, 47, 45, 43, 41, 39, 37, 35, 33,
+    31, 29, 27, 25, 23, 21, 19, 17, 15, 13, 11, 9, 7, 5, 3, 1,
+};
+
+// Written by the Timer2 overflow ISR's owner with interrupts off.
+volatile uint32_t gPhase = 0;
+volatile uint32_t gIncrement = 0;
+const uint8_t *gFlashTable = kSineTable;
+bool gUserShape = false;
+static_assert(kWaveUserPoints == 64, "the ISR indexes the user table with phase >> 26");
+uint8_t gUserTable[kWaveUserPoints];
+volatile uint8_t *gDuty8 = nullptr;   // OCR2A/OCR2B
+volatile uint16_t *gDuty16 = nullptr; // OCR1A/OCR1B
+volatile uint8_t gLastCycles = 0;
+volatile uint8_t gMaxCycles = 0;
+
+bool gRunning = false;
+uint8_t gPin = 0;
+WaveShape gShape = WaveShape::Sine;
+PwmPinInfo gOutput = {2, 'A'};
+
+// The phase step per sample for a frequency in mHz: 2^32 * f / (F_CPU / 510).
+uint32_t incrementFor(uint32_t milliHz) {
+  return static_cast<uint32_t>((static_cast<uint64_t>(milliHz) * 510U << 32) /
+                               (F_CPU * 1000ULL));
+}
+
+uint8_t comBit(const PwmPinInfo &output) {
+  return output.channel == 'A' ? _BV(COM2A1) : _BV(COM2B1); // same on Timer1 and Timer2
+}
+
+} // namespace
+
+// Points are spread evenly over one period and joined by straight lines, wrapping from the
+// last point back to the first.
+bool waveLoadUser(const uint8_t *points, uint8_t count) {
+  if (count < 2 || count > kWaveUserPoints) {
+    return false;
+  }
+  uint8_t table[kWaveUserPoints];
+  for (uint8_t i = 0; i < kWaveUserPoints; ++i) {
+    const uint16_t pos = static_cast<uint16_t>(i * count * (256U / kWaveUserPoints));
+    const uint8_t at = static_cast<uint8_t>(pos >> 8);
+    const uint8_t frac = static_cast<uint8_t>(pos);
+    const int16_t a = points[at];
+    const int16_t b = points[at + 1U == count ? 0 : at + 1U];
+    table[i] = static_cast<uint8_t>(a + ((b - a) * frac) / 256);
+  }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    for (uint8_t i = 0; i < kWaveUserPoints; ++i) {
+      gUserTable[i] = table[i];
+    }
+  }
+  return true;
+}
+
+// Timer2 runs 8-bit phase-correct PWM at clk/1, so it overflows every 510 cycles; that is
+// the sample clock. On D3/D11 it is also the carrier; for D9/D10 Timer1 runs the same mode
+// as the carrier and the ISR writes its compare register. Another pin or shape on the
+// running generator restarts it; a new frequency alone only changes the step, so the phase
+// carries on without a jump.
+bool waveStart(uint8_t pin, WaveShape shape, uint32_t milliHz) {
+  PwmPinInfo output;
+  if (!isPwmCapablePin(pin, output) || output.timer == 0 || milliHz == 0 ||
+      milliHz > kWaveMaxHz * 1000UL) {
+    return false;
+  }
+  const uint32_t increment = incrementFor(milliHz);
+  if (gRunning && pin == gPin && shape == gShape) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { gIncrement = increment; }
+    return true;
+  }
+  waveStop();
+  if (!timer2Claim()) {
+    return false;
+  }
+  if (output.timer == 1 && !timer1Claim()) {
+    timer2Release();
+    return false;
+  }
+  fastOutput(pin, false);
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    gPhase = 0;
+    gIncrement = increment;
+    gUserShape = shape == WaveShape::User;
+    gFlashTable = shape == WaveShape::Triangle ? kTriangleTable : kSineTable;
+    gDuty8 = nullptr;
+    gDuty16 = nullptr;
+    gLastCycles = 0;
+    gMaxCycles = 0;
+    TCCR2B = 0;
+    TCNT2 = 0;
+    TCCR2A = _BV(WGM20);
+    if (output.timer == 2) {
+      gDuty8 = output.channel == 'A' ? &OCR2A : &OCR2B;
+      *gDuty8 = 0x80;
+      TCCR2A = static_cast<uint8_t>(TCCR2A | comBit(output));
+    } else {
+      TCCR1B = 0;
+      TIMSK1 = 0;
+      TCNT1 = 0;
+      gDuty16 = output.channel == 'A' ? &OCR1A : &OCR1B;
+      *gDuty16 = 0x80;
+      TCCR1A = static_cast<uint8_t>(_BV(WGM10) | comBit(output));
+      TCCR1B = _BV(CS10);
+    }
+    TIFR2 = _BV(TOV2);
+    TIMSK2 = _BV(TOIE2);
+    TCCR2B = _BV(CS20);
+  }
+  gRunning = true;
+  gPin = pin;
+  gShape = shape;
+  gOutput = output;
+  return true;
+}
+
+bool waveRunning() { return gRunning; }
+
+void waveStop() {
+  if (!gRunning) {
+    return;
+  }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    TIMSK2 = static_cast<uint8_t>(TIMSK2 & ~_BV(TOIE2));
+    gDuty8 = nullptr;
+    gDuty16 = nullptr;
+  }
+  fastOutput(gPin, false);
+  if (gOutput.timer == 1) {
+    timer1Release();
+  }
+  timer2Release();
+  gRunning = false;
+}
+
+// "wave D11 sine 440.000 Hz, step 7.30 uHz, 31372.54 Hz sampling; ISR 40 cycles (max 52)
+// of 510 = 10.19% CPU, ceiling ~307692 Hz"
+void printWaveStatus() {
+  if (!gRunning) {
+    Serial.println(F("wave off"));
+    return;
+  }
+  uint32_t increment = 0;
+  uint8_t last = 0;
+  uint8_t worst = 0;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    increment = gIncrement;
+    last = gLastCycles;
+    worst = gMaxCycles;
+  }
+  Serial.print(F("wave "));
+  printPinLabel(gPin);
+  switch (gShape) {
+    case WaveShape::Sine:
+      Serial.print(F(" sine "));
+      break;
+    case WaveShape::Triangle:
+      Serial.print(F(" tri "));
+      break;
+    case WaveShape::User:
+      Serial.print(F(" file "));
+      break;
+  }
+  const uint32_t milliHz =
+      static_cast<uint32_t>((static_cast<uint64_t>(increment) * F_CPU * 1000U / 510U) >> 32);
+  Serial.print(milliHz / 1000UL);
+  Serial.write('.');
+  print3Digits(milliHz % 1000UL);
+  Serial.print(F(" Hz, step "));
+  printHundredths(static_cast<uint32_t>((F_CPU * 100000000ULL / 510U) >> 32));
+  Serial.print(F(" uHz, "));
+  printHundredths(F_CPU * 100UL / 510U);
+  Serial.println(F(" Hz sampling"));
+  Serial.print(F("ISR "));
+  Serial.print(last);
+  Serial.print(F(" cycles (max "));
+  Serial.print(worst);
+  Serial.print(F(") of 510 = "));
+  printHundredths(worst * 10000UL / 510U);
+  Serial.print(F("% CPU, ceiling ~"));
+  Serial.print(worst != 0 ? F_CPU / worst : 0UL);
+  Serial.println(F(" Hz"));
+}
+
+#if FEATURE_FS
+// Text file of 2..kWaveUserPoints sample values, 0..255, decimal or 0x hex, separated by
+// spaces, commas or newlines.
+bool waveLoadFile(const char *path) {
+  uint8_t nodeIndex = kFsRootParent;
+  FsEntry entry;
+  if (!fsResolvePath(path, nodeIndex, entry) || entry.isDir) {
+    return false;
+  }
+  uint8_t points[kWaveUserPoints];
+  uint8_t count = 0;
+  char token[6];
+  uint8_t len = 0;
+  for (uint16_t i = 0; i <= entry.dataLen; ++i) {
+    const char c = i < entry.dataLen
+                       ? static_cast<char>(EEPROM.read(static_cast<int>(entry.dataStart + i)))
+                       : ' ';
+    if (c != ' ' && c != ',' && c != '\n' && c != '\r' && c != '\t') {
+      if (len == sizeof(token) - 1) {
+        return false;
+      }
+      token[len++] = c;
+      continue;
+    }
+    if (len == 0) {
+      continue;
+    }
+    token[len] = '\0';
+    len = 0;
+    if (count == kWaveUserPoints || !parseByteValue(token, points[count])) {
+      return false;
+    }
+    ++count;
+  }
+  return waveLoadUser(points, count);
+}
+#endif
+
+#endif
+
+} // namespace shell
+
+#if FEATURE_WAVE
+// One sample per Timer2 overflow. TCNT2 has been counting CPU cycles up from BOTTOM since
+// the overflow, so reading it last gives the latency plus the cost of this handler.
+ISR(TIMER2_OVF_vect) {
+  using namespace shell;
+  const uint32_t phase = gPhase + gIncrement;
+  gPhase = phase;
+  const uint8_t index = static_cast<uint8_t>(phase >> 24);
+  const uint8_t sample =
+      gUserShape ? gUserTable[index >> 2] : pgm_read_byte(gFlashTable + index);
+  if (gDuty8 != nullptr) {
+    *gDuty8 = sample;
+  } else if (gDuty16 != nullptr) {
+    *gDuty16 = sample;
+  }
+  const uint8_t cycles = TCNT2;
+  gLastCycles = cycles;
+  if (cycles > gMaxCycles) {
+    gMaxCycles = cycles;
+  }
+}
+#endif
@@ -0,0 +1,302 @@
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+#include <vector>
+
+#include "shell_math.hpp"
+
+using namespace shell;
+
+namespace {
+
+// Decoded frames are at most kBinFrameSize (48) bytes, CRC included.
+constexpr uint8_t kFrameSize = 48;
+constexpr uint32_t kBaud = 57600;
+constexpr uint32_t kBitsPerByte = 10; // 8N1
+
+std::vector<uint8_t> gWire;
+
+void putWire(const uint8_t *bytes, uint8_t count) {
+  gWire.insert(gWire.end(), bytes, bytes + count);
+}
+
+// What sendFrame() puts on the wire for `data`.
+std::vector<uint8_t> encode(const uint8_t *data, uint8_t len) {
+  uint8_t frame[kFrameMaxData + 2];
+  memcpy(frame, data, len);
+  gWire.clear();
+  encodeFrame(frame, len, putWire);
+  return gWire;
+}
+
+// COBS as the paper describes it, one block per zero byte and a 0xFF block after every 254
+// bytes without one.
+std::vector<uint8_t> referenceCobs(const std::vector<uint8_t> &data) {
+  std::vector<uint8_t> out(1, 0);
+  size_t codeAt = 0;
+  for (uint8_t byte : data) {
+    if (out.size() - codeAt == 0xFF) {
+      out[codeAt] = 0xFF;
+      codeAt = out.size();
+      out.push_back(0);
+    }
+    if (byte == 0) {
+      out[codeAt] = static_cast<uint8_t>(out.size() - codeAt);
+      codeAt = out.size();
+      out.push_back(0);
+      continue;
+    }
+    out.push_back(byte);
+  }
+  out[codeAt] = static_cast<uint8_t>(out.size() - codeAt);
+  out.push_back(0);
+  return out;
+}
+
+void fillFrame(uint8_t *data, uint8_t len, uint8_t seed) {
+  for (uint8_t i = 0; i < len; ++i) {
+    // Every fifth byte is zero so the encoder has blocks to split.
+    data[i] = (i % 5U == 2U) ? 0 : static_cast<uint8_t>(seed + i * 37U);
+  }
+}
+
+// Decodes a frame as handleFrame() sees it: the bytes before the delimiter.
+uint8_t decodeWire(const std::vector<uint8_t> &wire, uint8_t *out) {
+  if (wire.size() < 2 || wire.size() - 1U > kFrameSize + 2U) {
+    return 0;
+  }
+  memcpy(out, wire.data(), wire.size() - 1U);
+  return cobsDecode(out, static_cast<uint8_t>(wire.size() - 1U));
+}
+
+} // namespace
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_crc16_check_value() {
+  const char text[] = "123456789";
+  TEST_ASSERT_EQUAL_HEX16(0x29B1, crc16(reinterpret_cast<const uint8_t *>(text), 9));
+  TEST_ASSERT_EQUAL_HEX16(0xFFFF, crc16(nullptr, 0));
+}
+
+void test_cobs_decode_known_vectors() {
+  struct Vector {
+    uint8_t encoded[8];
+    uint8_t encodedLen;
+    uint8_t decoded[8];
+    uint8_t decodedLen;
+  };
+  const Vector vectors[] = {
+      {{0x01, 0x01}, 2, {0x00}, 1},
+      {{0x01, 0x01, 0x01}, 3, {0x00, 0x00}, 2},
+      {{0x03, 0x11, 0x22, 0x02, 0x33}, 5, {0x11, 0x22, 0x00, 0x33}, 4},
+      {{0x05, 0x11, 0x22, 0x33, 0x44}, 5, {0x11, 0x22, 0x33, 0x44}, 4},
+      {{0x02, 0x11, 0x01, 0x01, 0x01}, 5, {0x11, 0x00, 0x00, 0x00}, 4},
+  };
+  for (const Vector &vector : vectors) {
+    uint8_t buf[8];
+    memcpy(buf, vector.encoded, vector.encodedLen);
+    TEST_ASSERT_EQUAL_UINT8(vector.decodedLen, cobsDecode(buf, vector.encodedLen));
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(vector.decoded, buf, vector.decodedLen);
+  }
+}
+
+void test_cobs_decode_rejects_malformed() {
+  uint8_t zeroCode[] = {0x02, 0x11, 0x00, 0x22};
+  TEST_ASSERT_EQUAL_UINT8(0, cobsDecode(zeroCode, sizeof(zeroCode)));
+  uint8_t overrun[] = {0x05, 0x11, 0x22};
+  TEST_ASSERT_EQUAL_UINT8(0, cobsDecode(overrun, sizeof(overrun)));
+  uint8_t lateOverrun[] = {0x02, 0x11, 0x04, 0x22};
+  TEST_ASSERT_EQUAL_UINT8(0, cobsDecode(lateOverrun, sizeof(lateOverrun)));
+}
+
+// sendFrame() output: CRC appended low byte first, COBS as specified, one trailing 0x00.
+void test_send_frame_encoding() {
+  const uint8_t hello[] = {0x00, 0x00, 0x01};
+  const std::vector<uint8_t> wire = encode(hello, sizeof(hello));
+  const uint16_t crc = crc16(hello, sizeof(hello));
+  const std::vector<uint8_t> expected =
+      referenceCobs({0x00, 0x00, 0x01, static_cast<uint8_t>(crc & 0xFFU),
+                     static_cast<uint8_t>(crc >> 8)});
+  TEST_ASSERT_EQUAL_UINT32(expected.size(), wire.size());
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(expected.data(), wire.data(), wire.size());
+
+  for (uint8_t len = 0; len <= kFrameSize - 2U; ++len) {
+    uint8_t data[kFrameSize];
+    fillFrame(data, len, len);
+    const std::vector<uint8_t> out = encode(data, len);
+    std::vector<uint8_t> plain(data, data + len);
+    const uint16_t sum = crc16(data, len);
+    plain.push_back(static_cast<uint8_t>(sum & 0xFFU));
+    plain.push_back(static_cast<uint8_t>(sum >> 8));
+    const std::vector<uint8_t> reference = referenceCobs(plain);
+    TEST_ASSERT_EQUAL_UINT32(reference.size(), out.size());
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(reference.data(), out.data(), out.size());
+    TEST_ASSERT_TRUE(memchr(out.data(), 0, out.size() - 1U) == nullptr);
+  }
+}
+
+// Frames long enough for 0xFF blocks, including one whose 255th byte, the CRC's high
+// byte, is the zero right after a full block.
+void test_send_frame_long_blocks() {
+  uint8_t data[kFrameMaxData];
+  bool zeroAfterFullBlock = false;
+  for (uint16_t seed = 0; seed < 4096; ++seed) {
+    for (uint8_t i = 0; i < kFrameMaxData; ++i) {
+      data[i] = static_cast<uint8_t>((seed + i * 7U) % 255U + 1U);
+    }
+    const uint8_t len = static_cast<uint8_t>(kFrameMaxData - seed % 4U);
+    const uint16_t sum = crc16(data, len);
+    std::vector<uint8_t> plain(data, data + len);
+    plain.push_back(static_cast<uint8_t>(sum & 0xFFU));
+    plain.push_back(static_cast<uint8_t>(sum >> 8));
+    const std::vector<uint8_t> reference = referenceCobs(plain);
+    const std::vector<uint8_t> out = encode(data, len);
+    TEST_ASSERT_EQUAL_UINT32(reference.size(), out.size());
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(reference.data(), out.data(), out.size());
+    TEST_ASSERT_TRUE(memchr(out.data(), 0, out.size() - 1U) == nullptr);
+    if (len == kFrameMaxData && (sum & 0xFFU) != 0 && (sum >> 8) == 0) {
+      zeroAfterFullBlock = true;
+    }
+  }
+  TEST_ASSERT_TRUE(zeroAfterFullBlock);
+}
+
+void test_frame_round_trip() {
+  for (uint8_t len = 2; len <= kFrameSize - 2U; ++len) {
+    uint8_t data[kFrameSize];
+    fillFrame(data, len, static_cast<uint8_t>(len * 11U));
+    uint8_t decoded[kFrameSize + 2];
+    const uint8_t decodedLen = decodeWire(encode(data, len), decoded);
+    TEST_ASSERT_EQUAL_UINT8(len + 2U, decodedLen);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(data, decoded, len);
+    TEST_ASSERT_TRUE(frameCrcOk(decoded, decodedLen));
+  }
+}
+
+// A flipped bit on the wire makes the frame undecodable, too short, or fail its CRC. A
+// flip to 0x00 ends the frame early and is left out.
+void test_crc_framing_rejects_corruption() {
+  uint8_t data[] = {0x07, 0x22, 0x48, 0x02, 0x00, 0x10};
+  const std::vector<uint8_t> wire = encode(data, sizeof(data));
+  for (size_t at = 0; at + 1U < wire.size(); ++at) {
+    for (uint8_t bit = 0; bit < 8; ++bit) {
+      std::vector<uint8_t> bad = wire;
+      bad[at] = static_cast<uint8_t>(bad[at] ^ (1U << bit));
+      if (bad[at] == 0) {
+        continue;
+      }
+      uint8_t decoded[kFrameSize + 2];
+      const uint8_t len = decodeWire(bad, decoded);
+      TEST_ASSERT_FALSE(len >= 4 && frameCrcOk(decoded, len));
+    }
+  }
+}
+
+// Bytes on the wire and host-side decode time for one request and its reply, text shell
+// against binary frames. The text reply is what the firmware prints, prompt included; the
+// echo of the command runs while the request is still arriving and is not counted. The
+// round trips per second are what the UART alone allows.
+void test_throughput_against_text() {
+  struct Exchange {
+    const char *name;
+    const char *command;
+    uint8_t request[8];
+    uint8_t requestLen;
+    uint8_t dataLen;
+  };
+  const Exchange exchanges[] = {
+      {"i2crr 2 bytes", "i2crr 0x48 0 2\n", {0x01, 0x22, 0x48, 0x02, 0x00}, 5, 2},
+      {"eepread 32 bytes", "eepread 0 32\n", {0x01, 0x30, 0x00, 0x00, 0x20}, 5, 32},
+  };
+  for (const Exchange &exchange : exchanges) {
+    uint8_t data[32];
+    fillFrame(data, exchange.dataLen, 0x5A);
+
+    char reply[256];
+    size_t replyLen = 0;
+    if (exchange.dataLen == 2) {
+      replyLen = snprintf(reply, sizeof(reply),
+                          "i2crr 0x48 reg 0x00 -> 2 byte(s): 0x%02X 0x%02X\r\n", data[0], data[1]);
+    } else {
+      replyLen = snprintf(reply, sizeof(reply), "EEPROM read 32 byte(s) @ 0x0000\r\n");
+      for (uint8_t i = 0; i < exchange.dataLen; ++i) {
+        if (i % 16U == 0) {
+          replyLen += snprintf(reply + replyLen, sizeof(reply) - replyLen, "0x%04X:", i);
+        }
+        replyLen += snprintf(reply + replyLen, sizeof(reply) - replyLen, " %02X", data[i]);
+        if (i % 16U == 15U) {
+          replyLen += snprintf(reply + replyLen, sizeof(reply) - replyLen, "\r\n");
+        }
+      }
+    }
+    replyLen += snprintf(reply + replyLen, sizeof(reply) - replyLen, "arduino$ ");
+    const size_t textBytes = strlen(exchange.command) + replyLen;
+
+    uint8_t response[kFrameSize] = {0x01, 0x00};
+    memcpy(response + 2, data, exchange.dataLen);
+    const std::vector<uint8_t> responseWire =
+        encode(response, static_cast<uint8_t>(2U + exchange.dataLen));
+    const size_t binaryBytes = encode(exchange.request, exchange.requestLen).size() +
+                               responseWire.size();
+
+    // Host side: pull the data bytes out of each reply.
+    constexpr uint32_t kRounds = 20000;
+    uint32_t checksum = 0;
+    const auto textStart = std::chrono::steady_clock::now();
+    for (uint32_t round = 0; round < kRounds; ++round) {
+      const char *p = strchr(reply, ':') + 1;
+      for (uint8_t i = 0; i < exchange.dataLen; ++i) {
+        char *end = nullptr;
+        checksum += static_cast<uint32_t>(strtoul(p, &end, 16));
+        p = end;
+        if (exchange.dataLen != 2 && i % 16U == 15U && i + 1U < exchange.dataLen) {
+          p = strchr(p, ':') + 1;
+        }
+      }
+    }
+    const auto binaryStart = std::chrono::steady_clock::now();
+    for (uint32_t round = 0; round < kRounds; ++round) {
+      uint8_t decoded[kFrameSize + 2];
+      const uint8_t len = decodeWire(responseWire, decoded);
+      TEST_ASSERT_TRUE(frameCrcOk(decoded, len));
+      for (uint8_t i = 2; i < len - 2U; ++i) {
+        checksum -= decoded[i];
+      }
+    }
+    const auto binaryEnd = std::chrono::steady_clock::now();
+    TEST_ASSERT_EQUAL_UINT32(0, checksum);
+    const double textNs =
+        std::chrono::duration<double, std::nano>(binaryStart - textStart).count() / kRounds;
+    const double binaryNs =
+        std::chrono::duration<double, std::nano>(binaryEnd - binaryStart).count() / kRounds;
+
+    const double textOps = static_cast<double>(kBaud) / (kBitsPerByte * textBytes);
+    const double binaryOps = static_cast<double>(kBaud) / (kBitsPerByte * binaryBytes);
+    char message[160];
+    snprintf(message, sizeof(message),
+             "%s: text %zu B (%.0f round trips/s), binary %zu B (%.0f round trips/s) at %lu "
+             "baud; host decode text %.0f ns, binary %.0f ns",
+             exchange.name, textBytes, textOps, binaryBytes, binaryOps,
+             static_cast<unsigned long>(kBaud), textNs, binaryNs);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_TRUE(binaryBytes * 2U < textBytes);
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_crc16_check_value);
+  RUN_TEST(test_cobs_decode_known_vectors);
+  RUN_TEST(test_cobs_decode_rejects_malformed);
+  RUN_TEST(test_send_frame_encoding);
+  RUN_TEST(test_send_frame_long_blocks);
+  RUN_TEST(test_frame_round_trip);
+  RUN_TEST(test_crc_framing_rejects_corruption);
+  RUN_TEST(test_throughput_against_text);
+  return UNITY_END();
+}
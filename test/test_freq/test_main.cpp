@@ -0,0 +1,183 @@
+#include <unity.h>
+
+#include "shell_math.hpp"
+
+using namespace shell;
+
+namespace {
+
+constexpr uint32_t kUsPerTick = kCyclesPerTick / (F_CPU / 1000000UL);
+
+// Timer1 as freqStop() and the capture ISR see it: TCNT1, the TOV1 flag and the overflows
+// TIMER1_OVF_vect has counted. The overflow ISR only runs while interrupts are on.
+struct SimTimer1 {
+  uint64_t clocks = 0;
+  uint16_t serviced = 0;
+  bool tov = false;
+
+  uint16_t tcnt() const { return static_cast<uint16_t>(clocks & 0xFFFFU); }
+
+  void clock(uint32_t n, bool interruptsOn) {
+    for (uint32_t i = 0; i < n; ++i) {
+      ++clocks;
+      if (tcnt() == 0) {
+        tov = true;
+      }
+      if (interruptsOn && tov) {
+        ++serviced;
+        tov = false;
+      }
+    }
+  }
+
+  uint32_t stamp(uint16_t count) const { return timer1Stamp(serviced, tov, count); }
+};
+
+// Gate counting on T1: `hz` edges for `gateUs`, the gate opened `phaseUs` into a Timer0
+// tick. Returns the reading freqStop() would make.
+FreqReading gateReading(uint32_t hz, uint32_t gateUs, uint32_t phaseUs) {
+  SimTimer1 timer;
+  const uint64_t edges = static_cast<uint64_t>(hz) * gateUs / 1000000UL;
+  // The last few edges land with interrupts off, after TCCR1B has been cleared.
+  const uint32_t late = edges > 8U ? 8U : static_cast<uint32_t>(edges);
+  timer.clock(static_cast<uint32_t>(edges) - late, true);
+  timer.clock(late, false);
+  const uint32_t ticks = (phaseUs + gateUs) / kUsPerTick - phaseUs / kUsPerTick;
+  FreqReading reading;
+  freqCompute(FreqMode::Gate, timer.stamp(timer.tcnt()), gateSpanUs(ticks), reading);
+  return reading;
+}
+
+// The reading must cover the true rate (in Hz x 100) within its stated error.
+void assertCovers(uint64_t trueX100, const FreqReading &reading) {
+  const uint64_t low = static_cast<uint64_t>(reading.hzX100) - reading.errX100;
+  const uint64_t high = static_cast<uint64_t>(reading.hzX100) + reading.errX100;
+  TEST_ASSERT_TRUE(reading.errX100 <= reading.hzX100);
+  TEST_ASSERT_TRUE(low <= trueX100 + 1U); // hzX100 is truncated
+  TEST_ASSERT_TRUE(high + 1U >= trueX100);
+}
+
+// Capture of an edge at `cycle` whose ISR runs `latency` cycles later. Overflows up to
+// `latency` cycles before the edge have been serviced; later ones are still pending in
+// TOV1, since TIMER1_CAPT_vect outranks TIMER1_OVF_vect.
+uint32_t captureStamp(uint64_t cycle, uint32_t latency) {
+  const uint64_t servicedBefore = cycle > latency ? cycle - latency : 0;
+  const uint16_t serviced = static_cast<uint16_t>(servicedBefore >> 16);
+  const bool pending = ((cycle + latency) >> 16) != serviced;
+  return timer1Stamp(serviced, pending, static_cast<uint16_t>(cycle & 0xFFFFU));
+}
+
+} // namespace
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_gate_counts_5mhz() {
+  for (uint32_t phaseUs = 0; phaseUs < kUsPerTick; ++phaseUs) {
+    const FreqReading reading = gateReading(5000000UL, 1000000UL, phaseUs);
+    TEST_ASSERT_EQUAL_UINT32(5000000UL, reading.events);
+    TEST_ASSERT_EQUAL_UINT32(1000000UL, reading.span);
+    TEST_ASSERT_EQUAL_UINT32(500000000UL, reading.hzX100);
+    assertCovers(500000000ULL, reading);
+  }
+  // A gate that is not a whole number of ticks is still covered by the error bound.
+  for (uint32_t phaseUs = 0; phaseUs < kUsPerTick; ++phaseUs) {
+    assertCovers(500000000ULL, gateReading(5000000UL, 100003UL, phaseUs));
+    assertCovers(500000000ULL, gateReading(5000000UL, 9998UL, phaseUs));
+  }
+}
+
+void test_gate_counts_slow_signal() {
+  for (uint32_t phaseUs = 0; phaseUs < kUsPerTick; ++phaseUs) {
+    assertCovers(123400ULL, gateReading(1234UL, 1000001UL, phaseUs));
+  }
+}
+
+// TCNT1 wrapped after interrupts went off for the gate close: TOV1 carries the overflow.
+void test_overflow_pending_at_gate_close() {
+  SimTimer1 timer;
+  timer.clock(3UL * 65536UL - 5U, true);
+  timer.clock(10, false);
+  TEST_ASSERT_TRUE(timer.tov);
+  TEST_ASSERT_EQUAL_UINT16(5, timer.tcnt());
+  TEST_ASSERT_EQUAL_UINT16(2, timer.serviced);
+  TEST_ASSERT_EQUAL_UINT32(3UL * 65536UL + 5U, timer.stamp(timer.tcnt()));
+
+  // No wrap since interrupts went off: nothing to add.
+  SimTimer1 quiet;
+  quiet.clock(3UL * 65536UL - 20U, true);
+  quiet.clock(10, false);
+  TEST_ASSERT_FALSE(quiet.tov);
+  TEST_ASSERT_EQUAL_UINT32(3UL * 65536UL - 10U, quiet.stamp(quiet.tcnt()));
+}
+
+// Edges on either side of a TCNT1 wrap, with the overflow serviced or still pending when the
+// capture ISR reads ICR1.
+void test_capture_stamps_across_wrap() {
+  const uint32_t latencies[] = {0, 40, 200, 4000};
+  for (uint32_t latency : latencies) {
+    for (uint64_t wrap = 65536U; wrap <= 4U * 65536U; wrap += 65536U) {
+      for (int32_t offset = -300; offset <= 300; ++offset) {
+        const uint64_t cycle = wrap + offset;
+        TEST_ASSERT_EQUAL_UINT32(static_cast<uint32_t>(cycle), captureStamp(cycle, latency));
+      }
+    }
+  }
+}
+
+void test_reciprocal_across_wrap() {
+  // 1 kHz from just before the first wrap: 16000 cycles per period.
+  const uint64_t first = 65536U - 7000U;
+  const uint32_t periods = 9;
+  const uint32_t firstStamp = captureStamp(first, 80);
+  const uint32_t lastStamp = captureStamp(first + 16000ULL * periods, 80);
+  FreqReading reading;
+  freqCompute(FreqMode::Reciprocal, periods, lastStamp - firstStamp, reading);
+  TEST_ASSERT_EQUAL_UINT32(144000UL, reading.span);
+  TEST_ASSERT_EQUAL_UINT32(100000UL, reading.hzX100);
+  assertCovers(100000ULL, reading);
+
+  // 3 kHz is not a whole number of cycles: stamps are one cycle off at most.
+  const double period = static_cast<double>(F_CPU) / 3000.0;
+  const uint64_t start = 2U * 65536U - 100U;
+  const uint32_t a = captureStamp(start, 80);
+  const uint32_t b = captureStamp(start + static_cast<uint64_t>(period * 300.0), 80);
+  freqCompute(FreqMode::Reciprocal, 300, b - a, reading);
+  assertCovers(300000ULL, reading);
+}
+
+void test_too_fast_capture() {
+  TEST_ASSERT_TRUE(captureTooClose(1000U, 1000U + kCaptureMinCycles - 1U));
+  TEST_ASSERT_FALSE(captureTooClose(1000U, 1000U + kCaptureMinCycles));
+  TEST_ASSERT_TRUE(captureTooClose(0xFFFFFF80UL, 0x00000010UL));
+  TEST_ASSERT_FALSE(captureTooClose(0xFFFFFF80UL, 0x00000080UL));
+
+  // 100 kHz (160 cycles) is flagged right at a TCNT1 wrap; 50 kHz (320 cycles) is not.
+  const uint64_t start = 65536U - 200U;
+  TEST_ASSERT_TRUE(captureTooClose(captureStamp(start, 60), captureStamp(start + 160U, 60)));
+  TEST_ASSERT_FALSE(captureTooClose(captureStamp(start, 60), captureStamp(start + 320U, 60)));
+}
+
+void test_empty_window() {
+  FreqReading reading;
+  reading.hzX100 = 1;
+  freqCompute(FreqMode::Reciprocal, 0, 0, reading);
+  TEST_ASSERT_EQUAL_UINT32(0, reading.hzX100);
+  TEST_ASSERT_EQUAL_UINT32(0, reading.errX100);
+  freqCompute(FreqMode::Gate, 0, 1000000UL, reading);
+  TEST_ASSERT_EQUAL_UINT32(0, reading.hzX100);
+  TEST_ASSERT_EQUAL_UINT32(0, reading.resPpmX100);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_gate_counts_5mhz);
+  RUN_TEST(test_gate_counts_slow_signal);
+  RUN_TEST(test_overflow_pending_at_gate_close);
+  RUN_TEST(test_capture_stamps_across_wrap);
+  RUN_TEST(test_reciprocal_across_wrap);
+  RUN_TEST(test_too_fast_capture);
+  RUN_TEST(test_empty_window);
+  return UNITY_END();
+}
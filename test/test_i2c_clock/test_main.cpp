@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <unity.h>
+
+#include "shell_math.hpp"
+
+using namespace shell;
+
+namespace {
+
+// SCL dividers of every TWPS x TWBR setting, in the order the search prefers on a tie.
+uint32_t gDividers[4 * 256];
+
+uint32_t dividerOf(const I2cClock &clock) {
+  return 16UL + (static_cast<uint32_t>(clock.twbr) << (2U * clock.twps + 1U));
+}
+
+// Tries all 1024 settings; returns the index of the first one closest to hz.
+uint16_t bruteForce(uint32_t hz) {
+  uint64_t bestNum = 0;
+  uint32_t bestDivider = 0;
+  uint16_t best = 0;
+  for (uint16_t i = 0; i < 4 * 256; ++i) {
+    const uint32_t divider = gDividers[i];
+    const uint64_t target = static_cast<uint64_t>(hz) * divider;
+    const uint64_t num = target > F_CPU ? target - F_CPU : F_CPU - target;
+    if (bestDivider == 0 || num * bestDivider < bestNum * divider) {
+      bestNum = num;
+      bestDivider = divider;
+      best = i;
+    }
+  }
+  return best;
+}
+
+} // namespace
+
+void setUp() {
+  for (uint16_t i = 0; i < 4 * 256; ++i) {
+    gDividers[i] = dividerOf({static_cast<uint8_t>(i & 0xFFU), static_cast<uint8_t>(i >> 8)});
+  }
+}
+
+void tearDown() {}
+
+void test_refuses_rates_out_of_range() {
+  I2cClock clock = {0x5A, 3};
+  TEST_ASSERT_FALSE(i2cClockFor(0, clock));
+  TEST_ASSERT_FALSE(i2cClockFor(kI2cMinHz - 1U, clock));
+  TEST_ASSERT_FALSE(i2cClockFor(kI2cMaxHz + 1U, clock));
+  TEST_ASSERT_FALSE(i2cClockFor(0xFFFFFFFFUL, clock));
+  TEST_ASSERT_EQUAL_UINT8(0x5A, clock.twbr);
+  TEST_ASSERT_EQUAL_UINT8(3, clock.twps);
+  TEST_ASSERT_TRUE(i2cClockFor(kI2cMinHz, clock));
+  TEST_ASSERT_TRUE(i2cClockFor(kI2cMaxHz, clock));
+}
+
+void test_range_ends_are_the_extreme_settings() {
+  I2cClock clock;
+  TEST_ASSERT_TRUE(i2cClockFor(kI2cMaxHz, clock));
+  TEST_ASSERT_EQUAL_UINT8(0, clock.twbr);
+  TEST_ASSERT_EQUAL_UINT8(0, clock.twps);
+  TEST_ASSERT_TRUE(i2cClockFor(kI2cMinHz, clock));
+  TEST_ASSERT_EQUAL_UINT8(255, clock.twbr);
+  TEST_ASSERT_EQUAL_UINT8(3, clock.twps);
+}
+
+void test_standard_rates() {
+  I2cClock clock;
+  TEST_ASSERT_TRUE(i2cClockFor(100000UL, clock));
+  TEST_ASSERT_EQUAL_UINT8(72, clock.twbr);
+  TEST_ASSERT_EQUAL_UINT8(0, clock.twps);
+  TEST_ASSERT_EQUAL_UINT32(10000000UL, i2cClockHzX100(clock));
+  TEST_ASSERT_TRUE(i2cClockFor(400000UL, clock));
+  TEST_ASSERT_EQUAL_UINT8(12, clock.twbr);
+  TEST_ASSERT_EQUAL_UINT8(0, clock.twps);
+  TEST_ASSERT_EQUAL_UINT32(40000000UL, i2cClockHzX100(clock));
+}
+
+// Every rate the command accepts gets the same setting as trying all 1024 of them.
+void test_matches_brute_force_over_full_range() {
+  for (uint32_t hz = kI2cMinHz; hz <= kI2cMaxHz; ++hz) {
+    I2cClock clock;
+    TEST_ASSERT_TRUE(i2cClockFor(hz, clock));
+    const uint16_t best = bruteForce(hz);
+    const uint16_t found = static_cast<uint16_t>((clock.twps << 8) | clock.twbr);
+    if (found != best) {
+      char message[64];
+      snprintf(message, sizeof(message), "%lu Hz", static_cast<unsigned long>(hz));
+      TEST_ASSERT_EQUAL_UINT32_MESSAGE(best, found, message);
+    }
+  }
+}
+
+void test_reported_rate_is_rounded_to_hundredths() {
+  for (uint16_t i = 0; i < 4 * 256; ++i) {
+    const I2cClock clock = {static_cast<uint8_t>(i & 0xFFU), static_cast<uint8_t>(i >> 8)};
+    const uint64_t scaled = static_cast<uint64_t>(F_CPU) * 100U;
+    const uint32_t actual = i2cClockHzX100(clock);
+    const uint64_t low = static_cast<uint64_t>(actual) * gDividers[i];
+    TEST_ASSERT_TRUE(low <= scaled + gDividers[i] / 2U);
+    TEST_ASSERT_TRUE(low + gDividers[i] > scaled + gDividers[i] / 2U);
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_refuses_rates_out_of_range);
+  RUN_TEST(test_range_ends_are_the_extreme_settings);
+  RUN_TEST(test_standard_rates);
+  RUN_TEST(test_matches_brute_force_over_full_range);
+  RUN_TEST(test_reported_rate_is_rounded_to_hundredths);
+  return UNITY_END();
+}